@@ -1,5 +1,30 @@
-option (ENABLE_COMPLEX_X2 "Use Complex type vector optimizations (including AVX)" ON)
+option (ENABLE_COMPLEX_X2 "Compile Complex type vector optimizations (including AVX), selected at runtime by CPU support" ON)
+
+if (ENABLE_COMPLEX_X2 AND NOT (CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64|i.86|x86)$"))
+    message ("Complex_x2 kernels are only available for x86 processors.")
+    set(ENABLE_COMPLEX_X2 OFF)
+endif ()
 
 if (ENABLE_COMPLEX_X2)
     set(ENABLE_COMPLEX_X2 ON)
+
+    # Each kernel variant is compiled with the flags of its own instruction set tier, and only that file is.
+    # (QEngineCPU calls a variant only if GetSimdLevel() reports support for its tier.)
+    target_sources (qrack PRIVATE
+        src/qengine/simd_sse2.cpp
+        src/qengine/simd_avx.cpp
+        src/qengine/simd_avx2.cpp
+        src/qengine/simd_avx512.cpp
+        )
+
+    if (MSVC)
+        set_source_files_properties (src/qengine/simd_avx.cpp PROPERTIES COMPILE_FLAGS "/arch:AVX")
+        set_source_files_properties (src/qengine/simd_avx2.cpp PROPERTIES COMPILE_FLAGS "/arch:AVX2")
+        set_source_files_properties (src/qengine/simd_avx512.cpp PROPERTIES COMPILE_FLAGS "/arch:AVX512")
+    else (MSVC)
+        set_source_files_properties (src/qengine/simd_sse2.cpp PROPERTIES COMPILE_FLAGS "-msse2")
+        set_source_files_properties (src/qengine/simd_avx.cpp PROPERTIES COMPILE_FLAGS "-mavx")
+        set_source_files_properties (src/qengine/simd_avx2.cpp PROPERTIES COMPILE_FLAGS "-mavx2 -mfma")
+        set_source_files_properties (src/qengine/simd_avx512.cpp PROPERTIES COMPILE_FLAGS "-mavx512f")
+    endif (MSVC)
 endif (ENABLE_COMPLEX_X2)
@@ -22,22 +22,18 @@ namespace Qrack {
 
 struct BitBuffer;
 struct GateBuffer;
-struct ArithmeticBuffer;
 typedef std::shared_ptr<BitBuffer> BitBufferPtr;
 typedef std::shared_ptr<GateBuffer> GateBufferPtr;
-typedef std::shared_ptr<ArithmeticBuffer> ArithmeticBufferPtr;
 
-// This is a buffer struct that's capable of representing controlled single bit gates and arithmetic, when subclassed.
+// This is a buffer struct that's capable of representing controlled single bit gates, when subclassed.
 struct BitBuffer {
     bool anti;
-    bool isArithmetic;
     std::vector<bitLenInt> controls;
 
-    BitBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen, bool isArith);
+    BitBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen);
 
     BitBuffer(BitBuffer* toCopy)
         : anti(toCopy->anti)
-        , isArithmetic(toCopy->isArithmetic)
         , controls(toCopy->controls)
     {
         // Intentionally left blank.
@@ -75,37 +71,4 @@ struct GateBuffer : public BitBuffer {
 
     virtual bool IsIdentity();
 };
-
-struct ArithmeticBuffer : public BitBuffer {
-    bitLenInt start;
-    bitLenInt length;
-    int toAdd;
-
-    ArithmeticBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen, const bitLenInt& strt,
-        const bitLenInt& len, int intToAdd)
-        : BitBuffer(antiCtrl, cntrls, cntrlLen, true)
-        , start(strt)
-        , length(len)
-        , toAdd(intToAdd)
-    {
-        // Intentionally left blank.
-    }
-
-    ArithmeticBuffer(ArithmeticBuffer* toCopy, int add)
-        : BitBuffer(toCopy)
-        , start(toCopy->start)
-        , length(toCopy->length)
-        , toAdd(toCopy->toAdd + add)
-    {
-        // Intentionally left blank.
-    }
-
-    virtual bool Combinable(BitBufferPtr toCmp);
-
-    virtual void Apply(QInterfacePtr qReg, const bitLenInt& qubitIndex, std::vector<BitBufferPtr>* bitBuffers);
-
-    virtual BitBufferPtr LeftRightCompose(BitBufferPtr rightBuffer);
-
-    virtual bool IsIdentity();
-};
 } // namespace Qrack
@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// Runtime detection of CPU vector instruction set support, so that one build of the
+// library can select the fastest kernel variant available on the host.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+namespace Qrack {
+
+/** Vector instruction set tiers, in ascending order of capability. (SIMD_AVX2 also requires FMA.) */
+enum SimdLevel { SIMD_NONE = 0, SIMD_SSE2 = 1, SIMD_AVX = 2, SIMD_AVX2 = 3, SIMD_AVX512 = 4 };
+
+/** Query the host CPU (and OS register state support) for the highest available SimdLevel. */
+SimdLevel DetectSimdLevel();
+
+/**
+ * SimdLevel used for kernel dispatch, detected once and then cached.
+ *
+ * The "QRACK_SIMD" environment variable ("none", "sse2", "avx", "avx2", or "avx512") can lower the level, for
+ * testing. It can never raise the level above what DetectSimdLevel() reports.
+ */
+SimdLevel GetSimdLevel();
+
+/**
+ * Override the SimdLevel used for kernel dispatch, (clamped to what DetectSimdLevel() reports,) and return the level
+ * that takes effect. This is meant for tests that compare kernel variants, and it must not be called while any engine
+ * is applying gates on another thread.
+ */
+SimdLevel SetSimdLevel(SimdLevel level);
+
+} // namespace Qrack
@@ -134,6 +134,9 @@ public:
     /// Optimized "write" that is only guaranteed to write if either amplitude is nonzero. (Useful for the result of 2x2
     /// tensor slicing.)
     virtual void write2(const bitCapInt& i1, const complex& c1, const bitCapInt& i2, const complex& c2) = 0;
+    /// Exchange "length" consecutive amplitudes starting at "i1" with those starting at "i2." (The two ranges must not
+    /// overlap.)
+    virtual void swap_range(const bitCapInt& i1, const bitCapInt& i2, const bitCapInt& length) = 0;
     virtual void clear() = 0;
     virtual void copy_in(const complex* inArray) = 0;
     virtual void copy_out(complex* outArray) = 0;
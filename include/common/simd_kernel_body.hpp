@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// The body of the vectorized 2x2 matrix kernel, shared by the instruction set tiers declared in simd_kernels.hpp.
+//
+// This is included only by the src/qengine/simd_<tier>.cpp translation units, after each has defined, in an anonymous
+// namespace, the "simd_vec" type holding SIMD_LANES complex numbers and the primitives used below. It is included
+// inside that same anonymous namespace, so each translation unit keeps its own copy, compiled for its own tier.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+simd_real Apply2x2Body(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh)
+{
+    // A complex product m * y is Re(m) * y + Im(m) * (-Im(y), Re(y)), so each matrix entry is held as its real part,
+    // and its imaginary part with alternating sign, to multiply against the amplitudes with their parts swapped.
+    const simd_vec m0r = Set1(mtrx[0]);
+    const simd_vec m0i = SetIm(mtrx[1]);
+    const simd_vec m1r = Set1(mtrx[2]);
+    const simd_vec m1i = SetIm(mtrx[3]);
+    const simd_vec m2r = Set1(mtrx[4]);
+    const simd_vec m2i = SetIm(mtrx[5]);
+    const simd_vec m3r = Set1(mtrx[6]);
+    const simd_vec m3i = SetIm(mtrx[7]);
+    const simd_vec thresh = Set1(normThresh);
+
+    simd_vec nrmSum = Set1(0);
+    size_t idx1[SIMD_LANES];
+    size_t idx2[SIMD_LANES];
+
+    size_t i = 0;
+    for (; (i + SIMD_LANES) <= count; i += SIMD_LANES) {
+        for (size_t j = 0; j < SIMD_LANES; j++) {
+            idx1[j] = bases[i + j] + offset1;
+            idx2[j] = bases[i + j] + offset2;
+        }
+
+        const simd_vec y0 = Load(amps, idx1);
+        const simd_vec y1 = Load(amps, idx2);
+        const simd_vec y0s = Swap(y0);
+        const simd_vec y1s = Swap(y1);
+
+        simd_vec q0 = MulAdd(m1i, y1s, MulAdd(m1r, y1, MulAdd(m0i, y0s, Mul(m0r, y0))));
+        simd_vec q1 = MulAdd(m3i, y1s, MulAdd(m3r, y1, MulAdd(m2i, y0s, Mul(m2r, y0))));
+
+        if (doCalcNorm) {
+            q0 = FloorNorm(q0, thresh, nrmSum);
+            q1 = FloorNorm(q1, thresh, nrmSum);
+        }
+
+        Store(amps, idx1, q0);
+        Store(amps, idx2, q1);
+    }
+
+    // FloorNorm() adds each norm into both the real and the imaginary lane of its complex number.
+    simd_real partNrm = doCalcNorm ? (Sum(nrmSum) / 2) : 0;
+
+    for (; i < count; i++) {
+        simd_real* y[2] = { amps + 2U * (bases[i] + offset1), amps + 2U * (bases[i] + offset2) };
+        const simd_real y0r = y[0][0], y0i = y[0][1], y1r = y[1][0], y1i = y[1][1];
+        for (size_t j = 0; j < 2U; j++) {
+            const simd_real* m = mtrx + 4U * j;
+            const simd_real qr = m[0] * y0r - m[1] * y0i + m[2] * y1r - m[3] * y1i;
+            const simd_real qi = m[0] * y0i + m[1] * y0r + m[2] * y1i + m[3] * y1r;
+            const simd_real nrm = qr * qr + qi * qi;
+            if (doCalcNorm && (nrm < normThresh)) {
+                y[j][0] = 0;
+                y[j][1] = 0;
+            } else {
+                y[j][0] = qr;
+                y[j][1] = qi;
+                partNrm += doCalcNorm ? nrm : 0;
+            }
+        }
+    }
+
+    return partNrm;
+}
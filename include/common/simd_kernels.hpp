@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// Vectorized 2x2 matrix kernels for QEngineCPU, one variant per instruction set tier.
+//
+// Each variant is built in its own translation unit, (src/qengine/simd_<tier>.cpp,) with the compiler flags of its
+// tier. Those translation units include only this header, the intrinsics headers, and simd_kernel_body.hpp, so that
+// no inline or template code compiled with the wider instruction set can be shared with, (and picked by the linker
+// for,) the rest of the library. The variants therefore take plain pointers and integers, rather than Qrack types.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include <cstddef>
+
+#include "config.h"
+
+namespace Qrack {
+
+#if ENABLE_COMPLEX8
+typedef float simd_real;
+#else
+typedef double simd_real;
+#endif
+
+/**
+ * Apply a 2x2 matrix to "count" pairs of amplitudes of a dense state vector.
+ *
+ * "amps" is the state vector, as interleaved real and imaginary parts. "mtrx" is the 2x2 matrix, row major, also as
+ * interleaved real and imaginary parts. For each "i" less than "count," the pair of amplitudes at indices
+ * "bases[i] + offset1" and "bases[i] + offset2" is multiplied by "mtrx."
+ *
+ * If "doCalcNorm" is true, any result with norm less than "normThresh" is set to exactly zero, and the summed norm of
+ * the other results is returned. Otherwise, 0 is returned.
+ */
+typedef simd_real (*Apply2x2Kernel)(simd_real* amps, const size_t* bases, size_t count, size_t offset1,
+    size_t offset2, const simd_real* mtrx, bool doCalcNorm, simd_real normThresh);
+
+simd_real Apply2x2Sse2(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh);
+simd_real Apply2x2Avx(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh);
+simd_real Apply2x2Avx2(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh);
+simd_real Apply2x2Avx512(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh);
+
+} // namespace Qrack
@@ -14,6 +14,7 @@
 #include <memory>
 #include <vector>
 
+#include "common/parallel_for.hpp"
 #include "common/qrack_types.hpp"
 
 namespace Qrack {
@@ -109,4 +110,102 @@ struct UniformHamiltonianOp : HamiltonianOp {
  */
 typedef std::shared_ptr<HamiltonianOp> HamiltonianOpPtr;
 typedef std::vector<HamiltonianOpPtr> Hamiltonian;
+
+/**
+ * One "HamiltonianOp" of a PreparedHamiltonian step, with the permutation of the step's control bits on which it acts.
+ * (For a uniform op, the permutation is unused, since the op acts on every permutation.)
+ */
+struct PreparedHamiltonianTerm {
+    HamiltonianOpPtr op;
+    bitCapIntOcl controlPerm;
+
+    PreparedHamiltonianTerm(HamiltonianOpPtr o, bitCapIntOcl perm)
+        : op(o)
+        , controlPerm(perm)
+    {
+    }
+};
+
+/**
+ * One gate pass of a PreparedHamiltonian. A step without controls holds one or more single bit gates on distinct
+ * targets, applied together as a sequence. A step with controls holds exactly one target, and acts either as a
+ * controlled (or anti-controlled) gate, or, if its terms act on more than one permutation of the controls (or on a
+ * permutation that mixes control and anti-control bits), as a uniformly controlled gate.
+ */
+struct PreparedHamiltonianStep {
+    std::vector<bitLenInt> controls;
+    std::vector<bitLenInt> targets;
+    std::vector<std::vector<PreparedHamiltonianTerm>> terms;
+    bool isUniform;
+    bitCapIntOcl controlPerm;
+    bitCapIntOcl mtrxOffset;
+
+    PreparedHamiltonianStep()
+        : isUniform(false)
+        , controlPerm(0)
+        , mtrxOffset(0)
+    {
+    }
+};
+
+/**
+ * A Hamiltonian, prepared once for repeated calls to QInterface::TimeEvolve().
+ *
+ * Preparation groups the ops into as few gate passes as possible, without changing the result. An op is composed
+ * into an earlier step on the same target and control bits, (or, if it has no controls, added to an earlier step of
+ * uncontrolled gates,) when every step in between acts on a disjoint set of qubits, and so commutes with the op.
+ * Control "toggles" are folded into the step's control permutation, rather than applied as X gates around the op.
+ *
+ * The exponentiated step matrices are cached for the last few distinct values of "timeDiff," so a steady-state time
+ * step neither recomputes exponentials nor allocates. (The cache is discarded if any op matrix is changed in place.)
+ */
+class PreparedHamiltonian {
+protected:
+    Hamiltonian ops;
+    std::vector<complex> opMatrices;
+    std::vector<PreparedHamiltonianStep> steps;
+    /// While adding ops, the (1-based) index of the last step acting on each bit, or 0 if none does
+    std::vector<size_t> bitLastSteps;
+    /// While adding ops, the (1-based) index of the last step of uncontrolled gates, or 0 if there is none
+    size_t lastUncontrolledStep;
+    bitCapIntOcl mtrxLength;
+    std::vector<real1> cachedTimes;
+    std::vector<std::vector<complex>> cachedMtrxs;
+    size_t nextCacheSlot;
+
+    void AddOp(HamiltonianOpPtr op);
+    void ComputeMatrices(real1 timeDiff, complex* mtrxs);
+    /// Update the copy of all op matrices, (to detect changes made to them in place,) returning whether it changed
+    bool UpdateOpMatrices();
+
+public:
+    explicit PreparedHamiltonian(const Hamiltonian& h);
+
+    /// Whether this was prepared from the same ops as "h," in the same order
+    bool IsPreparedFrom(const Hamiltonian& h) const;
+
+    /// Get the fused gate passes, in order of application
+    const std::vector<PreparedHamiltonianStep>& GetSteps() const { return steps; }
+
+    /**
+     * Get the exponentiated matrices of all steps for a time step of "timeDiff," (each step's matrices starting at
+     * its "mtrxOffset,") computing them only if "timeDiff" is not cached.
+     */
+    const complex* GetMatrices(real1 timeDiff);
+};
+
+typedef std::shared_ptr<PreparedHamiltonian> PreparedHamiltonianPtr;
+
+/**
+ * Evolve the dense state vector "stateVec," of "qubitCount" qubits, by the exact propagator e^{-i (H_0 + H_1 + ...
+ * + H_(N - 1)) t} of the Hamiltonian "h," for time "timeDiff," with Lanczos (Krylov subspace) exponentiation.
+ *
+ * Every op matrix must be Hermitian. (A uniform op contributes a Hermitian 2x2 block for each control permutation,
+ * which is exponentiated as e^{-i H t}, unlike the e^{-H t} of the per-op TimeEvolve() path.)
+ * The Hamiltonian is applied as a sparse operator, in one parallel pass over the state vector per Krylov vector, and
+ * the time step is subdivided adaptively, so that the estimated error of the whole evolution stays within
+ * "tolerance." A "tolerance" of REAL1_DEFAULT_ARG selects a default suited to the floating point precision.
+ */
+void KrylovTimeEvolve(const Hamiltonian& h, real1 timeDiff, real1 tolerance, complex* stateVec,
+    const bitLenInt& qubitCount, ParallelFor& pf);
 } // namespace Qrack
@@ -41,6 +41,13 @@ protected:
         }
     }
 
+    /**
+     * Draw a permutation at random from the "lengthPower" (unnormalized) probabilities of "probArray," which sum to
+     * "totProb." Returns the permutation, and sets "nrmlzr" to its probability, from the same array.
+     */
+    bitCapIntOcl DrawPermutation(
+        const real1* probArray, const bitCapIntOcl& lengthPower, const real1& totProb, real1& nrmlzr);
+
 public:
     QEngine(bitLenInt qBitCount, qrack_rand_gen_ptr rgp = nullptr, bool doNorm = false, bool randomGlobalPhase = true,
         bool useHostMem = false, bool useHardwareRNG = true, real1 norm_thresh = REAL1_DEFAULT_ARG)
@@ -35,6 +35,51 @@ class QEngineCPU : virtual public QEngine, public ParallelFor {
 protected:
     StateVectorPtr stateVec;
     bool isSparse;
+    /// Physical bit index of each logical qubit, (or empty, while that map is the identity)
+    std::vector<bitLenInt> qubitMap;
+
+    /// A deferred diagonal operator: a phase factor on each (physical) permutation that meets the condition
+    struct PhaseTerm {
+        enum Condition {
+            /// (perm & mask) == value
+            MASK_EQUALS,
+            /// The bits of (perm & mask) have odd parity, and all bits in flagMask are set.
+            ODD_PARITY,
+            /// The register (perm & mask) >> shift is less than value, and all bits in flagMask are set.
+            LESS_THAN
+        };
+
+        Condition condition;
+        bitCapInt mask;
+        bitCapInt value;
+        bitCapInt flagMask;
+        bitLenInt shift;
+        complex factor;
+
+        bool Matches(const bitCapInt& perm) const
+        {
+            switch (condition) {
+            case MASK_EQUALS:
+                return (perm & mask) == value;
+            case ODD_PARITY: {
+                if ((perm & flagMask) != flagMask) {
+                    return false;
+                }
+                bool isOdd = false;
+                for (bitCapInt v = perm & mask; v; v &= v - ONE_BCI) {
+                    isOdd = !isOdd;
+                }
+                return isOdd;
+            }
+            default:
+                return (((perm & mask) >> shift) < value) && ((perm & flagMask) == flagMask);
+            }
+        }
+    };
+    /// Diagonal operators that have been applied, but not yet written to the state vector
+    std::vector<PhaseTerm> phaseTerms;
+    /// A deferred global phase factor, kept apart from "phaseTerms," since it needs no pass of its own
+    complex globalPhaseTerm;
 
     StateVectorSparsePtr CastStateVecSparse() { return std::dynamic_pointer_cast<StateVectorSparse>(stateVec); }
 
@@ -55,6 +100,8 @@ public:
     virtual void GetQuantumState(complex* outputState);
     virtual void GetProbs(real1* outputProbs);
     virtual complex GetAmplitude(bitCapInt perm);
+    virtual std::vector<std::pair<bitCapInt, complex>> GetTopAmplitudes(const bitCapIntOcl& k);
+    virtual void GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps);
     virtual void SetAmplitude(bitCapInt perm, complex amp);
 
     virtual bitLenInt Compose(QEngineCPUPtr toCopy);
@@ -73,6 +120,36 @@ public:
 
     /** @} */
 
+    /**
+     * \defgroup BasicGates Basic quantum gate primitives
+     *@{
+     */
+
+    virtual void ApplySinglePhase(const complex topLeft, const complex bottomRight, bitLenInt qubitIndex);
+    virtual void ApplySingleInvert(const complex topRight, const complex bottomLeft, bitLenInt qubitIndex);
+    virtual void ApplyControlledSinglePhase(const bitLenInt* controls, const bitLenInt& controlLen,
+        const bitLenInt& target, const complex topLeft, const complex bottomRight);
+    virtual void ApplyControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
+        const bitLenInt& target, const complex topRight, const complex bottomLeft);
+    virtual void ApplyAntiControlledSinglePhase(const bitLenInt* controls, const bitLenInt& controlLen,
+        const bitLenInt& target, const complex topLeft, const complex bottomRight);
+    virtual void ApplyAntiControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
+        const bitLenInt& target, const complex topRight, const complex bottomLeft);
+    virtual void ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx);
+    virtual void PhaseParity(real1 radians, bitCapInt mask);
+    virtual void ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitLenInt* controls, const bitLenInt& controlLen, real1 radians);
+    virtual void TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance = REAL1_DEFAULT_ARG);
+    virtual void ApplySingleBitSequence(const complex* mtrxs, const bitLenInt* targets, const unsigned int gateCount);
+    virtual void ApplySingleBitLayer(const complex* mtrxs, bitLenInt start, bitLenInt length);
+
+    using QEngine::FSim;
+    virtual void FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    using QEngine::Swap;
+    virtual void Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+
+    /** @} */
+
     /**
      * \defgroup ArithGate Arithmetic and other opcode-like gate implemenations.
      *
@@ -111,6 +188,10 @@ public:
      * @{
      */
 
+    using QEngine::H;
+    virtual void H(bitLenInt start, bitLenInt length);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
     virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
     virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
     virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
@@ -135,10 +216,26 @@ public:
      * @{
      */
 
+    virtual bool ForceM(bitLenInt qubitIndex, bool result, bool doForce = true, bool doApply = true);
+    virtual bitCapInt ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply = true);
+    virtual bitCapInt ForceMReg(
+        bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true, bool doApply = true);
+    virtual bitCapInt ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true);
     virtual real1 Prob(bitLenInt qubitIndex);
     virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual void ProbAllQubits(real1* probsArray);
     virtual real1 ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation);
     virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
+    virtual void ProbRegAll(const bitLenInt& start, const bitLenInt& length, real1* probsArray);
+    virtual void ProbMaskAll(const bitCapInt& mask, real1* probsArray);
+    virtual std::map<bitCapInt, int> MultiShotMeasureMask(
+        const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots);
+    virtual real1 ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length);
+    virtual void ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitCapIntOcl& stringCount, real1* expectations);
+    virtual real1 ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+        real1* histogram = NULL, const bitCapIntOcl& binCount = 0U, const real1& minCost = ZERO_R1,
+        const real1& maxCost = ZERO_R1);
     virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG);
     virtual bool ApproxCompare(QInterfacePtr toCompare)
     {
@@ -154,10 +251,101 @@ protected:
     virtual void ResetStateVec(StateVectorPtr sv);
 
     void DecomposeDispose(bitLenInt start, bitLenInt length, QEngineCPUPtr dest);
+
+    /// Physical bit index of a logical qubit
+    bitLenInt MapQubit(const bitLenInt& qubit) { return qubitMap.size() ? qubitMap[qubit] : qubit; }
+    /// Start tracking the qubit map explicitly, (if it is still the identity)
+    void InitQubitMap()
+    {
+        if (!qubitMap.size()) {
+            qubitMap.resize(qubitCount);
+            for (bitLenInt i = 0; i < qubitCount; i++) {
+                qubitMap[i] = i;
+            }
+        }
+    }
+    /// Physical permutation (or bit mask) of a logical permutation
+    bitCapInt MapPermutation(const bitCapInt& perm);
+    /**
+     * Translate the offsets and sorted powers of a 2x2 kernel call from logical to physical bits, in place. Returns
+     * the physical powers, which are stored in "mappedPowers" if they differ from "qPowersSorted."
+     */
+    const bitCapInt* MapPairs(bitCapInt& offset1, bitCapInt& offset2, const bitLenInt bitCount,
+        const bitCapInt* qPowersSorted, std::vector<bitCapInt>& mappedPowers);
+    /**
+     * Bring the state vector up to date for direct access by logical index: apply any deferred phase terms, then
+     * permute the state vector to match the logical qubit order, in a single pass, and reset the qubit map.
+     */
+    void MaterializeState();
+    /// Defer a diagonal operator, (with physical masks,) to be applied with any others in a single pass.
+    void AddPhaseTerm(const PhaseTerm& term);
+    /// Defer a "MASK_EQUALS" phase term, (with physical masks).
+    void AddPhaseTerm(const bitCapInt& mask, const bitCapInt& value, const complex& factor);
+    /// Apply all deferred phase terms in a single pass over the state vector.
+    void FlushPhaseTerms();
     virtual void Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
         const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh = REAL1_DEFAULT_ARG);
+    /**
+     * Apply the (inverse) QFT to a contiguous register of a dense state vector, as a radix-2 FFT along the register's
+     * axis. The output is in the same bit order as QInterface::QFT(), which leaves out the final bit reversal.
+     */
+    void ApplyFFT(bitLenInt start, bitLenInt length, bool isInverse);
+    /**
+     * Apply one 2x2 matrix to a run of "runLength" amplitude pairs of the dense state vector, starting from the pair at
+     * "offset | freePerm," and stepping through the bits of "freeMask." Returns the summed norm of the run.
+     */
+    real1 ApplyUniformRun(const complex* mtrx, const real1& nrm, const bitCapInt& offset, bitCapInt freePerm,
+        const bitCapInt& freeMask, const bitCapInt& targetPower, const bitCapInt& runLength);
+#if ENABLE_COMPLEX_X2
+    /**
+     * Vectorized variants of ApplyUniformRun() and (dense) Apply2x2(), which hand batches of amplitude pairs to the
+     * kernel selected by GetSimdLevel(), (see src/qengine/simd.cpp).
+     */
+    real1 ApplyUniformRunSimd(const complex* mtrx, const real1& nrm, const bitCapInt& offset, bitCapInt freePerm,
+        const bitCapInt& freeMask, const bitCapInt& targetPower, const bitCapInt& runLength);
+    void Apply2x2Simd(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
+        const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh);
+#endif
+    /**
+     * Apply a diagonal 2x2 matrix, with the same offsets and sorted powers as Apply2x2(). Only amplitudes with a
+     * diagonal entry other than exactly 1 are read or written.
+     */
+    void ApplyPhase2x2(bitCapInt offset1, bitCapInt offset2, const complex topLeft, const complex bottomRight,
+        const bitLenInt bitCount, const bitCapInt* qPowersSorted);
+    /**
+     * Apply an anti-diagonal 2x2 matrix, with the same offsets and sorted powers as Apply2x2(), as a swap and scale
+     * of each amplitude pair.
+     */
+    void ApplyInvert2x2(bitCapInt offset1, bitCapInt offset2, const complex topRight, const complex bottomLeft,
+        const bitLenInt bitCount, const bitCapInt* qPowersSorted);
+    /**
+     * Swap each amplitude pair touched by a 2x2 matrix, as for a (controlled) Pauli X, with no arithmetic. The offsets
+     * and powers are physical, (already translated through the qubit map).
+     */
+    void ApplySwap2x2(bitCapInt offset1, bitCapInt offset2, const bitLenInt bitCount, const bitCapInt* qPowersSorted);
+    /// Call fn on the base index of each amplitude pair touched by a 2x2 matrix, dense or sparse.
+    void ParForPairs(bitCapInt offset1, bitCapInt offset2, const bitLenInt bitCount, const bitCapInt* qPowersSorted,
+        ParallelFunc fn);
+    void ApplyEitherControlledPhase(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target,
+        const complex topLeft, const complex bottomRight, const bool anti);
+    void ApplyEitherControlledInvert(const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target,
+        const complex topRight, const complex bottomLeft, const bool anti);
     virtual void UpdateRunningNorm(real1 norm_thresh = REAL1_DEFAULT_ARG);
-    virtual void ApplyM(bitCapInt mask, bitCapInt result, complex nrm);
+    virtual void ApplyM(bitCapInt mask, bitCapInt result, complex nrm) { ApplyMFloor(mask, result, nrm, ZERO_R1); }
+    /// ApplyM(), also dropping survivors of (raw) norm less than "norm_thresh," as NormalizeState() would
+    void ApplyMFloor(bitCapInt mask, bitCapInt result, complex nrm, real1 norm_thresh);
+    /// The floor of NormalizeState(), if a normalization is pending that a fused collapse replaces, or else 0
+    real1 PendingNormFloor() { return (doNormalize && (runningNorm != ONE_R1)) ? amplitudeFloor : ZERO_R1; }
+    /// ProbMask(), without normalizing the state first or clamping the result
+    real1 ProbMaskBase(const bitCapInt& mask, const bitCapInt& permutation);
+    /// ProbMaskAll(), without normalizing the state first or clamping the results
+    void ProbMaskAllBase(const bitCapInt& mask, real1* probsArray);
+    /**
+     * Measure (or force) the bits of "regMask" together, drawing the outcome from the raw norms of the state as it
+     * stands, so that renormalization is folded into the collapse. "result" is a (logical) permutation of the mask
+     * bits, used only if "doForce" is set. Returns the outcome. Survivors are floored as in ForceM().
+     */
+    bitCapInt ForceMMask(const bitCapInt& regMask, bitCapInt result, bool doForce, bool doApply);
 
     virtual void INCDECC(
         bitCapInt toMod, const bitLenInt& inOutStart, const bitLenInt& length, const bitLenInt& carryIndex);
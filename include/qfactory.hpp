@@ -13,6 +13,7 @@
 #pragma once
 
 #include "qengine_cpu.hpp"
+#include "qfusion.hpp"
 
 #if ENABLE_OPENCL
 #include "qengine_opencl.hpp"
@@ -41,6 +42,8 @@ QInterfacePtr CreateQuantumInterface(
     case QINTERFACE_QUNIT_MULTI:
         return std::make_shared<QUnitMulti>(subengine1, subengine2, args...);
 #endif
+    case QINTERFACE_QFUSION:
+        return std::make_shared<QFusion>(subengine1, subengine2, args...);
     default:
         return NULL;
     }
@@ -62,6 +65,8 @@ QInterfacePtr CreateQuantumInterface(QInterfaceEngine engine, QInterfaceEngine s
     case QINTERFACE_QUNIT_MULTI:
         return std::make_shared<QUnit>(subengine, args...);
 #endif
+    case QINTERFACE_QFUSION:
+        return std::make_shared<QFusion>(subengine, args...);
     default:
         return NULL;
     }
@@ -0,0 +1,262 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// QFusion adds an optional "gate fusion" layer on top of a QEngine or QUnit.
+// Single bit gates are buffered in per-bit 2x2 matrices, and buffered gates that
+// act on the same bit with the same controls are composed into single products, before
+// ever touching the state vector. Identity products are discarded outright.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#pragma once
+
+#include "bitbuffer.hpp"
+#include "qinterface.hpp"
+
+namespace Qrack {
+
+class QFusion;
+typedef std::shared_ptr<QFusion> QFusionPtr;
+
+/**
+ * A "Qrack::QFusion" is a decorator of another QInterface, (typically a QEngine or a QUnit,) which buffers and composes
+ * (optionally controlled) single bit gates on a per-target-bit basis.
+ *
+ * Consecutive gates on the same target bit, with the same control bits, are multiplied together into a single 2x2
+ * matrix, and composed products that come out to the identity operator are dropped. Buffers are "flushed" to the
+ * underlying QInterface only when an operation that does not commute with them arrives. For probability and
+ * measurement methods, only buffers that target the measured bits are flushed, since gates on other bits cannot change
+ * the measured marginal distribution.
+ */
+class QFusion : public QInterface {
+protected:
+    QInterfaceEngine engine;
+    QInterfaceEngine subengine;
+    int devID;
+    complex phaseFactor;
+    bool useHostRam;
+    bool useRDRAND;
+    bool isSparse;
+    QInterfacePtr qReg;
+    // Buffered gate on each target bit, or NULL
+    std::vector<BitBufferPtr> bitBuffers;
+    // For each bit, the target bits of buffered gates that it controls
+    std::vector<std::vector<bitLenInt>> bitControls;
+
+    virtual void SetQubitCount(bitLenInt qb)
+    {
+        bitBuffers.resize(qb);
+        bitControls.resize(qb);
+        QInterface::SetQubitCount(qb);
+    }
+
+    // Wrap an existing engine, (as for Clone(),) with no buffered gates
+    QFusion(QInterfacePtr reg, QInterfaceEngine eng, QInterfaceEngine subEng, qrack_rand_gen_ptr rgp, complex phaseFac,
+        bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceID, bool useHardwareRNG, bool useSparseStateVec,
+        real1 norm_thresh);
+
+public:
+    QFusion(QInterfaceEngine eng, QInterfaceEngine subEng, bitLenInt qBitCount, bitCapInt initState = 0,
+        qrack_rand_gen_ptr rgp = nullptr, complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = true,
+        bool randomGlobalPhase = true, bool useHostMem = false, int deviceID = -1, bool useHardwareRNG = true,
+        bool useSparseStateVec = false, real1 norm_thresh = REAL1_DEFAULT_ARG, std::vector<bitLenInt> ignored = {});
+    QFusion(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState = 0, qrack_rand_gen_ptr rgp = nullptr,
+        complex phaseFac = CMPLX_DEFAULT_ARG, bool doNorm = true, bool randomGlobalPhase = true,
+        bool useHostMem = false, int deviceId = -1, bool useHardwareRNG = true, bool useSparseStateVec = false,
+        real1 norm_thresh = REAL1_DEFAULT_ARG, std::vector<bitLenInt> ignored = {});
+
+    virtual void SetQuantumState(const complex* inputState);
+    virtual void GetQuantumState(complex* outputState);
+    virtual void GetProbs(real1* outputProbs);
+    virtual complex GetAmplitude(bitCapInt perm);
+    virtual std::vector<std::pair<bitCapInt, complex>> GetTopAmplitudes(const bitCapIntOcl& k);
+    virtual void GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps);
+    virtual void SetAmplitude(bitCapInt perm, complex amp);
+    virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
+    using QInterface::Compose;
+    virtual bitLenInt Compose(QInterfacePtr toCopy);
+    virtual bitLenInt Compose(QInterfacePtr toCopy, bitLenInt start);
+    virtual void Decompose(bitLenInt start, bitLenInt length, QInterfacePtr dest);
+    virtual void Dispose(bitLenInt start, bitLenInt length);
+    virtual void Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm);
+
+    /**
+     * \defgroup BasicGates Basic quantum gate primitives
+     *@{
+     */
+
+    virtual void ApplySingleBit(const complex* mtrx, bitLenInt qubitIndex);
+    virtual void ApplyControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyAntiControlledSingleBit(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx);
+    virtual void ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitLenInt* controls, const bitLenInt& controlLen, real1 radians);
+    virtual void TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance = REAL1_DEFAULT_ARG);
+    virtual void QFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    virtual void IQFT(bitLenInt start, bitLenInt length, bool trySeparate = false);
+    using QInterface::UniformlyControlledSingleBit;
+    virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+        bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+        const bitCapInt& mtrxSkipValueMask);
+    virtual void CSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCSqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void CISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    virtual void AntiCISqrtSwap(
+        const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
+    using QInterface::ForceM;
+    virtual bool ForceM(bitLenInt qubitIndex, bool result, bool doForce = true, bool doApply = true);
+    virtual bitCapInt ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply = true);
+    using QInterface::ForceMReg;
+    virtual bitCapInt ForceMReg(
+        bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true, bool doApply = true);
+    virtual bitCapInt ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true);
+
+    /** @} */
+
+    /**
+     * \defgroup ArithGate Arithmetic and other opcode-like gate implemenations.
+     *
+     * @{
+     */
+
+    virtual void ROL(bitLenInt shift, bitLenInt start, bitLenInt length);
+    virtual void ROR(bitLenInt shift, bitLenInt start, bitLenInt length);
+    virtual void INC(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void CINC(
+        bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen);
+    virtual void INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex);
+    virtual void INCSC(
+        bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length);
+    virtual void INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECSC(
+        bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex);
+    virtual void DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex);
+    virtual void MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length);
+    virtual void MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length);
+    virtual void CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+    virtual void CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+        bitLenInt* controls, bitLenInt controlLen);
+
+    /** @} */
+
+    /**
+     * \defgroup ExtraOps Extra operations and capabilities
+     *
+     * @{
+     */
+
+    virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
+    virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
+    virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
+    virtual void PhaseFlip();
+    virtual void SetReg(bitLenInt start, bitLenInt length, bitCapInt value);
+    virtual bitCapInt IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, unsigned char* values, bool resetValue = true);
+    virtual bitCapInt IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual bitCapInt IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+        bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values);
+    virtual void Hash(bitLenInt start, bitLenInt length, unsigned char* values);
+    virtual void Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+    virtual void FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2);
+
+    /** @} */
+
+    /**
+     * \defgroup UtilityFunc Utility functions
+     *
+     * @{
+     */
+
+    virtual real1 Prob(bitLenInt qubitIndex);
+    virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual void ProbAllQubits(real1* probsArray);
+    virtual real1 ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation);
+    virtual real1 ProbMask(const bitCapInt& mask, const bitCapInt& permutation);
+    virtual void ProbMaskAll(const bitCapInt& mask, real1* probsArray);
+    virtual std::map<bitCapInt, int> MultiShotMeasureMask(
+        const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots);
+    virtual real1 ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length);
+    virtual void ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitCapIntOcl& stringCount, real1* expectations);
+    virtual real1 ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+        real1* histogram = NULL, const bitCapIntOcl& binCount = 0U, const real1& minCost = ZERO_R1,
+        const real1& maxCost = ZERO_R1);
+    virtual bool ApproxCompare(QInterfacePtr toCompare);
+    virtual void UpdateRunningNorm(real1 norm_thresh = REAL1_DEFAULT_ARG);
+    virtual void NormalizeState(real1 nrm = REAL1_DEFAULT_ARG, real1 norm_thresh = REAL1_DEFAULT_ARG);
+    virtual void Finish();
+    virtual bool isFinished();
+    virtual bool TrySeparate(bitLenInt start, bitLenInt length = 1);
+
+    virtual QInterfacePtr Clone();
+
+    /** @} */
+
+protected:
+    void BufferGate(GateBufferPtr bfr, const bitLenInt& target);
+    void ApplyBuffer(const bitLenInt& target);
+    void DiscardBuffer(const bitLenInt& target);
+    void UnregisterControls(const bitLenInt& target);
+
+    /// Apply the buffered gate that targets this bit, if any
+    void FlushTarget(const bitLenInt& qubitIndex)
+    {
+        if (bitBuffers[qubitIndex]) {
+            ApplyBuffer(qubitIndex);
+        }
+    }
+    void FlushTargetReg(const bitLenInt& start, const bitLenInt& length);
+    void FlushTargetMask(const bitCapInt& mask);
+
+    /// Apply every buffered gate that touches this bit, as either target or control
+    void FlushBit(const bitLenInt& qubitIndex);
+    void FlushReg(const bitLenInt& start, const bitLenInt& length)
+    {
+        for (bitLenInt i = 0; i < length; i++) {
+            FlushBit(start + i);
+        }
+    }
+    void FlushArray(const bitLenInt* bitList, const bitLenInt& length)
+    {
+        for (bitLenInt i = 0; i < length; i++) {
+            FlushBit(bitList[i]);
+        }
+    }
+    void FlushAll() { FlushTargetReg(0, qubitCount); }
+    void DiscardAll();
+
+    /// If "toUnwrap" is a QFusion, flush it and return the QInterface it decorates.
+    static QInterfacePtr FlushAndUnwrap(QInterfacePtr toUnwrap);
+};
+} // namespace Qrack
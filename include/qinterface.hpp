@@ -96,6 +96,12 @@ enum QInterfaceEngine {
      */
     QINTERFACE_QUNIT_MULTI,
 
+    /**
+     * Create a QFusion, which buffers and composes single bit gates, (optionally controlled,) before applying them to
+     * the QInterface that it wraps.
+     */
+    QINTERFACE_QFUSION,
+
     QINTERFACE_FIRST = QINTERFACE_CPU,
 #if ENABLE_OPENCL
     QINTERFACE_OPTIMAL = QINTERFACE_OPENCL,
@@ -106,6 +112,22 @@ enum QInterfaceEngine {
     QINTERFACE_MAX
 };
 
+/**
+ * Single qubit Pauli operators, for Pauli string methods like ExpPauli().
+ *
+ * The values match the Q# "Pauli" constants.
+ */
+enum Pauli {
+    /// Pauli Identity operator. Corresponds to Q# constant "PauliI."
+    PauliI = 0U,
+    /// Pauli X operator. Corresponds to Q# constant "PauliX."
+    PauliX = 1U,
+    /// Pauli Y operator. Corresponds to Q# constant "PauliY."
+    PauliY = 3U,
+    /// Pauli Z operator. Corresponds to Q# constant "PauliZ."
+    PauliZ = 2U
+};
+
 /**
  * A "Qrack::QInterface" is an abstract interface exposing qubit permutation
  * state vector with methods to operate on it as by gates and register-like
@@ -124,6 +146,8 @@ protected:
     bool doNormalize;
     bool randGlobalPhase;
     real1 amplitudeFloor;
+    /// The preparation of the Hamiltonian last passed to TimeEvolve(), reused for as long as the same ops are passed
+    PreparedHamiltonianPtr preparedHamiltonian;
 
     virtual void SetQubitCount(bitLenInt qb)
     {
@@ -173,6 +197,39 @@ protected:
 
     bool IsIdentity(const complex* mtrx, const bool isControlled = false);
 
+    /**
+     * Draw "count" 64-bit seeds, in order, from this QInterface's random source, for independent generators that sample
+     * shots in parallel. Each generator should cover a fixed block of shots, so the samples do not depend on the thread
+     * schedule.
+     */
+    std::vector<uint64_t> RandSeeds(const bitCapIntOcl& count);
+
+    /**
+     * The sampler behind MultiShotMeasureMask(), with its blocks of shots spread over the threads of "pf." (QInterface
+     * has no threads of its own, so its MultiShotMeasureMask() passes a serial ParallelFor, while QEngineCPU passes
+     * itself.)
+     */
+    std::map<bitCapInt, int> SampleMaskShots(
+        const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots, ParallelFor& pf);
+
+    /// The QUBO cost of ExpectationQUBO() for one permutation "x" of the (length) cost bits, evaluated directly
+    static real1 QUBOCost(const real1* weights, const bitLenInt& length, const bitCapInt& x);
+
+    /// Whether amplitude "a" ranks ahead of "b" for GetTopAmplitudes(): larger norm first, then lower permutation
+    static bool IsAmplitudeAhead(const std::pair<bitCapInt, complex>& a, const std::pair<bitCapInt, complex>& b)
+    {
+        const real1 nrmA = norm(a.second);
+        const real1 nrmB = norm(b.second);
+        return (nrmA > nrmB) || ((nrmA == nrmB) && (a.first < b.first));
+    }
+
+    /**
+     * Offer a nonzero amplitude to "heap," which holds at most "k" of the best amplitudes offered so far, with the
+     * last of them (by IsAmplitudeAhead()) at the front.
+     */
+    static void OfferTopAmplitude(std::vector<std::pair<bitCapInt, complex>>& heap, const bitCapIntOcl& k,
+        const bitCapInt& perm, const complex& amp);
+
 public:
     QInterface(bitLenInt n, qrack_rand_gen_ptr rgp = nullptr, bool doNorm = false, bool useHardwareRNG = true,
         bool randomGlobalPhase = true, real1 norm_thresh = REAL1_DEFAULT_ARG)
@@ -261,6 +318,25 @@ public:
      */
     virtual complex GetAmplitude(bitCapInt perm) = 0;
 
+    /**
+     * Get the "k" largest amplitudes, by norm, without exporting the whole state
+     *
+     * Returns (permutation, amplitude) pairs in descending order of norm, (with ties in ascending order of
+     * permutation,) or fewer than "k" pairs, if fewer amplitudes are nonzero.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual std::vector<std::pair<bitCapInt, complex>> GetTopAmplitudes(const bitCapIntOcl& k);
+
+    /**
+     * Get the representational amplitudes of a list of full permutations, in one call
+     *
+     * The amplitude of "perms[i]" is returned in "amps[i]," for "count" permutations.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual void GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps);
+
     /** Sets the representational amplitude of a full permutation
      *
      * \warning PSEUDO-QUANTUM
@@ -450,6 +526,34 @@ public:
      */
     virtual void ApplyAntiControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
         const bitLenInt& target, const complex topRight, const complex bottomLeft);
+
+    /**
+     * Apply an arbitrary dense transformation to several bits at once.
+     *
+     * "mtrx" is a flat, row-major 2^k by 2^k complex matrix, for k = "targetLen." The first bit index in the "targets"
+     * array is the least significant bit of the matrix row and column index, proceeding to the most significant bit.
+     * (For k = 1, this is the same as Qrack::ApplySingleBit.) Target bits must be distinct.
+     */
+    virtual void ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx);
+
+    /**
+     * Apply a sequence of arbitrary single bit gates, in order.
+     *
+     * Gate "i" applies the 2x2 matrix at "mtrxs + 4 * i," (in the same component order as Qrack::ApplySingleBit,) to
+     * bit "targets[i]." The result is the same as calling Qrack::ApplySingleBit once per gate, but engines may apply
+     * the whole sequence to one cache-sized block of the state vector at a time.
+     */
+    virtual void ApplySingleBitSequence(const complex* mtrxs, const bitLenInt* targets, const unsigned int gateCount);
+
+    /**
+     * Apply a layer of arbitrary single bit gates, one to each bit of a contiguous register.
+     *
+     * Bit "start + i" is acted on by the 2x2 matrix at "mtrxs + 4 * i," (in the same component order as
+     * Qrack::ApplySingleBit,) for "i" from 0 to "length - 1." Since the gates act on distinct bits, the layer is a
+     * single tensor product operator, which engines may apply in one traversal of the state vector.
+     */
+    virtual void ApplySingleBitLayer(const complex* mtrxs, bitLenInt start, bitLenInt length);
+
     /**
      * Apply a "uniformly controlled" arbitrary single bit unitary transformation. (See
      * https://arxiv.org/abs/quant-ph/0312218)
@@ -487,9 +591,31 @@ public:
      * e^{-i H_0 t} \left|\psi \rangle\right. .\f} (For example, if A and B are single bit gates acting on the same
      * bit, form their composition into one gate by the intended right-to-left fusion and apply them as a single
      * HamiltonianOp.)
+     *
+     * Repeated calls with the same ops, (the same HamiltonianOp instances, in the same order,) reuse one
+     * PreparedHamiltonian.
      */
     virtual void TimeEvolve(Hamiltonian h, real1 timeDiff);
 
+    /**
+     * Time evolve by a Hamiltonian that has been prepared for repeated evolution. The result is the same as
+     * TimeEvolve() on the original Hamiltonian, but the ops are applied in fused passes, and the exponentiated matrices
+     * are reused across calls with the same "timeDiff." (See Qrack::PreparedHamiltonian.)
+     */
+    virtual void TimeEvolve(PreparedHamiltonian& h, real1 timeDiff);
+
+    /**
+     * Time evolve by the exact propagator of a Hamiltonian, \f$ e^{-i (H_0 + H_1 + \ldots + H_{N - 1}) t} \f$,
+     * rather than by the ordered product of per-op exponentials that TimeEvolve() applies. Every op matrix must be
+     * Hermitian. When the ops commute, the two agree, except for uniform ops: TimeEvolve() exponentiates the blocks
+     * of a UniformHamiltonianOp as \f$ e^{-H t} \f$, while TimeEvolveExact() exponentiates them as
+     * \f$ e^{-i H t} \f$, like every other op.
+     *
+     * The propagator is applied by Lanczos (Krylov subspace) exponentiation, with the time step subdivided
+     * adaptively to keep the estimated error within "tolerance." (See Qrack::KrylovTimeEvolve.)
+     */
+    virtual void TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance = REAL1_DEFAULT_ARG);
+
     /**
      * Apply a swap with arbitrary control bits.
      */
@@ -992,6 +1118,15 @@ public:
      */
     virtual void ExpZDyad(int numerator, int denomPower, bitLenInt qubitIndex);
 
+    /**
+     * (Controlled) Pauli string exponentiation gate
+     *
+     * Applies \f$ e^{i*\theta*P} \f$, where "P" is the tensor product of "paulis[i]" acting on "qubits[i]," if all
+     * "controls" are 1. (This matches the convention of the Q# "Exp" operation.)
+     */
+    virtual void ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitLenInt* controls, const bitLenInt& controlLen, real1 radians);
+
     /**
      * Controlled X axis rotation gate
      *
@@ -1686,6 +1821,14 @@ public:
     /** This is an expedient for an adaptive Grover's search for a function's global minimum. */
     virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length) = 0;
 
+    /**
+     * Parity phase gate
+     *
+     * Applies e^(i*radians/2) to permutations in which the bits of "mask" have odd parity, and e^(-i*radians/2) to
+     * those with even parity. (For a mask of two bits, this is exp(-i*radians/2 * Z x Z), the "ZZ" interaction.)
+     */
+    virtual void PhaseParity(real1 radians, bitCapInt mask);
+
     /** Phase flip always - equivalent to Z X Z X on any bit in the QInterface */
     virtual void PhaseFlip() = 0;
 
@@ -1703,6 +1846,22 @@ public:
     virtual bitCapInt ForceMReg(
         bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true, bool doApply = true);
 
+    /** Measure permutation state of a register, and dispose of its qubits */
+    virtual bitCapInt MRegDispose(bitLenInt start, bitLenInt length)
+    {
+        return ForceMRegDispose(start, length, 0, false);
+    }
+
+    /**
+     * Measure a register as ForceMReg(), and then dispose of its qubits, as Dispose()
+     *
+     * The qubits above the register shift down by "length," so that measurement-heavy circuits can free memory as
+     * they go. The result is returned as a permutation of the register.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual bitCapInt ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce = true);
+
     /** Measure bits with indices in array, and return a mask of the results */
     virtual bitCapInt M(const bitLenInt* bits, const bitLenInt& length) { return ForceM(bits, length, NULL); }
 
@@ -1898,6 +2057,24 @@ public:
      */
     virtual real1 ProbAll(bitCapInt fullRegister) = 0;
 
+    /**
+     * Direct measure of the probabilities of a list of full permutations, in one call
+     *
+     * The probability of "perms[i]" is returned in "probs[i]," for "count" permutations.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual void ProbAllBatch(const bitCapInt* perms, const bitCapIntOcl& count, real1* probs);
+
+    /**
+     * Direct measure of every bit's probability to be in |1> state
+     *
+     * The probability of each bit "i" is returned in "probsArray[i]," which must have room for every bit.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual void ProbAllQubits(real1* probsArray);
+
     /**
      * Direct measure of register permutation probability
      *
@@ -1943,6 +2120,55 @@ public:
     virtual std::map<bitCapInt, int> MultiShotMeasureMask(
         const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots);
 
+    /**
+     * Expectation value of a Pauli string
+     *
+     * Returns \f$ \langle\psi|P|\psi\rangle \f$, where "P" is the tensor product of "paulis[i]" acting on "qubits[i]."
+     * The state is left as it was.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual real1 ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length);
+
+    /**
+     * Expectation values of many Pauli strings on the same qubits
+     *
+     * "paulis" holds "stringCount" strings of "length" factors each, back to back, with factor "i" of every string
+     * acting on "qubits[i]." (Strings that act on fewer qubits are padded with PauliI.) The expectation value of each
+     * string is returned in the "expectations" argument. The state is left as it was.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual void ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitCapIntOcl& stringCount, real1* expectations);
+
+    /**
+     * Expectation value of a QUBO cost, (a classical quadratic cost over bitstrings,) and optionally its distribution
+     *
+     * For the bits x[i] of "qubits," the cost is the sum of weights[i * length + j] * x[i] * x[j] over all "i" and "j,"
+     * so the diagonal of the "length" by "length" matrix "weights" holds the linear terms. If "histogram" is not NULL,
+     * it receives the probability that the cost falls in each of "binCount" equal bins over ["minCost", "maxCost"),
+     * with costs out of range counted in the first or last bin. The state is left as it was.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    virtual real1 ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+        real1* histogram = NULL, const bitCapIntOcl& binCount = 0U, const real1& minCost = ZERO_R1,
+        const real1& maxCost = ZERO_R1);
+
+    /**
+     * Expectation value of an Ising energy, and optionally its distribution
+     *
+     * The energy is the sum of fields[i] * z[i], plus the sum of couplings[i * length + j] * z[i] * z[j] for i < j,
+     * (reading only the upper triangle of "couplings,") where z[i] is +1 for |0> and -1 for |1> on qubits[i]. This is
+     * rewritten as a QUBO cost plus a constant for ExpectationQUBO(), and "histogram" bins the energy as there.
+     *
+     * \warning PSEUDO-QUANTUM
+     */
+    real1 ExpectationIsing(const bitLenInt* qubits, const bitLenInt& length, const real1* fields,
+        const real1* couplings, real1* histogram = NULL, const bitCapIntOcl& binCount = 0U,
+        const real1& minCost = ZERO_R1, const real1& maxCost = ZERO_R1);
+
     /**
      * Set individual bit to pure |0> (false) or |1> (true) state
      *
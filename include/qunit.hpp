@@ -630,6 +630,8 @@ public:
     virtual void GetQuantumState(complex* outputState);
     virtual void GetProbs(real1* outputProbs);
     virtual complex GetAmplitude(bitCapInt perm);
+    virtual std::vector<std::pair<bitCapInt, complex>> GetTopAmplitudes(const bitCapIntOcl& k);
+    virtual void GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps);
     virtual void SetAmplitude(bitCapInt perm, complex amp);
     virtual void SetPermutation(bitCapInt perm, complex phaseFac = CMPLX_DEFAULT_ARG);
     using QInterface::Compose;
@@ -689,6 +691,10 @@ public:
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
     virtual void ApplyAntiControlledSingleBit(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx);
+    virtual void ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx);
+    virtual void ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+        const bitLenInt* controls, const bitLenInt& controlLen, real1 radians);
+    virtual void TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance = REAL1_DEFAULT_ARG);
     using QInterface::UniformlyControlledSingleBit;
     virtual void CSwap(
         const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2);
@@ -783,6 +789,7 @@ public:
     virtual void ZeroPhaseFlip(bitLenInt start, bitLenInt length);
     virtual void CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex);
     virtual void PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length);
+    virtual void PhaseParity(real1 radians, bitCapInt mask);
     virtual void PhaseFlip();
     virtual void SetReg(bitLenInt start, bitLenInt length, bitCapInt value);
     virtual bitCapInt IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
@@ -808,6 +815,10 @@ public:
 
     virtual real1 Prob(bitLenInt qubit);
     virtual real1 ProbAll(bitCapInt fullRegister);
+    virtual void ProbAllQubits(real1* probsArray);
+    virtual real1 ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+        real1* histogram = NULL, const bitCapIntOcl& binCount = 0U, const real1& minCost = ZERO_R1,
+        const real1& maxCost = ZERO_R1);
     virtual bool ApproxCompare(QInterfacePtr toCompare)
     {
         return ApproxCompare(std::dynamic_pointer_cast<QUnit>(toCompare));
@@ -829,6 +840,8 @@ protected:
     virtual void XBase(const bitLenInt& target);
     virtual void ZBase(const bitLenInt& target);
     virtual real1 ProbBase(const bitLenInt& qubit);
+    /// Cache a freshly computed probability in a shard, and check whether that separates it
+    void CacheShardProb(const bitLenInt& qubit, const real1& prob);
 
     virtual void UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
         bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
@@ -892,6 +905,9 @@ protected:
     typedef bool (*ParallelUnitFn)(QInterfacePtr unit, real1 param1, real1 param2);
     bool ParallelUnitApply(ParallelUnitFn fn, real1 param1 = ZERO_R1, real1 param2 = ZERO_R1);
 
+    /// Flush all buffered basis changes and emulation, and map each unit to the QUnit qubit of each of its bits
+    std::map<QInterfacePtr, std::vector<bitLenInt>> UnitQubitMap();
+
     virtual void SeparateBit(bool value, bitLenInt qubit, bool doDispose = true);
 
     void OrderContiguous(QInterfacePtr unit);
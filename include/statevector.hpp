@@ -40,7 +40,8 @@
 
 namespace Qrack {
 
-class StateVectorArray : public StateVector {
+// (Final, so that kernels holding a StateVectorArray* can inline its accessors.)
+class StateVectorArray final : public StateVector {
 protected:
     complex* amplitudes;
 
@@ -94,12 +95,21 @@ public:
 
     void write(const bitCapInt& i, const complex& c) { amplitudes[(bitCapIntOcl)i] = c; };
 
+    /// Raw amplitude storage, for kernels that take plain pointers
+    complex* data() { return amplitudes; }
+
     void write2(const bitCapInt& i1, const complex& c1, const bitCapInt& i2, const complex& c2)
     {
         amplitudes[(bitCapIntOcl)i1] = c1;
         amplitudes[(bitCapIntOcl)i2] = c2;
     };
 
+    void swap_range(const bitCapInt& i1, const bitCapInt& i2, const bitCapInt& length)
+    {
+        std::swap_ranges(amplitudes + (bitCapIntOcl)i1, amplitudes + (bitCapIntOcl)(i1 + length),
+            amplitudes + (bitCapIntOcl)i2);
+    }
+
     void clear() { std::fill(amplitudes, amplitudes + (bitCapIntOcl)capacity, ZERO_CMPLX); }
 
     void copy_in(const complex* copyIn) { std::copy(copyIn, copyIn + (bitCapIntOcl)capacity, amplitudes); }
@@ -199,6 +209,14 @@ public:
         }
     }
 
+    void swap_range(const bitCapInt& i1, const bitCapInt& i2, const bitCapInt& length)
+    {
+        for (bitCapInt j = 0; j < length; j++) {
+            complex c1 = read(i1 + j);
+            write2(i1 + j, read(i2 + j), i2 + j, c1);
+        }
+    }
+
     void clear()
     {
         mtx.lock();
@@ -11,15 +11,12 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
-#include <future>
-
 #include "bitbuffer.hpp"
 
 namespace Qrack {
 
-BitBuffer::BitBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen, bool isArith)
+BitBuffer::BitBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen)
     : anti(antiCtrl)
-    , isArithmetic(isArith)
     , controls(cntrlLen)
 {
     if (cntrlLen > 0) {
@@ -41,10 +38,6 @@ bool BitBuffer::Combinable(BitBufferPtr toCmp)
         return false;
     }
 
-    if (isArithmetic != toCmp->isArithmetic) {
-        return false;
-    }
-
     if (controls.size() != toCmp->controls.size()) {
         return false;
     }
@@ -59,7 +52,7 @@ bool BitBuffer::Combinable(BitBufferPtr toCmp)
 }
 
 GateBuffer::GateBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt& cntrlLen, const complex* mtrx)
-    : BitBuffer(antiCtrl, cntrls, cntrlLen, false)
+    : BitBuffer(antiCtrl, cntrls, cntrlLen)
     , matrix(new complex[4], std::default_delete<complex[]>())
 {
     std::copy(mtrx, mtrx + 4, matrix.get());
@@ -67,8 +60,7 @@ GateBuffer::GateBuffer(bool antiCtrl, const bitLenInt* cntrls, const bitLenInt&
 
 BitBufferPtr GateBuffer::LeftRightCompose(BitBufferPtr rightBuffer)
 {
-    // If we pass the threshold number of qubits for buffering, we just do 2x2 complex matrix multiplication.
-    // We parallelize this, since we can.
+    // This is just 2x2 complex matrix multiplication. It's far too little work to be worth dispatching to threads.
     // If a matrix component is very close to zero, we assume it's floating-point-error on a composition that has an
     // exactly 0 component, number theoretically. (If it's not exactly 0 by number theory, it's numerically
     // negligible, and we're safe.)
@@ -77,49 +69,23 @@ BitBufferPtr GateBuffer::LeftRightCompose(BitBufferPtr rightBuffer)
 
     if (rightBuffer != NULL) {
         GateBuffer* rightGate = dynamic_cast<GateBuffer*>(rightBuffer.get());
-        BitOp right = rightGate->matrix;
+        const complex* left = matrix.get();
+        const complex* right = rightGate->matrix.get();
+        complex* out = outBuffer.get();
 
-        std::vector<std::future<void>> futures(4);
+        out[0] = (left[0] * right[0]) + (left[1] * right[2]);
+        out[1] = (left[0] * right[1]) + (left[1] * right[3]);
+        out[2] = (left[2] * right[0]) + (left[3] * right[2]);
+        out[3] = (left[2] * right[1]) + (left[3] * right[3]);
 
-        futures[0] = std::async(std::launch::async, [&]() {
-            outBuffer.get()[0] = (matrix.get()[0] * right.get()[0]) + (matrix.get()[1] * right.get()[2]);
-            real1 nrm = norm(outBuffer.get()[0]);
-            if (nrm < min_norm) {
-                outBuffer.get()[0] = complex(ZERO_R1, ZERO_R1);
-            } else if ((ONE_R1 - nrm) < min_norm) {
-                outBuffer.get()[0] /= std::sqrt(nrm);
-            }
-        });
-        futures[1] = std::async(std::launch::async, [&]() {
-            outBuffer.get()[1] = (matrix.get()[0] * right.get()[1]) + (matrix.get()[1] * right.get()[3]);
-            real1 nrm = norm(outBuffer.get()[1]);
-            if (nrm < min_norm) {
-                outBuffer.get()[1] = complex(ZERO_R1, ZERO_R1);
-            } else if ((ONE_R1 - nrm) < min_norm) {
-                outBuffer.get()[1] /= std::sqrt(nrm);
-            }
-        });
-        futures[2] = std::async(std::launch::async, [&]() {
-            outBuffer.get()[2] = (matrix.get()[2] * right.get()[0]) + (matrix.get()[3] * right.get()[2]);
-            real1 nrm = norm(outBuffer.get()[2]);
-            if (nrm < min_norm) {
-                outBuffer.get()[2] = complex(ZERO_R1, ZERO_R1);
-            } else if ((ONE_R1 - nrm) < min_norm) {
-                outBuffer.get()[2] /= std::sqrt(nrm);
-            }
-        });
-        futures[3] = std::async(std::launch::async, [&]() {
-            outBuffer.get()[3] = (matrix.get()[2] * right.get()[1]) + (matrix.get()[3] * right.get()[3]);
-            real1 nrm = norm(outBuffer.get()[3]);
+        real1 nrm;
+        for (int i = 0; i < 4; i++) {
+            nrm = norm(out[i]);
             if (nrm < min_norm) {
-                outBuffer.get()[3] = complex(ZERO_R1, ZERO_R1);
+                out[i] = complex(ZERO_R1, ZERO_R1);
             } else if ((ONE_R1 - nrm) < min_norm) {
-                outBuffer.get()[3] /= std::sqrt(nrm);
+                out[i] /= std::sqrt(nrm);
             }
-        });
-
-        for (int i = 0; i < 4; i++) {
-            futures[i].get();
         }
     } else {
         std::copy(matrix.get(), matrix.get() + 4, outBuffer.get());
@@ -172,70 +138,4 @@ void GateBuffer::Apply(QInterfacePtr qReg, const bitLenInt& qubitIndex, std::vec
     }
     (*bitBuffers)[qubitIndex] = NULL;
 }
-
-bool ArithmeticBuffer::Combinable(BitBufferPtr toCmp)
-{
-    if (toCmp == NULL) {
-        return true;
-    }
-
-    if (!BitBuffer::Combinable(toCmp)) {
-        return false;
-    }
-
-    // BitBuffer::Combinable requires either both or neither of the buyers to be arithmetic, which makes this cast safe
-    ArithmeticBuffer* toCmpArith = dynamic_cast<ArithmeticBuffer*>(toCmp.get());
-    if (start != toCmpArith->start) {
-        return false;
-    }
-
-    if (length != toCmpArith->length) {
-        return false;
-    }
-
-    return true;
-}
-
-void ArithmeticBuffer::Apply(QInterfacePtr qReg, const bitLenInt& qubitIndex, std::vector<BitBufferPtr>* bitBuffers)
-{
-    if (controls.size() == 0) {
-        if (toAdd > 0) {
-            qReg->INC(toAdd, start, length);
-        } else if (toAdd < 0) {
-            qReg->DEC(-toAdd, start, length);
-        }
-    } else {
-        bitLenInt* ctrls = new bitLenInt[controls.size()];
-        std::copy(controls.begin(), controls.end(), ctrls);
-
-        if (toAdd > 0) {
-            qReg->CINC(toAdd, start, length, ctrls, controls.size());
-        } else if (toAdd < 0) {
-            qReg->CDEC(-toAdd, start, length, ctrls, controls.size());
-        }
-
-        delete[] ctrls;
-    }
-
-    for (bitLenInt i = 0; i < length; i++) {
-        (*bitBuffers)[start + i] = NULL;
-    }
-}
-
-BitBufferPtr ArithmeticBuffer::LeftRightCompose(BitBufferPtr rightBuffer)
-{
-    if (rightBuffer) {
-        ArithmeticBuffer* aBfr = dynamic_cast<ArithmeticBuffer*>(rightBuffer.get());
-        return std::make_shared<ArithmeticBuffer>(this, aBfr->toAdd);
-    } else {
-        return std::make_shared<ArithmeticBuffer>(this, 0);
-    }
-}
-
-bool ArithmeticBuffer::IsIdentity()
-{
-    // If the effect of applying the buffer would be (approximately or exactly) that of applying the identity operator,
-    // then we can discard this buffer without applying it. If "toAdd" is zero, this is the identity operator.
-    return (toAdd == 0);
-}
 } // namespace Qrack
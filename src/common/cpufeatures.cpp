@@ -0,0 +1,116 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// Runtime detection of CPU vector instruction set support, so that one build of the
+// library can select the fastest kernel variant available on the host.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <cstdlib>
+#include <string>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+#include "cpufeatures.hpp"
+
+namespace Qrack {
+
+SimdLevel DetectSimdLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // These checks include OS support for saving the extended register state.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SIMD_AVX512;
+    }
+    // The AVX2 kernel variant also uses fused multiply-add.
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("avx")) {
+        return SIMD_AVX;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SIMD_SSE2;
+    }
+    return SIMD_NONE;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    if (!(info[3] & (1 << 26))) {
+        return SIMD_NONE;
+    }
+    bool isFma = (info[2] & (1 << 12)) != 0;
+
+    // AVX requires both the CPUID bit and OS support (OSXSAVE, with XMM and YMM state enabled).
+    bool isOsXSave = (info[2] & (1 << 27)) != 0;
+    if (!isOsXSave || !(info[2] & (1 << 28)) || ((_xgetbv(0) & 0x6) != 0x6)) {
+        return SIMD_SSE2;
+    }
+    if (maxLeaf < 7) {
+        return SIMD_AVX;
+    }
+
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 16)) && ((_xgetbv(0) & 0xE6) == 0xE6)) {
+        return SIMD_AVX512;
+    }
+    if ((info[1] & (1 << 5)) && isFma) {
+        return SIMD_AVX2;
+    }
+    return SIMD_AVX;
+#else
+    return SIMD_NONE;
+#endif
+}
+
+static SimdLevel ReadSimdLevel()
+{
+    SimdLevel detected = DetectSimdLevel();
+
+    if (!getenv("QRACK_SIMD")) {
+        return detected;
+    }
+
+    std::string name = std::string(getenv("QRACK_SIMD"));
+    SimdLevel requested = detected;
+    if (name == "none") {
+        requested = SIMD_NONE;
+    } else if (name == "sse2") {
+        requested = SIMD_SSE2;
+    } else if (name == "avx") {
+        requested = SIMD_AVX;
+    } else if (name == "avx2") {
+        requested = SIMD_AVX2;
+    } else if (name == "avx512") {
+        requested = SIMD_AVX512;
+    }
+
+    return (requested < detected) ? requested : detected;
+}
+
+static SimdLevel& CachedSimdLevel()
+{
+    static SimdLevel level = ReadSimdLevel();
+    return level;
+}
+
+SimdLevel GetSimdLevel() { return CachedSimdLevel(); }
+
+SimdLevel SetSimdLevel(SimdLevel level)
+{
+    SimdLevel detected = DetectSimdLevel();
+    CachedSimdLevel() = (level < detected) ? level : detected;
+    return CachedSimdLevel();
+}
+
+} // namespace Qrack
@@ -0,0 +1,549 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// This file prepares Qrack::Hamiltonian instances for repeated time evolution.
+// Ops are grouped into as few gate passes as possible, and the exponentiated
+// pass matrices are cached per time step.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include <algorithm>
+#include <complex>
+
+#include "qinterface.hpp"
+
+// The number of distinct "timeDiff" values for which PreparedHamiltonian keeps exponentiated matrices
+#define HAMILTONIAN_CACHE_SIZE 4U
+
+// The largest Krylov subspace dimension, and the most memory that the Krylov basis vectors may take together
+#define KRYLOV_MAX_DIM 30U
+#define KRYLOV_MAX_BYTES (1ULL << 31U)
+
+#if ENABLE_COMPLEX8
+#define KRYLOV_DEFAULT_TOLERANCE 1e-5f
+#else
+#define KRYLOV_DEFAULT_TOLERANCE 1e-10
+#endif
+
+namespace Qrack {
+
+PreparedHamiltonian::PreparedHamiltonian(const Hamiltonian& h)
+    : ops(h)
+    , lastUncontrolledStep(0)
+    , mtrxLength(0)
+    , nextCacheSlot(0)
+{
+    for (size_t i = 0; i < h.size(); i++) {
+        AddOp(h[i]);
+    }
+    bitLastSteps.clear();
+
+    UpdateOpMatrices();
+
+    for (size_t i = 0; i < steps.size(); i++) {
+        PreparedHamiltonianStep& step = steps[i];
+        const bitLenInt controlLen = step.controls.size();
+
+        if (controlLen > 0) {
+            const bitCapIntOcl allOnes = pow2MaskOcl(controlLen);
+            const std::vector<PreparedHamiltonianTerm>& terms = step.terms[0];
+            step.controlPerm = terms[0].controlPerm;
+            for (size_t j = 0; j < terms.size(); j++) {
+                if (terms[j].op->uniform || (terms[j].controlPerm != step.controlPerm)) {
+                    step.isUniform = true;
+                    break;
+                }
+            }
+            if ((step.controlPerm != 0) && (step.controlPerm != allOnes)) {
+                step.isUniform = true;
+            }
+        }
+
+        step.mtrxOffset = mtrxLength;
+        mtrxLength += 4U * (step.isUniform ? pow2Ocl(controlLen) : (bitCapIntOcl)step.targets.size());
+    }
+}
+
+void PreparedHamiltonian::AddOp(HamiltonianOpPtr op)
+{
+    std::vector<bitLenInt> opBits(op->controls, op->controls + op->controlLen);
+    opBits.push_back(op->targetBit);
+
+    // Every step after the last one that shares a bit with the op acts on a disjoint set of qubits, and so commutes
+    // with the op. The op can be composed into any of those steps, or into that last step itself.
+    const bitLenInt maxBit = *std::max_element(opBits.begin(), opBits.end());
+    if (bitLastSteps.size() <= maxBit) {
+        bitLastSteps.resize(maxBit + 1U, 0);
+    }
+    size_t barrier = 0;
+    for (size_t i = 0; i < opBits.size(); i++) {
+        barrier = std::max(barrier, bitLastSteps[opBits[i]]);
+    }
+
+    // An uncontrolled op joins the latest step of uncontrolled gates, if it can move back that far.
+    if ((op->controlLen == 0) && lastUncontrolledStep && (lastUncontrolledStep >= barrier)) {
+        PreparedHamiltonianStep& step = steps[lastUncontrolledStep - 1U];
+        std::vector<bitLenInt>::iterator target = std::find(step.targets.begin(), step.targets.end(), op->targetBit);
+        if (target == step.targets.end()) {
+            step.targets.push_back(op->targetBit);
+            step.terms.push_back(std::vector<PreparedHamiltonianTerm>());
+            target = step.targets.end() - 1U;
+        }
+        step.terms[target - step.targets.begin()].push_back(PreparedHamiltonianTerm(op, 0));
+        bitLastSteps[op->targetBit] = lastUncontrolledStep;
+        return;
+    }
+
+    // A controlled op joins a step on the same target and control bits, which can only be the barrier step.
+    if ((op->controlLen > 0) && barrier) {
+        PreparedHamiltonianStep& step = steps[barrier - 1U];
+        bool isCombinable = (step.controls.size() == op->controlLen) && (step.targets[0] == op->targetBit);
+        bitCapIntOcl controlPerm = 0;
+        for (bitLenInt j = 0; isCombinable && (j < op->controlLen); j++) {
+            size_t k = std::find(step.controls.begin(), step.controls.end(), op->controls[j]) - step.controls.begin();
+            // The matrices of a uniform op are indexed by its own control order.
+            if ((k == step.controls.size()) || (op->uniform && (k != j))) {
+                isCombinable = false;
+            } else if (op->anti == (op->toggles && op->toggles[j])) {
+                controlPerm |= pow2Ocl(k);
+            }
+        }
+        if (isCombinable) {
+            step.terms[0].push_back(PreparedHamiltonianTerm(op, controlPerm));
+            return;
+        }
+    }
+
+    PreparedHamiltonianStep step;
+    step.controls = std::vector<bitLenInt>(op->controls, op->controls + op->controlLen);
+    step.targets.push_back(op->targetBit);
+    step.terms.push_back(std::vector<PreparedHamiltonianTerm>());
+    bitCapIntOcl controlPerm = 0;
+    for (bitLenInt j = 0; j < op->controlLen; j++) {
+        if (op->anti == (op->toggles && op->toggles[j])) {
+            controlPerm |= pow2Ocl(j);
+        }
+    }
+    step.terms[0].push_back(PreparedHamiltonianTerm(op, controlPerm));
+    steps.push_back(step);
+
+    for (size_t i = 0; i < opBits.size(); i++) {
+        bitLastSteps[opBits[i]] = steps.size();
+    }
+    if (op->controlLen == 0) {
+        lastUncontrolledStep = steps.size();
+    }
+}
+
+void PreparedHamiltonian::ComputeMatrices(real1 timeDiff, complex* mtrxs)
+{
+    // Each step matrix is the left-multiplied product of e^(-i * H_j * t), over the terms j of the step, in order.
+    // (Uniform ops are exponentiated as e^(-H_j * t), as in the per-op TimeEvolve() path.)
+    complex scaled[4];
+    complex termExp[4];
+    complex product[4];
+
+    for (size_t i = 0; i < steps.size(); i++) {
+        const PreparedHamiltonianStep& step = steps[i];
+        const bitCapIntOcl mtrxCount = step.isUniform ? pow2Ocl(step.controls.size()) : step.targets.size();
+
+        for (bitCapIntOcl j = 0; j < mtrxCount; j++) {
+            complex* mtrx = mtrxs + step.mtrxOffset + (4U * j);
+            mtrx[0] = ONE_CMPLX;
+            mtrx[1] = ZERO_CMPLX;
+            mtrx[2] = ZERO_CMPLX;
+            mtrx[3] = ONE_CMPLX;
+
+            const std::vector<PreparedHamiltonianTerm>& terms = step.terms[step.isUniform ? 0 : j];
+            for (size_t k = 0; k < terms.size(); k++) {
+                const HamiltonianOp& op = *(terms[k].op);
+                const complex* opMtrx = op.matrix.get();
+                if (op.uniform) {
+                    opMtrx += step.isUniform ? (4U * j) : 0U;
+                } else if (step.isUniform && (terms[k].controlPerm != j)) {
+                    continue;
+                }
+
+                for (bitLenInt l = 0; l < 4; l++) {
+                    scaled[l] = opMtrx[l] * (-timeDiff);
+                    if (!op.uniform) {
+                        scaled[l] = complex(ZERO_R1, ONE_R1) * scaled[l];
+                    }
+                }
+                exp2x2(scaled, termExp);
+                mul2x2(termExp, mtrx, product);
+                std::copy(product, product + 4, mtrx);
+            }
+        }
+    }
+}
+
+bool PreparedHamiltonian::UpdateOpMatrices()
+{
+    bool isChanged = false;
+    size_t offset = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        const complex* mtrx = ops[i]->matrix.get();
+        const size_t length = ops[i]->uniform ? (4U << ops[i]->controlLen) : 4U;
+        if (opMatrices.size() < (offset + length)) {
+            opMatrices.resize(offset + length);
+            isChanged = true;
+        }
+        if (!std::equal(mtrx, mtrx + length, opMatrices.begin() + offset)) {
+            std::copy(mtrx, mtrx + length, opMatrices.begin() + offset);
+            isChanged = true;
+        }
+        offset += length;
+    }
+
+    return isChanged;
+}
+
+bool PreparedHamiltonian::IsPreparedFrom(const Hamiltonian& h) const
+{
+    if (h.size() != ops.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < h.size(); i++) {
+        if (h[i] != ops[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const complex* PreparedHamiltonian::GetMatrices(real1 timeDiff)
+{
+    // If the op matrices have been changed in place, every cached exponential is stale.
+    if (UpdateOpMatrices()) {
+        cachedTimes.clear();
+        cachedMtrxs.clear();
+        nextCacheSlot = 0;
+    }
+
+    for (size_t i = 0; i < cachedTimes.size(); i++) {
+        if (cachedTimes[i] == timeDiff) {
+            return &(cachedMtrxs[i][0]);
+        }
+    }
+
+    // On a miss, fill a new slot until the cache is full, then recycle the slots in order.
+    size_t slot;
+    if (cachedTimes.size() < HAMILTONIAN_CACHE_SIZE) {
+        slot = cachedTimes.size();
+        cachedTimes.push_back(timeDiff);
+        cachedMtrxs.push_back(std::vector<complex>(mtrxLength ? mtrxLength : 1U));
+    } else {
+        slot = nextCacheSlot;
+        nextCacheSlot = (nextCacheSlot + 1U) % HAMILTONIAN_CACHE_SIZE;
+        cachedTimes[slot] = timeDiff;
+    }
+
+    complex* mtrxs = &(cachedMtrxs[slot][0]);
+    ComputeMatrices(timeDiff, mtrxs);
+
+    return mtrxs;
+}
+
+/// Diagonalize the real symmetric "n" by "n" matrix "a," (row-major, destroyed,) by cyclic Jacobi rotations
+static void SymmetricEigen(std::vector<double>& a, const size_t& n, std::vector<double>& values,
+    std::vector<double>& vectors)
+{
+    size_t i, j, k;
+
+    vectors.assign(n * n, 0.0);
+    for (i = 0; i < n; i++) {
+        vectors[i * n + i] = 1.0;
+    }
+
+    for (int sweep = 0; sweep < 100; sweep++) {
+        double offDiag = 0.0;
+        for (i = 0; i < n; i++) {
+            for (j = i + 1U; j < n; j++) {
+                offDiag += a[i * n + j] * a[i * n + j];
+            }
+        }
+        if (offDiag < 1e-30) {
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            for (j = i + 1U; j < n; j++) {
+                const double aij = a[i * n + j];
+                if (aij == 0.0) {
+                    continue;
+                }
+
+                const double theta = (a[j * n + j] - a[i * n + i]) / (2.0 * aij);
+                const double t = ((theta < 0.0) ? -1.0 : 1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+
+                for (k = 0; k < n; k++) {
+                    const double aki = a[k * n + i];
+                    const double akj = a[k * n + j];
+                    a[k * n + i] = c * aki - s * akj;
+                    a[k * n + j] = s * aki + c * akj;
+                }
+                for (k = 0; k < n; k++) {
+                    const double aik = a[i * n + k];
+                    const double ajk = a[j * n + k];
+                    a[i * n + k] = c * aik - s * ajk;
+                    a[j * n + k] = s * aik + c * ajk;
+                }
+                for (k = 0; k < n; k++) {
+                    const double vki = vectors[k * n + i];
+                    const double vkj = vectors[k * n + j];
+                    vectors[k * n + i] = c * vki - s * vkj;
+                    vectors[k * n + j] = s * vki + c * vkj;
+                }
+            }
+        }
+    }
+
+    values.resize(n);
+    for (i = 0; i < n; i++) {
+        values[i] = a[i * n + i];
+    }
+}
+
+void KrylovTimeEvolve(const Hamiltonian& h, real1 timeDiff, real1 tolerance, complex* stateVec,
+    const bitLenInt& qubitCount, ParallelFor& pf)
+{
+    if (tolerance <= ZERO_R1) {
+        tolerance = KRYLOV_DEFAULT_TOLERANCE;
+    }
+
+    const bitCapIntOcl maxQPower = pow2Ocl(qubitCount);
+    const int numCores = pf.GetConcurrencyLevel();
+
+    // Each op acts on the amplitudes whose control bits match "controlValue," or, if it is uniform, on all of them,
+    // with the 2x2 block selected by the control permutation.
+    struct KrylovOp {
+        bitCapIntOcl targetPower;
+        bitCapIntOcl controlMask;
+        bitCapIntOcl controlValue;
+        std::vector<bitCapIntOcl> controlPowers;
+        const complex* mtrx;
+        bool uniform;
+    };
+
+    std::vector<KrylovOp> ops(h.size());
+    for (size_t i = 0; i < h.size(); i++) {
+        const HamiltonianOp& op = *(h[i]);
+        KrylovOp& kOp = ops[i];
+        kOp.targetPower = pow2Ocl(op.targetBit);
+        kOp.controlMask = 0;
+        kOp.controlValue = 0;
+        kOp.mtrx = op.matrix.get();
+        kOp.uniform = op.uniform;
+        for (bitLenInt j = 0; j < op.controlLen; j++) {
+            const bitCapIntOcl controlPower = pow2Ocl(op.controls[j]);
+            kOp.controlPowers.push_back(controlPower);
+            kOp.controlMask |= controlPower;
+            if (op.anti == (op.toggles && op.toggles[j])) {
+                kOp.controlValue |= controlPower;
+            }
+        }
+    }
+
+    // out = H * in, gathering every output amplitude independently
+    auto applyHamiltonian = [&](const complex* in, complex* out) {
+        pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl i = (bitCapIntOcl)lcv;
+            complex amp = ZERO_CMPLX;
+            for (size_t j = 0; j < ops.size(); j++) {
+                const KrylovOp& op = ops[j];
+                const complex* mtrx = op.mtrx;
+                if (op.uniform) {
+                    bitCapIntOcl offset = 0;
+                    for (size_t k = 0; k < op.controlPowers.size(); k++) {
+                        if (i & op.controlPowers[k]) {
+                            offset |= pow2Ocl(k);
+                        }
+                    }
+                    mtrx += 4U * offset;
+                } else if ((i & op.controlMask) != op.controlValue) {
+                    continue;
+                }
+
+                const bitCapIntOcl i0 = i & ~op.targetPower;
+                if (i & op.targetPower) {
+                    amp += (mtrx[2] * in[i0]) + (mtrx[3] * in[i0 | op.targetPower]);
+                } else {
+                    amp += (mtrx[0] * in[i0]) + (mtrx[1] * in[i0 | op.targetPower]);
+                }
+            }
+            out[i] = amp;
+        });
+    };
+
+    // Sums over the whole state vector are accumulated in double precision, even for single precision amplitudes.
+    std::vector<std::complex<double>> partSums(numCores);
+    auto innerProduct = [&](const complex* left, const complex* right) {
+        std::fill(partSums.begin(), partSums.end(), std::complex<double>(0.0, 0.0));
+        pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            const complex prod = conj(left[(bitCapIntOcl)lcv]) * right[(bitCapIntOcl)lcv];
+            partSums[cpu] += std::complex<double>(real(prod), imag(prod));
+        });
+        std::complex<double> sum(0.0, 0.0);
+        for (int i = 0; i < numCores; i++) {
+            sum += partSums[i];
+        }
+        return sum;
+    };
+
+    // Keep the basis, (including the next residual vector,) within the memory budget, but always allow a 2
+    // dimensional subspace, with which the adaptive step still converges.
+    const size_t vectorsFit = (size_t)(KRYLOV_MAX_BYTES / (sizeof(complex) * maxQPower));
+    const size_t maxDim = std::min((size_t)KRYLOV_MAX_DIM, (vectorsFit > 3U) ? (vectorsFit - 1U) : (size_t)2U);
+    std::vector<std::vector<complex>> basis;
+
+    std::vector<double> alpha, beta, tridiag, eigenValues, eigenVectors;
+    std::vector<std::complex<double>> coeffs, projSums;
+    std::vector<complex> projs;
+
+    // Given the Lanczos coefficients of an "m" dimensional subspace, find the subspace coordinates of e^{-i T tau} e_1
+    // and return the a posteriori estimate of its error.
+    auto expCoeffs = [&](const size_t& m, const double& tau) {
+        coeffs.assign(m, std::complex<double>(0.0, 0.0));
+        for (size_t k = 0; k < m; k++) {
+            const std::complex<double> phase = std::exp(std::complex<double>(0.0, -tau * eigenValues[k]));
+            for (size_t j = 0; j < m; j++) {
+                coeffs[j] += eigenVectors[j * m + k] * phase * eigenVectors[k];
+            }
+        }
+        return beta[m] * std::abs(coeffs[m - 1U]);
+    };
+
+    auto diagonalize = [&](const size_t& m) {
+        tridiag.assign(m * m, 0.0);
+        for (size_t k = 0; k < m; k++) {
+            tridiag[k * m + k] = alpha[k];
+            if ((k + 1U) < m) {
+                tridiag[k * m + k + 1U] = beta[k + 1U];
+                tridiag[(k + 1U) * m + k] = beta[k + 1U];
+            }
+        }
+        SymmetricEigen(tridiag, m, eigenValues, eigenVectors);
+    };
+
+    const double totalTime = std::abs((double)timeDiff);
+    const double direction = (timeDiff < ZERO_R1) ? -1.0 : 1.0;
+    double remaining = totalTime;
+
+    while (remaining > 0.0) {
+        const double stateNorm = std::sqrt(real(innerProduct(stateVec, stateVec)));
+        if (stateNorm <= 0.0) {
+            return;
+        }
+
+        if (basis.size() == 0) {
+            basis.push_back(std::vector<complex>(maxQPower));
+        }
+        const real1 invNorm = (real1)(1.0 / stateNorm);
+        complex* v0 = &(basis[0][0]);
+        pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            v0[(bitCapIntOcl)lcv] = invNorm * stateVec[(bitCapIntOcl)lcv];
+        });
+
+        // Build the Lanczos basis, with full reorthogonalization, until it breaks down, fills, or is already accurate
+        // enough for the whole remaining time.
+        alpha.clear();
+        beta.assign(1U, 0.0);
+        size_t m = 0;
+        bool isExact = false;
+        while (m < maxDim) {
+            if (basis.size() <= (m + 1U)) {
+                basis.push_back(std::vector<complex>(maxQPower));
+            }
+            complex* u = &(basis[m + 1U][0]);
+            applyHamiltonian(&(basis[m][0]), u);
+
+            // Classical Gram-Schmidt, against the whole basis, with all projections taken in one pass and
+            // subtracted in another
+            const size_t projCount = m + 1U;
+            projSums.assign(numCores * projCount, std::complex<double>(0.0, 0.0));
+            pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+                const bitCapIntOcl i = (bitCapIntOcl)lcv;
+                std::complex<double>* sums = &(projSums[cpu * projCount]);
+                for (size_t j = 0; j < projCount; j++) {
+                    const complex prod = conj(basis[j][i]) * u[i];
+                    sums[j] += std::complex<double>(real(prod), imag(prod));
+                }
+            });
+            projs.assign(projCount, ZERO_CMPLX);
+            for (size_t j = 0; j < projCount; j++) {
+                std::complex<double> proj(0.0, 0.0);
+                for (int k = 0; k < numCores; k++) {
+                    proj += projSums[k * projCount + j];
+                }
+                projs[j] = complex((real1)real(proj), (real1)imag(proj));
+                if (j == m) {
+                    alpha.push_back(real(proj));
+                }
+            }
+            pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+                const bitCapIntOcl i = (bitCapIntOcl)lcv;
+                complex amp = u[i];
+                for (size_t j = 0; j < projCount; j++) {
+                    amp -= projs[j] * basis[j][i];
+                }
+                u[i] = amp;
+            });
+
+            const double residual = std::sqrt(real(innerProduct(u, u)));
+            m++;
+            beta.push_back(residual);
+
+            // If H maps the subspace into itself, the subspace propagator is exact for any time.
+            if (residual <= (tolerance * 1e-3)) {
+                beta[m] = 0.0;
+                isExact = true;
+                break;
+            }
+
+            const real1 invResidual = (real1)(1.0 / residual);
+            pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) { u[(bitCapIntOcl)lcv] *= invResidual; });
+
+            diagonalize(m);
+            if ((stateNorm * expCoeffs(m, direction * remaining)) <= (tolerance * remaining / totalTime)) {
+                break;
+            }
+        }
+
+        if (isExact) {
+            diagonalize(m);
+        }
+
+        // Take the longest step, halving from the remaining time, whose error estimate fits its share of the
+        // tolerance.
+        double tau = remaining;
+        while ((stateNorm * expCoeffs(m, direction * tau)) > (tolerance * tau / totalTime)) {
+            tau /= 2;
+            if (tau < (remaining * 1e-12)) {
+                break;
+            }
+        }
+
+        pf.par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl i = (bitCapIntOcl)lcv;
+            std::complex<double> amp(0.0, 0.0);
+            for (size_t k = 0; k < m; k++) {
+                const complex& v = basis[k][i];
+                amp += coeffs[k] * std::complex<double>(real(v), imag(v));
+            }
+            amp *= stateNorm;
+            stateVec[i] = complex((real1)real(amp), (real1)imag(amp));
+        });
+
+        remaining = (tau < remaining) ? (remaining - tau) : 0.0;
+    }
+}
+
+} // namespace Qrack
@@ -26,17 +26,6 @@ std::mutex metaOperationMutex;
 
 using namespace Qrack;
 
-enum Pauli {
-    /// Pauli Identity operator. Corresponds to Q# constant "PauliI."
-    PauliI = 0U,
-    /// Pauli X operator. Corresponds to Q# constant "PauliX."
-    PauliX = 1U,
-    /// Pauli Y operator. Corresponds to Q# constant "PauliY."
-    PauliY = 3U,
-    /// Pauli Z operator. Corresponds to Q# constant "PauliZ."
-    PauliZ = 2U
-};
-
 qrack_rand_gen_ptr rng = std::make_shared<qrack_rand_gen>(std::time(0));
 std::vector<QInterfacePtr> simulators;
 std::map<QInterfacePtr, std::map<unsigned, bitLenInt>> shards;
@@ -159,102 +148,25 @@ void MCRHelper(unsigned sid, unsigned b, double phi, unsigned n, unsigned* c, un
     delete[] ctrlsArray;
 }
 
-inline bool isDiagonal(std::vector<unsigned> const& b)
+void ExpHelper(unsigned sid, const std::vector<unsigned>& b, double phi, unsigned nc, unsigned* cs,
+    const std::vector<unsigned>& q)
 {
-    for (auto x : b) {
-        if (x == PauliX || x == PauliY) {
-            return false;
-        }
-    }
-    return true;
-}
+    QInterfacePtr simulator = simulators[sid];
 
-inline bool poppar(unsigned perm)
-{
-    // From https://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetNaive
-    unsigned int c; // c accumulates the total bits set in v
-    for (c = 0; perm; c++) {
-        perm &= perm - 1U; // clear the least significant bit set
+    std::vector<Pauli> paulis(b.size());
+    std::vector<bitLenInt> qubits(q.size());
+    for (unsigned i = 0; i < b.size(); i++) {
+        paulis[i] = (Pauli)b[i];
+        qubits[i] = shards[simulator][q[i]];
     }
-    return c & 1U;
-}
-
-inline std::size_t make_mask(std::vector<unsigned> const& qs)
-{
-    std::size_t mask = 0;
-    for (std::size_t q : qs)
-        mask = mask | pow2Ocl(q);
-    return mask;
-}
 
-// power of square root of -1
-inline complex iExp(int power)
-{
-    int p = ((power % 4) + 8) % 4;
-    switch (p) {
-    case 0:
-        return ONE_CMPLX;
-    case 1:
-        return I_CMPLX;
-    case 2:
-        return -ONE_CMPLX;
-    case 3:
-        return -I_CMPLX;
+    std::vector<bitLenInt> controls(nc);
+    for (unsigned i = 0; i < nc; i++) {
+        controls[i] = shards[simulator][cs[i]];
     }
-    return 0;
-}
 
-void apply_controlled_exp(std::vector<complex>& wfn, std::vector<unsigned> const& b, double phi,
-    std::vector<unsigned> const& cs, std::vector<unsigned> const& qs)
-{
-    std::size_t cmask = make_mask(cs);
-
-    if (isDiagonal(b)) {
-        std::size_t mask = make_mask(qs);
-        complex phase = std::exp(complex(0., -phi));
-
-        for (std::intptr_t x = 0; x < static_cast<std::intptr_t>(wfn.size()); x++) {
-            if ((x & cmask) == cmask) {
-                wfn[x] *= (poppar(x & mask) ? phase : std::conj(phase));
-            }
-        }
-    } else { // see Exp-implementation-details.txt for the explanation of the algorithm below
-        std::size_t xy_bits = 0;
-        std::size_t yz_bits = 0;
-        int y_count = 0;
-        for (unsigned i = 0; i < b.size(); ++i) {
-            switch (b[i]) {
-            case PauliX:
-                xy_bits |= (1ull << qs[i]);
-                break;
-            case PauliY:
-                xy_bits |= (1ull << qs[i]);
-                yz_bits |= (1ull << qs[i]);
-                ++y_count;
-                break;
-            case PauliZ:
-                yz_bits |= (1ull << qs[i]);
-                break;
-            case PauliI:
-                break;
-            }
-        }
-
-        real1 alpha = (real1)std::cos(phi);
-        complex beta = (real1)std::sin(phi) * iExp(3 * y_count + 1);
-        complex gamma = (real1)std::sin(phi) * iExp(y_count + 1);
-
-        for (std::intptr_t x = 0; x < static_cast<std::intptr_t>(wfn.size()); x++) {
-            std::intptr_t t = x ^ xy_bits;
-            if (x < t && ((x & cmask) == cmask)) {
-                auto parity = poppar(x & yz_bits);
-                auto a = wfn[x];
-                auto b = wfn[t];
-                wfn[x] = alpha * a + (parity ? -beta : beta) * b;
-                wfn[t] = alpha * b + (parity ? -gamma : gamma) * a;
-            }
-        }
-    }
+    simulator->ExpPauli(
+        &(paulis[0]), &(qubits[0]), paulis.size(), nc ? &(controls[0]) : NULL, controls.size(), (real1)phi);
 }
 
 extern "C" {
@@ -756,21 +668,7 @@ MICROSOFT_QUANTUM_DECL void Exp(
     } else if (bVec.size() == 1) {
         RHelper(sid, bVec.front(), -2. * phi, qVec.front());
     } else {
-        QInterfacePtr simulator = simulators[sid];
-        std::vector<complex> wfn((bitCapIntOcl)simulator->GetMaxQPower());
-        simulator->GetQuantumState(&(wfn[0]));
-
-        std::vector<unsigned> bVec(n);
-        std::copy(b, b + n, bVec.begin());
-
-        std::vector<unsigned> csVec;
-
-        std::vector<unsigned> qVec(n);
-        std::copy(q, q + n, qVec.begin());
-
-        apply_controlled_exp(wfn, bVec, phi, csVec, qVec);
-
-        simulator->SetQuantumState(&(wfn[0]));
+        ExpHelper(sid, bVec, phi, 0, NULL, qVec);
     }
 }
 
@@ -801,16 +699,7 @@ MICROSOFT_QUANTUM_DECL void MCExp(_In_ unsigned sid, _In_ unsigned n, _In_reads_
     } else if (bVec.size() == 1) {
         MCRHelper(sid, bVec.front(), -2. * phi, nc, cs, qVec.front());
     } else {
-        QInterfacePtr simulator = simulators[sid];
-        std::vector<complex> wfn((bitCapIntOcl)simulator->GetMaxQPower());
-        simulator->GetQuantumState(&(wfn[0]));
-
-        std::vector<unsigned> csVec(nc);
-        std::copy(cs, cs + nc, csVec.begin());
-
-        apply_controlled_exp(wfn, bVec, phi, csVec, qVec);
-
-        simulator->SetQuantumState(&(wfn[0]));
+        ExpHelper(sid, bVec, phi, nc, cs, qVec);
     }
 }
 
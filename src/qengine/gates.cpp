@@ -12,23 +12,80 @@
 
 #include "qengine_cpu.hpp"
 
+// A conservative L2 cache size, for the state vector blocks of ApplySingleBitSequence()
+#define CACHE_BLOCK_BYTES 262144U
+// The shortest run of contiguous amplitudes we accept in a block
+#define MIN_BLOCK_RUN_BITS 8U
+// The most deviation from unit modulus for a phase factor that we defer, (since deferred phases must not change
+// probabilities)
+#define PHASE_NORM_EPSILON 1e-6f
+
 namespace Qrack {
 
-void QEngineCPU::ApplyM(bitCapInt regMask, bitCapInt result, complex nrm)
+/**
+ * Gather the "N" amplitudes touched by a dense N x N matrix, multiply, (and scale by "nrm,") and scatter them back.
+ * Results with norm below "norm_thresh" are set to zero. Returns the summed norm of the other results.
+ */
+template <bitCapIntOcl N>
+inline real1 ApplyMatrixKernel(StateVector* sv, const bitCapInt* offsets, const complex* mtrx, const real1& nrm,
+    const real1& norm_thresh, const bitCapInt& lcv)
+{
+    complex amps[N];
+    bitCapIntOcl i, j;
+    for (i = 0; i < N; i++) {
+        amps[i] = sv->read(lcv + offsets[i]);
+    }
+
+    real1 partNrm = ZERO_R1;
+    for (i = 0; i < N; i++) {
+        const complex* row = mtrx + (i * N);
+        complex amp = ZERO_CMPLX;
+        for (j = 0; j < N; j++) {
+            amp += row[j] * amps[j];
+        }
+        amp *= nrm;
+
+        real1 ampNorm = norm(amp);
+        if (ampNorm < norm_thresh) {
+            amp = ZERO_CMPLX;
+        } else {
+            partNrm += ampNorm;
+        }
+        sv->write(lcv + offsets[i], amp);
+    }
+
+    return partNrm;
+}
+
+void QEngineCPU::ApplyMFloor(bitCapInt regMask, bitCapInt result, complex nrm, real1 norm_thresh)
 {
+    regMask = MapPermutation(regMask);
+    result = MapPermutation(result);
+
+    if (!isSparse) {
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        par_for(0, maxQPower, [&](const bitCapInt i, const int cpu) {
+            if ((i & regMask) == result) {
+                const complex amp = sv->read(i);
+                sv->write(i, (norm(amp) < norm_thresh) ? ZERO_CMPLX : (nrm * amp));
+            } else {
+                sv->write(i, ZERO_CMPLX);
+            }
+        });
+        runningNorm = ONE_R1;
+        return;
+    }
+
     ParallelFunc fn = [&](const bitCapInt i, const int cpu) {
-        if ((i & regMask) == result) {
-            stateVec->write(i, nrm * stateVec->read(i));
+        complex amp = stateVec->read(i);
+        if (((i & regMask) == result) && (norm(amp) >= norm_thresh)) {
+            stateVec->write(i, nrm * amp);
         } else {
             stateVec->write(i, complex(ZERO_R1, ZERO_R1));
         }
     };
 
-    if (stateVec->is_sparse()) {
-        par_for_set(CastStateVecSparse()->iterable(), fn);
-    } else {
-        par_for(0, maxQPower, fn);
-    }
+    par_for_set(CastStateVecSparse()->iterable(), fn);
 
     runningNorm = ONE_R1;
 }
@@ -51,4 +108,1018 @@ void QEngineCPU::PhaseFlip()
     }
 }
 
+/// Apply a single bit transformation that only effects phase.
+void QEngineCPU::ApplySinglePhase(const complex topLeft, const complex bottomRight, bitLenInt qubitIndex)
+{
+    ApplyEitherControlledPhase(NULL, 0, qubitIndex, topLeft, bottomRight, false);
+}
+
+/// Apply a single bit transformation that reverses bit probability and might effect phase.
+void QEngineCPU::ApplySingleInvert(const complex topRight, const complex bottomLeft, bitLenInt qubitIndex)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        // Apply2x2() normalizes in the same pass.
+        QInterface::ApplySingleInvert(topRight, bottomLeft, qubitIndex);
+        return;
+    }
+
+    bitCapInt qPowers[1];
+    qPowers[0] = pow2(qubitIndex);
+    ApplyInvert2x2(0, qPowers[0], topRight, bottomLeft, 1, qPowers);
+}
+
+void QEngineCPU::ApplyControlledSinglePhase(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topLeft, const complex bottomRight)
+{
+    ApplyEitherControlledPhase(controls, controlLen, target, topLeft, bottomRight, false);
+}
+
+void QEngineCPU::ApplyControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topRight, const complex bottomLeft)
+{
+    ApplyEitherControlledInvert(controls, controlLen, target, topRight, bottomLeft, false);
+}
+
+void QEngineCPU::ApplyAntiControlledSinglePhase(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topLeft, const complex bottomRight)
+{
+    ApplyEitherControlledPhase(controls, controlLen, target, topLeft, bottomRight, true);
+}
+
+void QEngineCPU::ApplyAntiControlledSingleInvert(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topRight, const complex bottomLeft)
+{
+    ApplyEitherControlledInvert(controls, controlLen, target, topRight, bottomLeft, true);
+}
+
+/**
+ * Controlled phase gates are deferred as phase terms, to be applied together with any neighboring diagonal operators
+ * in a single pass, (unless they are not unitary).
+ */
+void QEngineCPU::ApplyEitherControlledPhase(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topLeft, const complex bottomRight, const bool anti)
+{
+    const complex mtrx[4] = { topLeft, ZERO_CMPLX, ZERO_CMPLX, bottomRight };
+    if (IsIdentity(mtrx, controlLen > 0)) {
+        return;
+    }
+
+    if ((abs(norm(topLeft) - ONE_R1) < PHASE_NORM_EPSILON) && (abs(norm(bottomRight) - ONE_R1) < PHASE_NORM_EPSILON)) {
+        bitCapInt controlMask = 0;
+        for (bitLenInt i = 0; i < controlLen; i++) {
+            controlMask |= pow2(MapQubit(controls[i]));
+        }
+        bitCapInt controlPerm = anti ? 0 : controlMask;
+        bitCapInt targetPower = pow2(MapQubit(target));
+
+        // The top left factor applies to the whole controlled subspace, and the ratio to its target |1> half.
+        AddPhaseTerm(controlMask, controlPerm, topLeft);
+        AddPhaseTerm(controlMask | targetPower, controlPerm | targetPower, bottomRight / topLeft);
+        return;
+    }
+
+    if (controlLen == 0) {
+        if (doNormalize && (runningNorm != ONE_R1)) {
+            // Apply2x2() normalizes in the same pass.
+            QInterface::ApplySinglePhase(topLeft, bottomRight, target);
+            return;
+        }
+
+        bitCapInt qPowers[1];
+        qPowers[0] = pow2(target);
+        ApplyPhase2x2(0, qPowers[0], topLeft, bottomRight, 1, qPowers);
+        return;
+    }
+
+    bitCapInt* qPowersSorted = new bitCapInt[controlLen + 1U];
+    bitCapInt controlMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        qPowersSorted[i] = pow2(controls[i]);
+        controlMask |= qPowersSorted[i];
+    }
+    bitCapInt targetPower = pow2(target);
+    qPowersSorted[controlLen] = targetPower;
+    std::sort(qPowersSorted, qPowersSorted + controlLen + 1U);
+
+    if (anti) {
+        controlMask = 0;
+    }
+
+    ApplyPhase2x2(controlMask, controlMask | targetPower, topLeft, bottomRight, controlLen + 1U, qPowersSorted);
+
+    delete[] qPowersSorted;
+}
+
+void QEngineCPU::ApplyEitherControlledInvert(const bitLenInt* controls, const bitLenInt& controlLen,
+    const bitLenInt& target, const complex topRight, const complex bottomLeft, const bool anti)
+{
+    if (controlLen == 0) {
+        ApplySingleInvert(topRight, bottomLeft, target);
+        return;
+    }
+
+    bitCapInt* qPowersSorted = new bitCapInt[controlLen + 1U];
+    bitCapInt controlMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        qPowersSorted[i] = pow2(controls[i]);
+        controlMask |= qPowersSorted[i];
+    }
+    bitCapInt targetPower = pow2(target);
+    qPowersSorted[controlLen] = targetPower;
+    std::sort(qPowersSorted, qPowersSorted + controlLen + 1U);
+
+    if (anti) {
+        controlMask = 0;
+    }
+
+    ApplyInvert2x2(controlMask, controlMask | targetPower, topRight, bottomLeft, controlLen + 1U, qPowersSorted);
+
+    delete[] qPowersSorted;
+}
+
+void QEngineCPU::ApplyPhase2x2(bitCapInt offset1, bitCapInt offset2, const complex topLeft,
+    const complex bottomRight, const bitLenInt bitCount, const bitCapInt* qPowersSorted)
+{
+    std::vector<bitCapInt> mappedPowers;
+    qPowersSorted = MapPairs(offset1, offset2, bitCount, qPowersSorted, mappedPowers);
+
+    ParallelFunc fn;
+    if (topLeft == ONE_CMPLX) {
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            stateVec->write(lcv + offset2, bottomRight * stateVec->read(lcv + offset2));
+        };
+    } else if (bottomRight == ONE_CMPLX) {
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            stateVec->write(lcv + offset1, topLeft * stateVec->read(lcv + offset1));
+        };
+    } else {
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            stateVec->write2(lcv + offset1, topLeft * stateVec->read(lcv + offset1), lcv + offset2,
+                bottomRight * stateVec->read(lcv + offset2));
+        };
+    }
+
+    ParForPairs(offset1, offset2, bitCount, qPowersSorted, fn);
+}
+
+void QEngineCPU::ApplyInvert2x2(bitCapInt offset1, bitCapInt offset2, const complex topRight,
+    const complex bottomLeft, const bitLenInt bitCount, const bitCapInt* qPowersSorted)
+{
+    FlushPhaseTerms();
+
+    std::vector<bitCapInt> mappedPowers;
+    qPowersSorted = MapPairs(offset1, offset2, bitCount, qPowersSorted, mappedPowers);
+
+    if ((topRight == ONE_CMPLX) && (bottomLeft == ONE_CMPLX)) {
+        ApplySwap2x2(offset1, offset2, bitCount, qPowersSorted);
+        return;
+    }
+
+    ParForPairs(offset1, offset2, bitCount, qPowersSorted, [&](const bitCapInt lcv, const int cpu) {
+        complex Y0 = stateVec->read(lcv + offset1);
+        stateVec->write2(lcv + offset1, topRight * stateVec->read(lcv + offset2), lcv + offset2, bottomLeft * Y0);
+    });
+}
+
+void QEngineCPU::ApplySwap2x2(
+    bitCapInt offset1, bitCapInt offset2, const bitLenInt bitCount, const bitCapInt* qPowersSorted)
+{
+    if (stateVec->is_sparse()) {
+        ParForPairs(offset1, offset2, bitCount, qPowersSorted, [&](const bitCapInt lcv, const int cpu) {
+            complex Y0 = stateVec->read(lcv + offset1);
+            stateVec->write2(lcv + offset1, stateVec->read(lcv + offset2), lcv + offset2, Y0);
+        });
+        return;
+    }
+
+    // Below the lowest target or control bit, the amplitude pairs are contiguous runs, which we exchange wholesale.
+    const bitCapInt runLength = qPowersSorted[0];
+    const bitLenInt runBits = log2(runLength);
+    StateVector* sv = stateVec.get();
+
+    par_for(0, maxQPower >> (bitCapIntOcl)(runBits + bitCount), [&](const bitCapInt lcv, const int cpu) {
+        bitCapInt i = lcv << (bitCapIntOcl)runBits;
+        for (bitLenInt p = 0; p < bitCount; p++) {
+            bitCapInt lowMask = qPowersSorted[p] - ONE_BCI;
+            i = ((i & ~lowMask) << ONE_BCI) | (i & lowMask);
+        }
+        sv->swap_range(i + offset1, i + offset2, runLength);
+    });
+}
+
+void QEngineCPU::ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    // Kernels are unrolled for up to 5 bits, (a 32x32 matrix).
+    if (targetLen > 5U) {
+        QInterface::ApplyMatrix(targets, targetLen, mtrx);
+        return;
+    }
+
+    bitLenInt i;
+    bitCapIntOcl j;
+
+    bitCapIntOcl targetPower = pow2Ocl(targetLen);
+    bitCapInt qPowersSorted[5];
+    bitCapInt offsets[32] = { 0 };
+    bitCapInt targetMask = 0;
+    for (i = 0; i < targetLen; i++) {
+        qPowersSorted[i] = pow2(MapQubit(targets[i]));
+        if (targetMask & qPowersSorted[i]) {
+            throw std::invalid_argument("ApplyMatrix target bits must be distinct.");
+        }
+        targetMask |= qPowersSorted[i];
+        for (j = 0; j < targetPower; j++) {
+            if (j & pow2Ocl(i)) {
+                offsets[j] |= qPowersSorted[i];
+            }
+        }
+    }
+
+    std::sort(qPowersSorted, qPowersSorted + targetLen);
+
+    FlushPhaseTerms();
+
+    // Every amplitude is visited, so a pending normalization is applied, (and the norm recalculated,) as in Apply2x2().
+    const bool doCalcNorm = doNormalize && (runningNorm != ONE_R1);
+    const real1 nrm = doCalcNorm ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
+    const real1 norm_thresh = doCalcNorm ? amplitudeFloor : ZERO_R1;
+
+    int numCores = GetConcurrencyLevel();
+    real1* rngNrm = new real1[numCores]();
+
+    StateVector* sv = stateVec.get();
+    ParallelFunc fn;
+    switch (targetLen) {
+    case 2:
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            rngNrm[cpu] += ApplyMatrixKernel<4U>(sv, offsets, mtrx, nrm, norm_thresh, lcv);
+        };
+        break;
+    case 3:
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            rngNrm[cpu] += ApplyMatrixKernel<8U>(sv, offsets, mtrx, nrm, norm_thresh, lcv);
+        };
+        break;
+    case 4:
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            rngNrm[cpu] += ApplyMatrixKernel<16U>(sv, offsets, mtrx, nrm, norm_thresh, lcv);
+        };
+        break;
+    default:
+        fn = [&](const bitCapInt lcv, const int cpu) {
+            rngNrm[cpu] += ApplyMatrixKernel<32U>(sv, offsets, mtrx, nrm, norm_thresh, lcv);
+        };
+        break;
+    }
+
+    ParForPairs(0, targetMask, targetLen, qPowersSorted, fn);
+
+    if (doCalcNorm) {
+        runningNorm = ZERO_R1;
+        for (int cpu = 0; cpu < numCores; cpu++) {
+            runningNorm += rngNrm[cpu];
+        }
+    }
+    delete[] rngNrm;
+}
+
+/**
+ * Apply a sequence of single bit gates one cache-sized block of the state vector at a time, rather than one full pass
+ * per gate.
+ *
+ * A block spans a contiguous run of the lowest bits, plus (up to) several higher bits that are gate targets. With the
+ * remaining bits held fixed, the block's amplitudes are a set of contiguous runs, each of which stays long enough to
+ * stream well, and every gate in the sequence is applied to the block before we move on to the next one.
+ */
+void QEngineCPU::ApplySingleBitSequence(const complex* mtrxs, const bitLenInt* targets, const unsigned int gateCount)
+{
+    const bitLenInt blockBits = log2(CACHE_BLOCK_BYTES / sizeof(complex));
+
+    if ((gateCount < 2U) || stateVec->is_sparse() || (qubitCount <= blockBits)) {
+        QInterface::ApplySingleBitSequence(mtrxs, targets, gateCount);
+        return;
+    }
+
+    FlushPhaseTerms();
+
+    unsigned int i;
+    bitLenInt j;
+
+    // Blocks are laid out over physical bit positions.
+    const bitLenInt* logicalTargets = targets;
+    std::vector<bitLenInt> physicalTargets(gateCount);
+    for (i = 0; i < gateCount; i++) {
+        physicalTargets[i] = MapQubit(targets[i]);
+    }
+    targets = &(physicalTargets[0]);
+
+    std::vector<unsigned int> targetCounts(qubitCount, 0);
+    for (i = 0; i < gateCount; i++) {
+        if (!IsIdentity(mtrxs + (4U * i))) {
+            targetCounts[targets[i]]++;
+        }
+    }
+
+    // Choose which high bits to bring into the block. Every high bit we add shortens the contiguous low runs, which
+    // can bring more target bits into the high set, so we iterate until the choice is stable.
+    const bitLenInt maxHighBits = blockBits - MIN_BLOCK_RUN_BITS;
+    bitLenInt lowBits = blockBits;
+    std::vector<bitLenInt> highBits;
+    for (;;) {
+        highBits.clear();
+        for (j = lowBits; j < qubitCount; j++) {
+            if (targetCounts[j]) {
+                highBits.push_back(j);
+            }
+        }
+
+        bitLenInt nLowBits = blockBits - std::min((bitLenInt)highBits.size(), maxHighBits);
+        if (nLowBits == lowBits) {
+            break;
+        }
+        lowBits = nLowBits;
+    }
+
+    // If there are too many high targets, keep the busiest, and apply the rest as ordinary full passes.
+    // (Gates on different bits commute, so only the order of gates on the same bit matters.)
+    if (highBits.size() > maxHighBits) {
+        std::stable_sort(highBits.begin(), highBits.end(),
+            [&](const bitLenInt& a, const bitLenInt& b) { return targetCounts[a] > targetCounts[b]; });
+        for (j = maxHighBits; j < highBits.size(); j++) {
+            for (i = 0; i < gateCount; i++) {
+                if (targets[i] == highBits[j]) {
+                    ApplySingleBit(mtrxs + (4U * i), logicalTargets[i]);
+                }
+            }
+            targetCounts[highBits[j]] = 0;
+        }
+        highBits.resize(maxHighBits);
+        std::sort(highBits.begin(), highBits.end());
+    }
+
+    const bitLenInt highLen = highBits.size();
+    std::vector<bitLenInt> blockTargets;
+    std::vector<complex> blockMtrxs;
+    for (i = 0; i < gateCount; i++) {
+        if (!targetCounts[targets[i]] || IsIdentity(mtrxs + (4U * i))) {
+            continue;
+        }
+
+        // Low targets are stored as bit positions, and high targets as "qubitCount" plus their position in the
+        // high bit list.
+        if (targets[i] < lowBits) {
+            blockTargets.push_back(targets[i]);
+        } else {
+            blockTargets.push_back(
+                qubitCount + (std::find(highBits.begin(), highBits.end(), targets[i]) - highBits.begin()));
+        }
+        blockMtrxs.insert(blockMtrxs.end(), mtrxs + (4U * i), mtrxs + (4U * i) + 4U);
+    }
+
+    if (blockTargets.size() == 0) {
+        return;
+    }
+
+    // Fold any pending normalization into the first gate, since every gate touches every amplitude.
+    if (doNormalize && (runningNorm != ONE_R1) && (runningNorm > ZERO_R1)) {
+        real1 nrm = ONE_R1 / std::sqrt(runningNorm);
+        for (i = 0; i < 4U; i++) {
+            blockMtrxs[i] *= nrm;
+        }
+    }
+
+    const bitCapIntOcl runLength = pow2Ocl(lowBits);
+    const bitCapIntOcl runCount = pow2Ocl(highLen);
+    std::vector<bitCapInt> runOffsets(runCount, 0);
+    for (bitCapIntOcl r = 0; r < runCount; r++) {
+        for (j = 0; j < highLen; j++) {
+            if (r & pow2Ocl(j)) {
+                runOffsets[r] |= pow2(highBits[j]);
+            }
+        }
+    }
+
+    const unsigned int blockGateCount = blockTargets.size();
+    const bitCapInt blockCount = pow2(qubitCount - (lowBits + highLen));
+    const real1 norm_thresh = amplitudeFloor;
+    const int numCores = GetConcurrencyLevel();
+    real1* rngNrm = doNormalize ? new real1[numCores]() : NULL;
+    StateVector* sv = stateVec.get();
+
+    par_for(0, blockCount, [&](const bitCapInt blk, const int cpu) {
+        // Spread the block index over the bits that are outside of the block.
+        bitCapInt blockStart = blk << lowBits;
+        for (bitLenInt h = 0; h < highLen; h++) {
+            bitCapInt lowMask = pow2(highBits[h]) - ONE_BCI;
+            blockStart = ((blockStart & ~lowMask) << ONE_BCI) | (blockStart & lowMask);
+        }
+
+        bitCapIntOcl r, k;
+        bitCapInt i0, i1;
+        complex Y0, Y1;
+        for (unsigned int g = 0; g < blockGateCount; g++) {
+            const complex* mtrx = &(blockMtrxs[4U * g]);
+            const bitLenInt target = blockTargets[g];
+
+            if (target < qubitCount) {
+                // The target is inside every contiguous run.
+                const bitCapIntOcl targetPower = pow2Ocl(target);
+                const bitCapIntOcl lowMask = targetPower - 1U;
+                for (r = 0; r < runCount; r++) {
+                    for (k = 0; k < (runLength >> 1U); k++) {
+                        i0 = blockStart + runOffsets[r] + (((k & ~lowMask) << 1U) | (k & lowMask));
+                        i1 = i0 + targetPower;
+                        Y0 = sv->read(i0);
+                        Y1 = sv->read(i1);
+                        sv->write2(i0, (mtrx[0] * Y0) + (mtrx[1] * Y1), i1, (mtrx[2] * Y0) + (mtrx[3] * Y1));
+                    }
+                }
+            } else {
+                // The target pairs whole runs with each other.
+                const bitCapIntOcl runPower = pow2Ocl(target - qubitCount);
+                const bitCapInt targetPower = pow2(highBits[target - qubitCount]);
+                for (r = 0; r < runCount; r++) {
+                    if (r & runPower) {
+                        continue;
+                    }
+                    for (k = 0; k < runLength; k++) {
+                        i0 = blockStart + runOffsets[r] + k;
+                        i1 = i0 + targetPower;
+                        Y0 = sv->read(i0);
+                        Y1 = sv->read(i1);
+                        sv->write2(i0, (mtrx[0] * Y0) + (mtrx[1] * Y1), i1, (mtrx[2] * Y0) + (mtrx[3] * Y1));
+                    }
+                }
+            }
+        }
+
+        if (!doNormalize) {
+            return;
+        }
+
+        real1 nrm;
+        for (r = 0; r < runCount; r++) {
+            for (k = 0; k < runLength; k++) {
+                i0 = blockStart + runOffsets[r] + k;
+                nrm = norm(sv->read(i0));
+                if (nrm < norm_thresh) {
+                    sv->write(i0, ZERO_CMPLX);
+                } else {
+                    rngNrm[cpu] += nrm;
+                }
+            }
+        }
+    });
+
+    if (doNormalize) {
+        runningNorm = ZERO_R1;
+        for (int c = 0; c < numCores; c++) {
+            runningNorm += rngNrm[c];
+        }
+        delete[] rngNrm;
+    }
+}
+
+/**
+ * Apply a layer of single bit gates on distinct bits as one tensor product.
+ *
+ * As for the Walsh-Hadamard transform in H(), gates on bits below the cache block size are all applied to one block
+ * before moving on to the next, and the rest are applied in full passes. In both cases, gates are taken two at a
+ * time, so each group of four amplitudes is loaded once, transformed by both gates in registers, and stored once.
+ */
+void QEngineCPU::ApplySingleBitLayer(const complex* mtrxs, bitLenInt start, bitLenInt length)
+{
+    if (isSparse || (length < 2U)) {
+        QInterface::ApplySingleBitLayer(mtrxs, start, length);
+        return;
+    }
+
+    FlushPhaseTerms();
+
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+
+    const bitLenInt cacheLen = log2((bitCapInt)(CACHE_BLOCK_BYTES / sizeof(complex)));
+    const bitLenInt blockLen = (qubitCount < cacheLen) ? qubitCount : cacheLen;
+
+    // Order the gates by physical bit, leaving out identities, and split them at the cache block boundary.
+    std::vector<std::pair<bitLenInt, const complex*>> gates;
+    for (bitLenInt i = 0; i < length; i++) {
+        if (!IsIdentity(mtrxs + (4U * i))) {
+            gates.push_back(std::make_pair(MapQubit(start + i), mtrxs + (4U * i)));
+        }
+    }
+    std::sort(gates.begin(), gates.end());
+
+    if (!gates.size()) {
+        return;
+    }
+
+    std::vector<bitCapInt> powers(gates.size());
+    std::vector<complex> gateMtrxs(4U * gates.size());
+    size_t lowCount = 0;
+    for (size_t i = 0; i < gates.size(); i++) {
+        powers[i] = pow2(gates[i].first);
+        std::copy(gates[i].second, gates[i].second + 4U, gateMtrxs.begin() + (4U * i));
+        if (gates[i].first < blockLen) {
+            lowCount++;
+        }
+    }
+
+    // Fold any pending normalization into one gate, since every gate touches every amplitude.
+    if (doNormalize && (runningNorm != ONE_R1) && (runningNorm > ZERO_R1)) {
+        const real1 nrm = ONE_R1 / std::sqrt(runningNorm);
+        for (bitLenInt i = 0; i < 4U; i++) {
+            gateMtrxs[i] *= nrm;
+        }
+    }
+
+    auto apply2 = [&](const bitCapIntOcl& i, const bitCapIntOcl& power, const complex* mtrx) {
+        const complex Y0 = sv->read(i);
+        const complex Y1 = sv->read(i | power);
+        sv->write2(i, (mtrx[0] * Y0) + (mtrx[1] * Y1), i | power, (mtrx[2] * Y0) + (mtrx[3] * Y1));
+    };
+
+    auto apply4 = [&](const bitCapIntOcl& i, const bitCapIntOcl& power1, const complex* mtrx1,
+                      const bitCapIntOcl& power2, const complex* mtrx2) {
+        const complex Y00 = sv->read(i);
+        const complex Y01 = sv->read(i | power1);
+        const complex Y10 = sv->read(i | power2);
+        const complex Y11 = sv->read(i | power1 | power2);
+
+        const complex Z00 = (mtrx1[0] * Y00) + (mtrx1[1] * Y01);
+        const complex Z01 = (mtrx1[2] * Y00) + (mtrx1[3] * Y01);
+        const complex Z10 = (mtrx1[0] * Y10) + (mtrx1[1] * Y11);
+        const complex Z11 = (mtrx1[2] * Y10) + (mtrx1[3] * Y11);
+
+        sv->write2(i, (mtrx2[0] * Z00) + (mtrx2[1] * Z10), i | power2, (mtrx2[2] * Z00) + (mtrx2[3] * Z10));
+        sv->write2(i | power1, (mtrx2[0] * Z01) + (mtrx2[1] * Z11), i | power1 | power2,
+            (mtrx2[2] * Z01) + (mtrx2[3] * Z11));
+    };
+
+    size_t g;
+    for (g = lowCount; (g + 1U) < gates.size(); g += 2U) {
+        const bitCapIntOcl power1 = (bitCapIntOcl)powers[g];
+        const bitCapIntOcl power2 = (bitCapIntOcl)powers[g + 1U];
+        const complex* mtrx1 = &(gateMtrxs[4U * g]);
+        const complex* mtrx2 = &(gateMtrxs[4U * (g + 1U)]);
+        par_for_mask(0, maxQPower, &(powers[g]), 2U, [&](const bitCapInt lcv, const int cpu) {
+            apply4((bitCapIntOcl)lcv, power1, mtrx1, power2, mtrx2);
+        });
+    }
+
+    if (g < gates.size()) {
+        const bitCapIntOcl power = (bitCapIntOcl)powers[g];
+        const complex* mtrx = &(gateMtrxs[4U * g]);
+        par_for_skip(0, maxQPower, power, 1U,
+            [&](const bitCapInt lcv, const int cpu) { apply2((bitCapIntOcl)lcv, power, mtrx); });
+    }
+
+    // The block pass goes last, so that it can also take the norm, if we're normalizing.
+    if (!lowCount && !doNormalize) {
+        return;
+    }
+
+    const bitCapIntOcl blockSize = pow2Ocl(blockLen);
+    const real1 norm_thresh = amplitudeFloor;
+    const int numCores = GetConcurrencyLevel();
+    std::vector<real1> rngNrm(numCores, ZERO_R1);
+
+    par_for(0, maxQPower >> blockLen, [&](const bitCapInt block, const int cpu) {
+        const bitCapIntOcl base = (bitCapIntOcl)block << blockLen;
+
+        size_t h;
+        for (h = 0; (h + 1U) < lowCount; h += 2U) {
+            const bitCapIntOcl power1 = (bitCapIntOcl)powers[h];
+            const bitCapIntOcl power2 = (bitCapIntOcl)powers[h + 1U];
+            const bitCapIntOcl lowMask1 = power1 - ONE_BCI;
+            const bitCapIntOcl lowMask2 = power2 - ONE_BCI;
+            const complex* mtrx1 = &(gateMtrxs[4U * h]);
+            const complex* mtrx2 = &(gateMtrxs[4U * (h + 1U)]);
+            for (bitCapIntOcl k = 0; k < (blockSize >> 2U); k++) {
+                bitCapIntOcl i = ((k & ~lowMask1) << 1U) | (k & lowMask1);
+                i = ((i & ~lowMask2) << 1U) | (i & lowMask2);
+                apply4(base | i, power1, mtrx1, power2, mtrx2);
+            }
+        }
+
+        if (h < lowCount) {
+            const bitCapIntOcl power = (bitCapIntOcl)powers[h];
+            const bitCapIntOcl lowMask = power - ONE_BCI;
+            const complex* mtrx = &(gateMtrxs[4U * h]);
+            for (bitCapIntOcl k = 0; k < (blockSize >> 1U); k++) {
+                apply2(base | ((k & ~lowMask) << 1U) | (k & lowMask), power, mtrx);
+            }
+        }
+
+        if (!doNormalize) {
+            return;
+        }
+
+        for (bitCapIntOcl k = 0; k < blockSize; k++) {
+            const real1 nrm = norm(sv->read(base | k));
+            if (nrm < norm_thresh) {
+                sv->write(base | k, ZERO_CMPLX);
+            } else {
+                rngNrm[cpu] += nrm;
+            }
+        }
+    });
+
+    if (doNormalize) {
+        runningNorm = ZERO_R1;
+        for (int c = 0; c < numCores; c++) {
+            runningNorm += rngNrm[c];
+        }
+    }
+}
+
+/// "fSim" gate, (useful in the simulation of particles with fermionic statistics)
+void QEngineCPU::FSim(real1 theta, real1 phi, bitLenInt qubit1, bitLenInt qubit2)
+{
+    real1 cosTheta = cos(theta);
+    real1 sinTheta = sin(theta);
+
+    // With only one of the two factors, QEngine already applies a single pass.
+    if ((qubit1 == qubit2) || (cosTheta == ONE_R1) || (phi == ZERO_R1)) {
+        QEngine::FSim(theta, phi, qubit1, qubit2);
+        return;
+    }
+
+    const bitLenInt targets[2] = { qubit1, qubit2 };
+    const complex fSim[16] = { ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, complex(cosTheta, ZERO_R1),
+        complex(ZERO_R1, sinTheta), ZERO_CMPLX, ZERO_CMPLX, complex(ZERO_R1, sinTheta), complex(cosTheta, ZERO_R1),
+        ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, exp(complex(ZERO_R1, phi)) };
+    ApplyMatrix(targets, 2, fSim);
+}
+
+/// Parity phase gate, deferred as a phase term
+void QEngineCPU::PhaseParity(real1 radians, bitCapInt mask)
+{
+    mask = MapPermutation(mask);
+    if (!mask) {
+        return;
+    }
+
+    // Apply e^(-i*radians/2) everywhere, and e^(i*radians) more to odd parity.
+    AddPhaseTerm(0, 0, complex(cos(radians / 2), -sin(radians / 2)));
+
+    PhaseTerm term;
+    term.condition = PhaseTerm::ODD_PARITY;
+    term.mask = mask;
+    term.value = 0;
+    term.flagMask = 0;
+    term.shift = 0;
+    term.factor = complex(cos(radians), sin(radians));
+    AddPhaseTerm(term);
+}
+
+/// Pauli string exponentiation, as phase terms if the string is diagonal, or otherwise as one pass over pairs
+void QEngineCPU::ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitLenInt* controls, const bitLenInt& controlLen, real1 radians)
+{
+    if (length == 0) {
+        return;
+    }
+
+    bitCapInt xyMask = 0;
+    bitCapInt yzMask = 0;
+    bitLenInt yCount = 0;
+    for (bitLenInt i = 0; i < length; i++) {
+        bitCapInt qPower = pow2(MapQubit(qubits[i]));
+        switch (paulis[i]) {
+        case PauliX:
+            xyMask |= qPower;
+            break;
+        case PauliY:
+            xyMask |= qPower;
+            yzMask |= qPower;
+            yCount++;
+            break;
+        case PauliZ:
+            yzMask |= qPower;
+            break;
+        default:
+            break;
+        }
+    }
+
+    bitCapInt controlMask = 0;
+    for (bitLenInt i = 0; i < controlLen; i++) {
+        controlMask |= pow2(MapQubit(controls[i]));
+    }
+
+    const complex phaseFac = complex(cos(radians), sin(radians));
+
+    if (!xyMask) {
+        const complex mtrx[4] = { phaseFac, ZERO_CMPLX, ZERO_CMPLX, phaseFac };
+        if (!yzMask && IsIdentity(mtrx, controlLen > 0)) {
+            return;
+        }
+
+        // Even parity gets e^(i*radians), and odd parity gets e^(-i*radians).
+        AddPhaseTerm(controlMask, controlMask, phaseFac);
+        if (yzMask) {
+            PhaseTerm term;
+            term.condition = PhaseTerm::ODD_PARITY;
+            term.mask = yzMask;
+            term.value = 0;
+            term.flagMask = controlMask;
+            term.shift = 0;
+            term.factor = conj(phaseFac * phaseFac);
+            AddPhaseTerm(term);
+        }
+
+        return;
+    }
+
+    FlushPhaseTerms();
+
+    // Each pair is visited from the member with the highest X/Y bit clear.
+    bitCapInt pivot = xyMask;
+    while (pivot & (pivot - ONE_BCI)) {
+        pivot &= pivot - ONE_BCI;
+    }
+
+    const complex iPowers[4] = { ONE_CMPLX, I_CMPLX, -ONE_CMPLX, -I_CMPLX };
+    const complex alpha = complex(cos(radians), ZERO_R1);
+    const complex beta = (real1)sin(radians) * iPowers[(3U * yCount + 1U) & 3U];
+    const complex gamma = (real1)sin(radians) * iPowers[(yCount + 1U) & 3U];
+
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        bitCapInt x = lcv | controlMask;
+        bitCapInt t = x ^ xyMask;
+
+        bool isOdd = false;
+        for (bitCapInt v = x & yzMask; v; v &= v - ONE_BCI) {
+            isOdd = !isOdd;
+        }
+
+        complex a = stateVec->read(x);
+        complex b = stateVec->read(t);
+        stateVec->write2(x, alpha * a + (isOdd ? -beta : beta) * b, t, alpha * b + (isOdd ? -gamma : gamma) * a);
+    };
+
+    if (stateVec->is_sparse()) {
+        std::vector<bitCapInt> nonzero = CastStateVecSparse()->iterable();
+        std::set<bitCapInt> pairs;
+        for (size_t i = 0; i < nonzero.size(); i++) {
+            if ((nonzero[i] & controlMask) == controlMask) {
+                pairs.insert((nonzero[i] & pivot) ? (nonzero[i] ^ xyMask) : nonzero[i]);
+            }
+        }
+        par_for_set(pairs, fn);
+        return;
+    }
+
+    std::vector<bitCapInt> skipPowers;
+    for (bitCapInt v = controlMask | pivot; v; v &= v - ONE_BCI) {
+        skipPowers.push_back(v & ~(v - ONE_BCI));
+    }
+    par_for_mask(0, maxQPower, &(skipPowers[0]), skipPowers.size(), fn);
+}
+
+/// Quantum Fourier Transform, as a single FFT over the register
+void QEngineCPU::QFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    if (isSparse || (length == 0)) {
+        QInterface::QFT(start, length, trySeparate);
+        return;
+    }
+
+    ApplyFFT(start, length, false);
+}
+
+/// Inverse Quantum Fourier Transform, as a single inverse FFT over the register
+void QEngineCPU::IQFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    if (isSparse || (length == 0)) {
+        QInterface::IQFT(start, length, trySeparate);
+        return;
+    }
+
+    ApplyFFT(start, length, true);
+}
+
+/// Exact time evolution, with the Lanczos sweeps parallelized over this engine's cores
+void QEngineCPU::TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance)
+{
+    if (isSparse) {
+        std::vector<complex> amps((bitCapIntOcl)maxQPower);
+        GetQuantumState(&(amps[0]));
+        KrylovTimeEvolve(h, timeDiff, tolerance, &(amps[0]), qubitCount, *this);
+        SetQuantumState(&(amps[0]));
+        return;
+    }
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+    MaterializeState();
+
+    // The dense amplitudes are in logical order now, so the Lanczos sweeps can run on them in place.
+    KrylovTimeEvolve(h, timeDiff, tolerance, static_cast<StateVectorArray*>(stateVec.get())->data(), qubitCount, *this);
+    runningNorm = ONE_R1;
+}
+
+/**
+ * Bitwise Hadamard, as an in-place fast Walsh-Hadamard transform.
+ *
+ * The transform factors into independent butterfly stages, one per bit, that may run in any order. Stages on bits
+ * below the cache block size are all applied to one block before moving on to the next, and the remaining stages are
+ * applied two bits at a time, (as radix-4 butterflies on H (x) H,) so each pass over the full state vector does the
+ * work of two.
+ */
+void QEngineCPU::H(bitLenInt start, bitLenInt length)
+{
+    if (isSparse || (length < 2U)) {
+        QInterface::H(start, length);
+        return;
+    }
+
+    // Phase terms are diagonal, and don't commute with H.
+    FlushPhaseTerms();
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+
+    const bitLenInt cacheLen = log2((bitCapInt)(CACHE_BLOCK_BYTES / sizeof(complex)));
+    const bitLenInt blockLen = (qubitCount < cacheLen) ? qubitCount : cacheLen;
+
+    std::vector<bitCapIntOcl> lowPowers;
+    std::vector<bitCapInt> highPowers;
+    for (bitLenInt i = 0; i < length; i++) {
+        const bitLenInt bit = MapQubit(start + i);
+        if (bit < blockLen) {
+            lowPowers.push_back(pow2Ocl(bit));
+        } else {
+            highPowers.push_back(pow2(bit));
+        }
+    }
+    std::sort(highPowers.begin(), highPowers.end());
+
+    // The in-block stages add and subtract without scaling, and the last of them scales by the product of all of
+    // their 1/sqrt(2) factors.
+    if (lowPowers.size()) {
+        const bitCapIntOcl halfBlock = pow2Ocl(blockLen) >> 1U;
+        const real1 nrm = (real1)pow(M_SQRT1_2, (double)lowPowers.size());
+        const size_t lastStage = lowPowers.size() - 1U;
+        par_for(0, maxQPower >> blockLen, [&](const bitCapInt block, const int cpu) {
+            const bitCapIntOcl base = (bitCapIntOcl)block << blockLen;
+            for (size_t s = 0; s < lowPowers.size(); s++) {
+                const bitCapIntOcl power = lowPowers[s];
+                const bitCapIntOcl lowMask = power - ONE_BCI;
+                const real1 scale = (s == lastStage) ? nrm : ONE_R1;
+                for (bitCapIntOcl k = 0; k < halfBlock; k++) {
+                    const bitCapIntOcl i = base | ((k & ~lowMask) << 1U) | (k & lowMask);
+                    const complex Y0 = sv->read(i);
+                    const complex Y1 = sv->read(i | power);
+                    sv->write2(i, scale * (Y0 + Y1), i | power, scale * (Y0 - Y1));
+                }
+            }
+        });
+    }
+
+    size_t s;
+    for (s = 0; (s + 1U) < highPowers.size(); s += 2U) {
+        const bitCapIntOcl power1 = (bitCapIntOcl)highPowers[s];
+        const bitCapIntOcl power2 = (bitCapIntOcl)highPowers[s + 1U];
+        const real1 half = ONE_R1 / 2;
+        par_for_mask(0, maxQPower, &(highPowers[s]), 2U, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl i = (bitCapIntOcl)lcv;
+            const complex Y00 = sv->read(i);
+            const complex Y01 = sv->read(i | power1);
+            const complex Y10 = sv->read(i | power2);
+            const complex Y11 = sv->read(i | power1 | power2);
+
+            const complex sum0 = Y00 + Y01;
+            const complex diff0 = Y00 - Y01;
+            const complex sum1 = Y10 + Y11;
+            const complex diff1 = Y10 - Y11;
+
+            sv->write2(i, half * (sum0 + sum1), i | power1, half * (diff0 + diff1));
+            sv->write2(i | power2, half * (sum0 - sum1), i | power1 | power2, half * (diff0 - diff1));
+        });
+    }
+
+    if (s < highPowers.size()) {
+        const bitCapIntOcl power = (bitCapIntOcl)highPowers[s];
+        const real1 nrm = (real1)M_SQRT1_2;
+        par_for_skip(0, maxQPower, power, 1U, [&](const bitCapInt lcv, const int cpu) {
+            const bitCapIntOcl i = (bitCapIntOcl)lcv;
+            const complex Y0 = sv->read(i);
+            const complex Y1 = sv->read(i | power);
+            sv->write2(i, nrm * (Y0 + Y1), i | power, nrm * (Y0 - Y1));
+        });
+    }
+}
+
+void QEngineCPU::ApplyFFT(bitLenInt start, bitLenInt length, bool isInverse)
+{
+    MaterializeState();
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+
+    // Twiddle factors are e^(-/+2*pi*i*j/2^length), for j < 2^(length - 1). We keep two tables of about
+    // sqrt(2^length) entries each, for the high and low halves of the bits of j.
+    const bitLenInt twiddleLen = length - 1U;
+    const bitLenInt lowLen = twiddleLen / 2U;
+    const bitCapIntOcl lowMask = pow2MaskOcl(lowLen);
+    std::vector<complex> lowTwiddles(pow2Ocl(lowLen));
+    std::vector<complex> highTwiddles(pow2Ocl(twiddleLen - lowLen));
+    const double angle = (isInverse ? 2 : -2) * M_PI / (double)pow2Ocl(length);
+    for (bitCapIntOcl j = 0; j < lowTwiddles.size(); j++) {
+        lowTwiddles[j] = complex((real1)cos(angle * j), (real1)sin(angle * j));
+    }
+    for (bitCapIntOcl j = 0; j < highTwiddles.size(); j++) {
+        highTwiddles[j] = complex((real1)cos(angle * (j << lowLen)), (real1)sin(angle * (j << lowLen)));
+    }
+
+    const bitCapIntOcl regMask = pow2MaskOcl(length);
+    const real1 nrm = (real1)M_SQRT1_2;
+
+    // Butterfly for the stage that pairs register bit "m," on the amplitude pair whose lower member is "i." The
+    // forward transform decimates in frequency, and the inverse decimates in time, so each stage of one exactly undoes
+    // the same stage of the other.
+    auto butterfly = [&](const bitCapIntOcl& i, const bitLenInt& m) {
+        const bitCapIntOcl halfPower = pow2Ocl(start + m);
+        const bitCapIntOcl j = (((i >> start) & regMask) & pow2MaskOcl(m)) << (twiddleLen - m);
+        complex twiddle = highTwiddles[j >> lowLen] * lowTwiddles[j & lowMask];
+
+        complex Y0 = sv->read(i);
+        complex Y1 = sv->read(i | halfPower);
+        if (isInverse) {
+            Y1 *= twiddle;
+            sv->write2(i, nrm * (Y0 + Y1), i | halfPower, nrm * (Y0 - Y1));
+        } else {
+            sv->write2(i, nrm * (Y0 + Y1), i | halfPower, (nrm * twiddle) * (Y0 - Y1));
+        }
+    };
+
+    // The stages on the lowest bits only pair amplitudes within the same cache-sized block, so they are all done in
+    // one pass, block by block.
+    const bitLenInt cacheLen = log2((bitCapInt)(CACHE_BLOCK_BYTES / sizeof(complex)));
+    const bitLenInt blockLen = (qubitCount < cacheLen) ? qubitCount : cacheLen;
+    bitLenInt blockStages = (blockLen > start) ? (blockLen - start) : 0;
+    if (blockStages > length) {
+        blockStages = length;
+    }
+
+    auto blockPass = [&]() {
+        if (!blockStages) {
+            return;
+        }
+        const bitCapIntOcl blockSize = pow2Ocl(blockLen);
+        par_for(0, maxQPower >> blockLen, [&](const bitCapInt block, const int cpu) {
+            const bitCapIntOcl base = (bitCapIntOcl)block << blockLen;
+            for (bitLenInt s = 0; s < blockStages; s++) {
+                const bitLenInt m = isInverse ? s : (blockStages - (s + 1U));
+                const bitCapIntOcl lowBits = pow2MaskOcl(start + m);
+                for (bitCapIntOcl k = 0; k < (blockSize >> 1U); k++) {
+                    butterfly(base | ((k & ~lowBits) << 1U) | (k & lowBits), m);
+                }
+            }
+        });
+    };
+
+    auto stagePass = [&](const bitLenInt& m) {
+        par_for_skip(0, maxQPower, pow2(start + m), 1,
+            [&](const bitCapInt lcv, const int cpu) { butterfly((bitCapIntOcl)lcv, m); });
+    };
+
+    if (isInverse) {
+        blockPass();
+        for (bitLenInt m = blockStages; m < length; m++) {
+            stagePass(m);
+        }
+    } else {
+        for (bitLenInt m = length; m > blockStages; m--) {
+            stagePass(m - 1U);
+        }
+        blockPass();
+    }
+}
+
+/// Swap values of two bits in register, by relabeling them in the qubit map, without touching the state vector
+void QEngineCPU::Swap(bitLenInt qubit1, bitLenInt qubit2)
+{
+    if (qubit1 == qubit2) {
+        return;
+    }
+
+    InitQubitMap();
+    std::swap(qubitMap[qubit1], qubitMap[qubit2]);
+}
+
 } // namespace Qrack
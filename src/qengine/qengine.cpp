@@ -52,6 +52,35 @@ bool QEngine::ForceM(bitLenInt qubit, bool result, bool doForce, bool doApply)
     return result;
 }
 
+bitCapIntOcl QEngine::DrawPermutation(
+    const real1* probArray, const bitCapIntOcl& lengthPower, const real1& totProb, real1& nrmlzr)
+{
+    real1 prob = Rand() * totProb;
+
+    real1 lowerProb = ZERO_R1;
+    real1 largestProb = ZERO_R1;
+    bitCapIntOcl result = lengthPower - ONE_BCI;
+
+    // The draw lands in the first permutation whose cumulative probability exceeds it, which skips any permutation of
+    // zero probability, and includes the last permutation.
+    for (bitCapIntOcl lcv = 0; lcv < lengthPower; lcv++) {
+        lowerProb += probArray[lcv];
+        if (prob < lowerProb) {
+            nrmlzr = probArray[lcv];
+            return lcv;
+        }
+        if (largestProb < probArray[lcv]) {
+            largestProb = probArray[lcv];
+            result = lcv;
+        }
+    }
+
+    // Rounding can leave the cumulative sum short of the draw, in which case, take the most probable permutation.
+    nrmlzr = probArray[result];
+
+    return result;
+}
+
 /// Measure permutation state of a register
 bitCapInt QEngine::ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply)
 {
@@ -90,7 +119,6 @@ bitCapInt QEngine::ForceM(const bitLenInt* bits, const bitLenInt& length, const
 
     bitCapIntOcl lengthPower = pow2Ocl(length);
     real1 nrmlzr = ONE_R1;
-    bitCapIntOcl lcv;
     bitCapInt result;
     complex nrm;
 
@@ -107,38 +135,9 @@ bitCapInt QEngine::ForceM(const bitLenInt* bits, const bitLenInt& length, const
         return result;
     }
 
-    real1 prob = Rand();
     real1* probArray = new real1[lengthPower]();
-
     ProbMaskAll(regMask, probArray);
-
-    lcv = 0;
-    real1 lowerProb = ZERO_R1;
-    real1 largestProb = ZERO_R1;
-    result = lengthPower - ONE_BCI;
-
-    /*
-     * The value of 'lcv' should not exceed lengthPower unless the stateVec is
-     * in a bug-induced topology - some value in stateVec must always be a
-     * vector.
-     */
-    while ((lowerProb < prob) && (lcv < lengthPower)) {
-        lowerProb += probArray[lcv];
-        if (largestProb <= probArray[lcv]) {
-            largestProb = probArray[lcv];
-            nrmlzr = largestProb;
-            result = lcv;
-        }
-        lcv++;
-    }
-    if (lcv < lengthPower) {
-        if (lcv > 0) {
-            lcv--;
-        }
-        result = lcv;
-        nrmlzr = probArray[lcv];
-    }
-
+    result = DrawPermutation(probArray, lengthPower, ONE_R1, nrmlzr);
     delete[] probArray;
 
     i = 0;
@@ -177,7 +176,7 @@ void QEngine::ApplySingleBit(const complex* mtrx, bitLenInt qubit)
 void QEngine::ApplyControlledSingleBit(
     const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
 {
-    if (IsIdentity(mtrx)) {
+    if (IsIdentity(mtrx, controlLen > 0)) {
         return;
     }
 
@@ -198,7 +197,7 @@ void QEngine::ApplyControlledSingleBit(
 void QEngine::ApplyAntiControlledSingleBit(
     const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
 {
-    if (IsIdentity(mtrx)) {
+    if (IsIdentity(mtrx, controlLen > 0)) {
         return;
     }
 
@@ -492,35 +491,9 @@ bitCapInt QEngine::ForceMReg(bitLenInt start, bitLenInt length, bitCapInt result
     if (doForce) {
         nrmlzr = ProbMask(regMask, result << (bitCapIntOcl)start);
     } else {
-        bitCapIntOcl lcv = 0;
         real1* probArray = new real1[lengthPower]();
         ProbRegAll(start, length, probArray);
-
-        real1 prob = Rand();
-        real1 lowerProb = ZERO_R1;
-        real1 largestProb = ZERO_R1;
-        result = lengthPower - ONE_BCI;
-
-        /*
-         * The value of 'lcv' should not exceed lengthPower unless the stateVec is
-         * in a bug-induced topology - some value in stateVec must always be a
-         * vector.
-         */
-        while ((lowerProb < prob) && (lcv < lengthPower)) {
-            lowerProb += probArray[lcv];
-            if (largestProb <= probArray[lcv]) {
-                largestProb = probArray[lcv];
-                nrmlzr = largestProb;
-                result = lcv;
-            }
-            lcv++;
-        }
-        if (lcv < lengthPower) {
-            lcv--;
-            result = lcv;
-            nrmlzr = probArray[lcv];
-        }
-
+        result = DrawPermutation(probArray, lengthPower, ONE_R1, nrmlzr);
         delete[] probArray;
     }
 
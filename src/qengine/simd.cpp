@@ -0,0 +1,128 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// Dispatch of the vectorized 2x2 kernels, selected at runtime according to GetSimdLevel().
+//
+// This file is compiled for the baseline instruction set, like the rest of the library. It only gathers the indices of
+// amplitude pairs into batches, and hands each batch to the kernel variant for the host's tier. The variants live in
+// src/qengine/simd_<tier>.cpp, each compiled with its own flags, (see simd_kernels.hpp).
+
+#include "qengine_cpu.hpp"
+
+#if ENABLE_COMPLEX_X2
+
+#include "common/cpufeatures.hpp"
+#include "common/simd_kernels.hpp"
+
+// Number of amplitude pairs handed to a kernel variant per call
+#define SIMD_BATCH 64U
+
+namespace Qrack {
+
+static Apply2x2Kernel SelectApply2x2Kernel()
+{
+    switch (GetSimdLevel()) {
+    case SIMD_AVX512:
+        return Apply2x2Avx512;
+    case SIMD_AVX2:
+        return Apply2x2Avx2;
+    case SIMD_AVX:
+        return Apply2x2Avx;
+    case SIMD_SSE2:
+        return Apply2x2Sse2;
+    default:
+        return NULL;
+    }
+}
+
+void QEngineCPU::Apply2x2Simd(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
+    const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh)
+{
+    doCalcNorm = (doCalcNorm || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
+
+    if (norm_thresh < ZERO_R1) {
+        norm_thresh = amplitudeFloor;
+    }
+
+    const Apply2x2Kernel kernel = SelectApply2x2Kernel();
+
+    const real1 nrm = doCalcNorm ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
+    const complex nMtrx[4] = { nrm * mtrx[0], nrm * mtrx[1], nrm * mtrx[2], nrm * mtrx[3] };
+
+    simd_real* amps = reinterpret_cast<simd_real*>(static_cast<StateVectorArray*>(stateVec.get())->data());
+    const size_t off1 = (size_t)(bitCapIntOcl)offset1;
+    const size_t off2 = (size_t)(bitCapIntOcl)offset2;
+
+    const bitCapIntOcl pairCount = (bitCapIntOcl)(maxQPower >> bitCount);
+    const bitCapIntOcl batchCount = (pairCount + SIMD_BATCH - 1U) / SIMD_BATCH;
+
+    int numCores = GetConcurrencyLevel();
+    real1* rngNrm = new real1[numCores]();
+
+    par_for(0, batchCount, [&](const bitCapInt batch, const int cpu) {
+        const bitCapIntOcl start = (bitCapIntOcl)batch * SIMD_BATCH;
+        const bitCapIntOcl count = ((pairCount - start) < SIMD_BATCH) ? (pairCount - start) : SIMD_BATCH;
+
+        size_t bases[SIMD_BATCH];
+        for (bitCapIntOcl k = 0; k < count; k++) {
+            // Open a zero bit at each of the (ascending) skipped powers, as par_for_mask() does.
+            bitCapIntOcl lcv = start + k;
+            for (bitLenInt p = 0; p < bitCount; p++) {
+                bitCapIntOcl lowMask = (bitCapIntOcl)qPowersSorted[p] - ONE_BCI;
+                lcv = ((lcv & ~lowMask) << ONE_BCI) | (lcv & lowMask);
+            }
+            bases[k] = (size_t)lcv;
+        }
+
+        rngNrm[cpu] += kernel(amps, bases, (size_t)count, off1, off2, reinterpret_cast<const simd_real*>(nMtrx),
+            doCalcNorm, norm_thresh);
+    });
+
+    if (doCalcNorm) {
+        runningNorm = ZERO_R1;
+        for (int i = 0; i < numCores; i++) {
+            runningNorm += rngNrm[i];
+        }
+    }
+    delete[] rngNrm;
+}
+
+real1 QEngineCPU::ApplyUniformRunSimd(const complex* mtrx, const real1& nrm, const bitCapInt& offset,
+    bitCapInt freePerm, const bitCapInt& freeMask, const bitCapInt& targetPower, const bitCapInt& runLength)
+{
+    const Apply2x2Kernel kernel = SelectApply2x2Kernel();
+
+    const complex nMtrx[4] = { nrm * mtrx[0], nrm * mtrx[1], nrm * mtrx[2], nrm * mtrx[3] };
+
+    simd_real* amps = reinterpret_cast<simd_real*>(static_cast<StateVectorArray*>(stateVec.get())->data());
+    const size_t target = (size_t)(bitCapIntOcl)targetPower;
+
+    size_t bases[SIMD_BATCH];
+    real1 partNrm = ZERO_R1;
+    bitCapInt k = 0;
+    while (k < runLength) {
+        size_t count = 0;
+        for (; (count < SIMD_BATCH) && (k < runLength); count++, k++) {
+            bases[count] = (size_t)(bitCapIntOcl)(offset | freePerm);
+            freePerm = ((freePerm | ~freeMask) + ONE_BCI) & freeMask;
+        }
+
+        // A threshold of 0 keeps every amplitude, and only sums the norm.
+        partNrm += kernel(amps, bases, count, 0, target, reinterpret_cast<const simd_real*>(nMtrx), true, ZERO_R1);
+    }
+
+    return partNrm;
+}
+
+} // namespace Qrack
+
+#endif
@@ -0,0 +1,110 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// AVX2 variant of the vectorized 2x2 kernel, (see simd_kernels.hpp,) which differs from the AVX variant by its fused
+// multiply-add. This file alone is compiled with AVX2 and FMA enabled, (see cmake/Complex_x2.cmake,) and it is only
+// called if GetSimdLevel() reports AVX2 support.
+
+#include <immintrin.h>
+
+#include "common/simd_kernels.hpp"
+
+namespace Qrack {
+
+namespace {
+
+#if ENABLE_COMPLEX8
+typedef __m256 simd_vec;
+const size_t SIMD_LANES = 4U;
+
+inline simd_vec Set1(simd_real r) { return _mm256_set1_ps(r); }
+inline simd_vec SetIm(simd_real i) { return _mm256_set_ps(i, -i, i, -i, i, -i, i, -i); }
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm256_mul_ps(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm256_fmadd_ps(a, b, c); }
+inline simd_vec Swap(simd_vec v) { return _mm256_permute_ps(v, 177); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx)
+{
+    const __m128 lo = _mm_loadh_pi(
+        _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(amps + 2U * idx[0])), (const __m64*)(amps + 2U * idx[1]));
+    const __m128 hi = _mm_loadh_pi(
+        _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(amps + 2U * idx[2])), (const __m64*)(amps + 2U * idx[3]));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v)
+{
+    const __m128 lo = _mm256_castps256_ps128(v);
+    const __m128 hi = _mm256_extractf128_ps(v, 1);
+    _mm_storel_pi((__m64*)(amps + 2U * idx[0]), lo);
+    _mm_storeh_pi((__m64*)(amps + 2U * idx[1]), lo);
+    _mm_storel_pi((__m64*)(amps + 2U * idx[2]), hi);
+    _mm_storeh_pi((__m64*)(amps + 2U * idx[3]), hi);
+}
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm256_mul_ps(v, v);
+    n = _mm256_add_ps(n, Swap(n));
+    const simd_vec keep = _mm256_cmp_ps(n, thresh, _CMP_GE_OQ);
+    nrmSum = _mm256_add_ps(nrmSum, _mm256_and_ps(n, keep));
+    return _mm256_and_ps(v, keep);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[8];
+    _mm256_storeu_ps(r, v);
+    return ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+}
+#else
+typedef __m256d simd_vec;
+const size_t SIMD_LANES = 2U;
+
+inline simd_vec Set1(simd_real r) { return _mm256_set1_pd(r); }
+inline simd_vec SetIm(simd_real i) { return _mm256_set_pd(i, -i, i, -i); }
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm256_mul_pd(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm256_fmadd_pd(a, b, c); }
+inline simd_vec Swap(simd_vec v) { return _mm256_permute_pd(v, 5); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx)
+{
+    return _mm256_insertf128_pd(
+        _mm256_castpd128_pd256(_mm_loadu_pd(amps + 2U * idx[0])), _mm_loadu_pd(amps + 2U * idx[1]), 1);
+}
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v)
+{
+    _mm_storeu_pd(amps + 2U * idx[0], _mm256_castpd256_pd128(v));
+    _mm_storeu_pd(amps + 2U * idx[1], _mm256_extractf128_pd(v, 1));
+}
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm256_mul_pd(v, v);
+    n = _mm256_add_pd(n, Swap(n));
+    const simd_vec keep = _mm256_cmp_pd(n, thresh, _CMP_GE_OQ);
+    nrmSum = _mm256_add_pd(nrmSum, _mm256_and_pd(n, keep));
+    return _mm256_and_pd(v, keep);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[4];
+    _mm256_storeu_pd(r, v);
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+#endif
+
+#include "common/simd_kernel_body.hpp"
+
+} // namespace
+
+simd_real Apply2x2Avx2(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh)
+{
+    return Apply2x2Body(amps, bases, count, offset1, offset2, mtrx, doCalcNorm, normThresh);
+}
+
+} // namespace Qrack
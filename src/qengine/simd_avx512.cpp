@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// AVX-512 variant of the vectorized 2x2 kernel, (see simd_kernels.hpp,) which gathers and scatters the amplitudes of
+// its pairs, and floors small results with mask registers. This file alone is compiled with AVX-512F enabled, (see
+// cmake/Complex_x2.cmake,) and it is only called if GetSimdLevel() reports AVX-512 support.
+//
+// The masked forms of the gather and permute intrinsics are used, with full masks, because the unmasked forms trip
+// GCC's uninitialized variable warning.
+
+#include <immintrin.h>
+
+#include "common/simd_kernels.hpp"
+
+namespace Qrack {
+
+namespace {
+
+#if ENABLE_COMPLEX8
+typedef __m512 simd_vec;
+const size_t SIMD_LANES = 8U;
+
+// Each single precision complex number is 64 bits wide, so it can be gathered and scattered as one double.
+inline __m512i Index(const size_t* idx)
+{
+    return _mm512_set_epi64((long long)idx[7], (long long)idx[6], (long long)idx[5], (long long)idx[4],
+        (long long)idx[3], (long long)idx[2], (long long)idx[1], (long long)idx[0]);
+}
+
+inline simd_vec Set1(simd_real r) { return _mm512_set1_ps(r); }
+inline simd_vec SetIm(simd_real i)
+{
+    return _mm512_set_ps(i, -i, i, -i, i, -i, i, -i, i, -i, i, -i, i, -i, i, -i);
+}
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm512_mul_ps(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm512_fmadd_ps(a, b, c); }
+inline simd_vec Swap(simd_vec v) { return _mm512_maskz_permute_ps(0xFFFF, v, 177); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx)
+{
+    return _mm512_castpd_ps(_mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, Index(idx), (const double*)amps, 8));
+}
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v)
+{
+    _mm512_i64scatter_pd((double*)amps, Index(idx), _mm512_castps_pd(v), 8);
+}
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm512_mul_ps(v, v);
+    n = _mm512_add_ps(n, Swap(n));
+    const __mmask16 keep = _mm512_cmp_ps_mask(n, thresh, _CMP_GE_OQ);
+    nrmSum = _mm512_mask_add_ps(nrmSum, keep, nrmSum, n);
+    return _mm512_maskz_mov_ps(keep, v);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[16];
+    _mm512_storeu_ps(r, v);
+    simd_real sum = 0;
+    for (size_t i = 0; i < 16U; i++) {
+        sum += r[i];
+    }
+    return sum;
+}
+#else
+typedef __m512d simd_vec;
+const size_t SIMD_LANES = 4U;
+
+// Each double precision complex number is two doubles wide, so both of its halves are gathered and scattered.
+inline __m512i Index(const size_t* idx)
+{
+    return _mm512_set_epi64((long long)(2U * idx[3] + 1U), (long long)(2U * idx[3]), (long long)(2U * idx[2] + 1U),
+        (long long)(2U * idx[2]), (long long)(2U * idx[1] + 1U), (long long)(2U * idx[1]),
+        (long long)(2U * idx[0] + 1U), (long long)(2U * idx[0]));
+}
+
+inline simd_vec Set1(simd_real r) { return _mm512_set1_pd(r); }
+inline simd_vec SetIm(simd_real i) { return _mm512_set_pd(i, -i, i, -i, i, -i, i, -i); }
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm512_mul_pd(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm512_fmadd_pd(a, b, c); }
+inline simd_vec Swap(simd_vec v) { return _mm512_maskz_permute_pd(0xFF, v, 85); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx)
+{
+    return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, Index(idx), amps, 8);
+}
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v) { _mm512_i64scatter_pd(amps, Index(idx), v, 8); }
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm512_mul_pd(v, v);
+    n = _mm512_add_pd(n, Swap(n));
+    const __mmask8 keep = _mm512_cmp_pd_mask(n, thresh, _CMP_GE_OQ);
+    nrmSum = _mm512_mask_add_pd(nrmSum, keep, nrmSum, n);
+    return _mm512_maskz_mov_pd(keep, v);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[8];
+    _mm512_storeu_pd(r, v);
+    return ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+}
+#endif
+
+#include "common/simd_kernel_body.hpp"
+
+} // namespace
+
+simd_real Apply2x2Avx512(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh)
+{
+    return Apply2x2Body(amps, bases, count, offset1, offset2, mtrx, doCalcNorm, normThresh);
+}
+
+} // namespace Qrack
@@ -0,0 +1,94 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// This is a multithreaded, universal quantum register simulation, allowing
+// (nonphysical) register cloning and direct measurement of probability and
+// phase, to leverage what advantages classical emulation of qubits can have.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+// SSE2 variant of the vectorized 2x2 kernel, (see simd_kernels.hpp). SSE2 is baseline for x86-64, so this file needs no
+// extra compiler flags there.
+
+#include <emmintrin.h>
+
+#include "common/simd_kernels.hpp"
+
+namespace Qrack {
+
+namespace {
+
+#if ENABLE_COMPLEX8
+typedef __m128 simd_vec;
+const size_t SIMD_LANES = 2U;
+
+inline simd_vec Set1(simd_real r) { return _mm_set1_ps(r); }
+inline simd_vec SetIm(simd_real i) { return _mm_set_ps(i, -i, i, -i); }
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm_mul_ps(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline simd_vec Swap(simd_vec v) { return _mm_shuffle_ps(v, v, 177); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx)
+{
+    return _mm_loadh_pi(
+        _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(amps + 2U * idx[0])), (const __m64*)(amps + 2U * idx[1]));
+}
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v)
+{
+    _mm_storel_pi((__m64*)(amps + 2U * idx[0]), v);
+    _mm_storeh_pi((__m64*)(amps + 2U * idx[1]), v);
+}
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm_mul_ps(v, v);
+    n = _mm_add_ps(n, Swap(n));
+    const simd_vec keep = _mm_cmpge_ps(n, thresh);
+    nrmSum = _mm_add_ps(nrmSum, _mm_and_ps(n, keep));
+    return _mm_and_ps(v, keep);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[4];
+    _mm_storeu_ps(r, v);
+    return (r[0] + r[1]) + (r[2] + r[3]);
+}
+#else
+typedef __m128d simd_vec;
+const size_t SIMD_LANES = 1U;
+
+inline simd_vec Set1(simd_real r) { return _mm_set1_pd(r); }
+inline simd_vec SetIm(simd_real i) { return _mm_set_pd(i, -i); }
+inline simd_vec Mul(simd_vec a, simd_vec b) { return _mm_mul_pd(a, b); }
+inline simd_vec MulAdd(simd_vec a, simd_vec b, simd_vec c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+inline simd_vec Swap(simd_vec v) { return _mm_shuffle_pd(v, v, 1); }
+inline simd_vec Load(const simd_real* amps, const size_t* idx) { return _mm_loadu_pd(amps + 2U * idx[0]); }
+inline void Store(simd_real* amps, const size_t* idx, simd_vec v) { _mm_storeu_pd(amps + 2U * idx[0], v); }
+inline simd_vec FloorNorm(simd_vec v, simd_vec thresh, simd_vec& nrmSum)
+{
+    simd_vec n = _mm_mul_pd(v, v);
+    n = _mm_add_pd(n, Swap(n));
+    const simd_vec keep = _mm_cmpge_pd(n, thresh);
+    nrmSum = _mm_add_pd(nrmSum, _mm_and_pd(n, keep));
+    return _mm_and_pd(v, keep);
+}
+inline simd_real Sum(simd_vec v)
+{
+    simd_real r[2];
+    _mm_storeu_pd(r, v);
+    return r[0] + r[1];
+}
+#endif
+
+#include "common/simd_kernel_body.hpp"
+
+} // namespace
+
+simd_real Apply2x2Sse2(simd_real* amps, const size_t* bases, size_t count, size_t offset1, size_t offset2,
+    const simd_real* mtrx, bool doCalcNorm, simd_real normThresh)
+{
+    return Apply2x2Body(amps, bases, count, offset1, offset2, mtrx, doCalcNorm, normThresh);
+}
+
+} // namespace Qrack
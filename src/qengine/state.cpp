@@ -10,18 +10,23 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
+#include <random>
 #include <thread>
 
 #include "qengine_cpu.hpp"
 
+// The most diagonal operators we defer before applying them
+#define MAX_PHASE_TERMS 256U
+// Shots drawn by each independently seeded generator in MultiShotMeasureMask()
+#define STREAM_SHOT_CHUNK 4096U
+// Bits of the contiguous blocks that ProbAllQubits() folds in place
+#define PROB_BLOCK_POW 10U
+// Bits of the blocks that ExpectationQUBO() walks in Gray code order
+#define COST_GRAY_BLOCK_POW 10U
+
 #if ENABLE_COMPLEX_X2
-#if ENABLE_COMPLEX8
-#include "common/complex8x2simd.hpp"
-#define complex2 Complex8x2Simd
-#else
-#include "common/complex16x2simd.hpp"
-#define complex2 Complex16x2Simd
-#endif
+#include "common/cpufeatures.hpp"
 #endif
 
 namespace Qrack {
@@ -41,6 +46,7 @@ QEngineCPU::QEngineCPU(bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_
     real1 norm_thresh, std::vector<bitLenInt> devList)
     : QEngine(qBitCount, rgp, doNorm, randomGlobalPhase, true, useHardwareRNG, norm_thresh)
     , isSparse(useSparseStateVec)
+    , globalPhaseTerm(ONE_CMPLX)
 {
     SetConcurrencyLevel(std::thread::hardware_concurrency());
 
@@ -59,7 +65,82 @@ complex QEngineCPU::GetAmplitude(bitCapInt perm)
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
-    return stateVec->read(perm);
+    if (!phaseTerms.size()) {
+        return globalPhaseTerm * stateVec->read(MapPermutation(perm));
+    }
+    FlushPhaseTerms();
+
+    return stateVec->read(MapPermutation(perm));
+}
+
+/**
+ * The "k" largest amplitudes, by norm
+ *
+ * Each thread keeps a bounded heap of its own best amplitudes, and the heaps are merged at the end, so only the
+ * winners are translated back through the qubit map.
+ */
+std::vector<std::pair<bitCapInt, complex>> QEngineCPU::GetTopAmplitudes(const bitCapIntOcl& k)
+{
+    std::vector<std::pair<bitCapInt, complex>> toRet;
+    if (!k) {
+        return toRet;
+    }
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+    FlushPhaseTerms();
+
+    std::vector<std::vector<std::pair<bitCapInt, complex>>> heaps(GetConcurrencyLevel());
+
+    stateVec->isReadLocked = false;
+    if (isSparse) {
+        par_for_set(CastStateVecSparse()->iterable(), [&](const bitCapInt lcv, const int cpu) {
+            OfferTopAmplitude(heaps[cpu], k, lcv, stateVec->read(lcv));
+        });
+    } else {
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        par_for(0, maxQPower,
+            [&](const bitCapInt lcv, const int cpu) { OfferTopAmplitude(heaps[cpu], k, lcv, sv->read(lcv)); });
+    }
+    stateVec->isReadLocked = true;
+
+    for (size_t i = 0; i < heaps.size(); i++) {
+        for (size_t j = 0; j < heaps[i].size(); j++) {
+            OfferTopAmplitude(toRet, k, heaps[i][j].first, heaps[i][j].second);
+        }
+    }
+
+    if (qubitMap.size()) {
+        for (size_t j = 0; j < toRet.size(); j++) {
+            bitCapInt perm = 0;
+            for (bitLenInt i = 0; i < qubitCount; i++) {
+                if ((toRet[j].first >> qubitMap[i]) & ONE_BCI) {
+                    perm |= pow2(i);
+                }
+            }
+            toRet[j].first = perm;
+        }
+    }
+
+    std::sort(toRet.begin(), toRet.end(), IsAmplitudeAhead);
+
+    return toRet;
+}
+
+/// Amplitudes of a list of permutations, normalizing and flushing deferred phases once for the whole list
+void QEngineCPU::GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+    FlushPhaseTerms();
+
+    stateVec->isReadLocked = false;
+    par_for(0, count, [&](const bitCapInt lcv, const int cpu) {
+        amps[(bitCapIntOcl)lcv] = stateVec->read(MapPermutation(perms[(bitCapIntOcl)lcv]));
+    });
+    stateVec->isReadLocked = true;
 }
 
 void QEngineCPU::SetAmplitude(bitCapInt perm, complex amp)
@@ -68,13 +149,19 @@ void QEngineCPU::SetAmplitude(bitCapInt perm, complex amp)
         NormalizeState();
     }
 
-    runningNorm -= norm(stateVec->read(perm));
+    FlushPhaseTerms();
+
+    bitCapInt physicalPerm = MapPermutation(perm);
+    runningNorm -= norm(stateVec->read(physicalPerm));
     runningNorm += norm(amp);
-    stateVec->write(perm, amp);
+    stateVec->write(physicalPerm, amp);
 }
 
 void QEngineCPU::SetPermutation(bitCapInt perm, complex phaseFac)
 {
+    qubitMap.clear();
+    phaseTerms.clear();
+    globalPhaseTerm = ONE_CMPLX;
     stateVec->clear();
 
     if (phaseFac == complex(-999.0, -999.0)) {
@@ -97,6 +184,9 @@ void QEngineCPU::SetPermutation(bitCapInt perm, complex phaseFac)
 /// Set arbitrary pure quantum state, in unsigned int permutation basis
 void QEngineCPU::SetQuantumState(const complex* inputState)
 {
+    qubitMap.clear();
+    phaseTerms.clear();
+    globalPhaseTerm = ONE_CMPLX;
     stateVec->copy_in(inputState);
     runningNorm = ONE_R1;
 }
@@ -107,6 +197,7 @@ void QEngineCPU::GetQuantumState(complex* outputState)
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
+    MaterializeState();
 
     stateVec->copy_out(outputState);
 }
@@ -117,6 +208,7 @@ void QEngineCPU::GetProbs(real1* outputProbs)
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
+    MaterializeState();
 
     stateVec->get_probs(outputProbs);
 }
@@ -124,106 +216,41 @@ void QEngineCPU::GetProbs(real1* outputProbs)
 /**
  * Apply a 2x2 matrix to the state vector
  *
- * A fundamental operation used by almost all gates.
+ * A fundamental operation used by almost all gates. If vectorized variants were compiled in, and the host CPU
+ * supports them, this dispatches dense state vectors to Apply2x2Simd().
  */
-
-#if ENABLE_COMPLEX_X2
-
-union ComplexUnion {
-    complex2 cmplx2;
-    complex cmplx[2];
-
-    inline ComplexUnion(){};
-    inline ComplexUnion(const complex& cmplx0, const complex& cmplx1)
-    {
-        cmplx[0] = cmplx0;
-        cmplx[1] = cmplx1;
-    }
-};
-
 void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
     const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh)
 {
-    doCalcNorm = (doCalcNorm || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
-
-    if (norm_thresh < ZERO_R1) {
-        norm_thresh = amplitudeFloor;
+    // An uncontrolled single bit gate visits every amplitude, so a lone pending global phase can ride along with it.
+    complex phasedMtrx[4];
+    if ((bitCount == 1U) && !phaseTerms.size() && (globalPhaseTerm != ONE_CMPLX)) {
+        for (bitLenInt i = 0; i < 4U; i++) {
+            phasedMtrx[i] = globalPhaseTerm * mtrx[i];
+        }
+        mtrx = phasedMtrx;
+        globalPhaseTerm = ONE_CMPLX;
     }
 
-    int numCores = GetConcurrencyLevel();
-    real1 nrm = doNormalize ? (ONE_R1 / std::sqrt(runningNorm)) : ONE_R1;
-    ComplexUnion mtrxCol1(mtrx[0], mtrx[2]);
-    ComplexUnion mtrxCol2(mtrx[1], mtrx[3]);
-
-    real1* rngNrm = NULL;
-    ParallelFunc fn;
-    if (doCalcNorm) {
-        rngNrm = new real1[numCores]();
-
-        fn = [&](const bitCapInt lcv, const int cpu) {
-            ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
-
-            qubit.cmplx2 = matrixMul(nrm, mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
-
-            real1 dotMulRes = norm(qubit.cmplx[0]);
-            if (dotMulRes < norm_thresh) {
-                qubit.cmplx[0] = ZERO_CMPLX;
-            } else {
-                rngNrm[cpu] += dotMulRes;
-            }
+    FlushPhaseTerms();
 
-            dotMulRes = norm(qubit.cmplx[1]);
-            if (dotMulRes < norm_thresh) {
-                qubit.cmplx[1] = ZERO_CMPLX;
-            } else {
-                rngNrm[cpu] += dotMulRes;
-            }
+    std::vector<bitCapInt> mappedPowers;
+    qPowersSorted = MapPairs(offset1, offset2, bitCount, qPowersSorted, mappedPowers);
 
-#if ENABLE_COMPLEX8
-            stateVec->write(lcv + offset1, qubit.cmplx[0]);
-            stateVec->write(lcv + offset2, qubit.cmplx[1]);
-#else
-            stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
-#endif
-        };
-    } else {
-        fn = [&](const bitCapInt lcv, const int cpu) {
-            ComplexUnion qubit(stateVec->read(lcv + offset1), stateVec->read(lcv + offset2));
-
-            qubit.cmplx2 = matrixMul(mtrxCol1.cmplx2, mtrxCol2.cmplx2, qubit.cmplx2);
-#if ENABLE_COMPLEX8
-            stateVec->write(lcv + offset1, qubit.cmplx[0]);
-            stateVec->write(lcv + offset2, qubit.cmplx[1]);
-#else
-            stateVec->write2(lcv + offset1, qubit.cmplx[0], lcv + offset2, qubit.cmplx[1]);
-#endif
-        };
+    // A (controlled) Pauli X, or a swap, is a pure permutation of amplitudes, if no normalization is due.
+    if ((mtrx[0] == ZERO_CMPLX) && (mtrx[1] == ONE_CMPLX) && (mtrx[2] == ONE_CMPLX) && (mtrx[3] == ZERO_CMPLX) &&
+        (!doNormalize || (!doCalcNorm && (runningNorm == ONE_R1)))) {
+        ApplySwap2x2(offset1, offset2, bitCount, qPowersSorted);
+        return;
     }
 
-    if (stateVec->is_sparse()) {
-        bitCapInt setMask = offset1 ^ offset2;
-        bitCapInt filterMask = 0;
-        for (bitLenInt i = 0; i < bitCount; i++) {
-            filterMask |= (qPowersSorted[i] & ~setMask);
-        }
-        bitCapInt filterValues = filterMask & offset1 & offset2;
-        par_for_set(CastStateVecSparse()->iterable(setMask, filterMask, filterValues), fn);
-    } else {
-        par_for_mask(0, maxQPower, qPowersSorted, bitCount, fn);
+#if ENABLE_COMPLEX_X2
+    if (!isSparse && (GetSimdLevel() != SIMD_NONE)) {
+        Apply2x2Simd(offset1, offset2, mtrx, bitCount, qPowersSorted, doCalcNorm, norm_thresh);
+        return;
     }
+#endif
 
-    if (doCalcNorm) {
-        runningNorm = ZERO_R1;
-        for (int i = 0; i < numCores; i++) {
-            runningNorm += rngNrm[i];
-        }
-        delete[] rngNrm;
-    }
-}
-#else
-void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* mtrx, const bitLenInt bitCount,
-    const bitCapInt* qPowersSorted, bool doCalcNorm, real1 norm_thresh)
-{
     doCalcNorm = (doCalcNorm || (runningNorm != ONE_R1)) && doNormalize && (bitCount == 1);
 
     if (norm_thresh < ZERO_R1) {
@@ -277,6 +304,20 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
         };
     }
 
+    ParForPairs(offset1, offset2, bitCount, qPowersSorted, fn);
+
+    if (doCalcNorm) {
+        runningNorm = ZERO_R1;
+        for (int i = 0; i < numCores; i++) {
+            runningNorm += rngNrm[i];
+        }
+        delete[] rngNrm;
+    }
+}
+
+void QEngineCPU::ParForPairs(
+    bitCapInt offset1, bitCapInt offset2, const bitLenInt bitCount, const bitCapInt* qPowersSorted, ParallelFunc fn)
+{
     if (stateVec->is_sparse()) {
         bitCapInt setMask = offset1 ^ offset2;
         bitCapInt filterMask = 0;
@@ -288,16 +329,7 @@ void QEngineCPU::Apply2x2(bitCapInt offset1, bitCapInt offset2, const complex* m
     } else {
         par_for_mask(0, maxQPower, qPowersSorted, bitCount, fn);
     }
-
-    if (doCalcNorm) {
-        runningNorm = ZERO_R1;
-        for (int i = 0; i < numCores; i++) {
-            runningNorm += rngNrm[i];
-        }
-        delete[] rngNrm;
-    }
 }
-#endif
 
 void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
     bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
@@ -309,30 +341,29 @@ void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const b
         return;
     }
 
-    bitCapInt targetPower = pow2(qubitIndex);
+    FlushPhaseTerms();
+
+    bitCapInt targetPower = pow2(MapQubit(qubitIndex));
 
     real1 nrm = ONE_R1 / std::sqrt(runningNorm);
 
     bitCapInt* qPowers = new bitCapInt[controlLen];
+    bitCapInt controlMask = 0;
     for (bitLenInt i = 0; i < controlLen; i++) {
-        qPowers[i] = pow2(controls[i]);
+        qPowers[i] = pow2(MapQubit(controls[i]));
+        controlMask |= qPowers[i];
     }
 
     int numCores = GetConcurrencyLevel();
     real1* rngNrm = new real1[numCores];
     std::fill(rngNrm, rngNrm + numCores, ZERO_R1);
 
-    par_for_skip(0, maxQPower, targetPower, 1, [&](const bitCapInt lcv, const int cpu) {
-        bitCapIntOcl offset = 0;
-        for (bitLenInt j = 0; j < controlLen; j++) {
-            if (lcv & qPowers[j]) {
-                offset |= pow2Ocl(j);
-            }
-        }
-
+    // Offset is permutation * 4, for the components of 2x2 matrices. (Note that this sacrifices 2 qubits of capacity
+    // for the unsigned bitCapInt.)
+    auto mtrxOffset = [&](const bitCapInt& controlPerm) {
         bitCapInt i, iHigh, iLow;
         bitCapIntOcl p;
-        iHigh = offset;
+        iHigh = controlPerm;
         i = 0;
         for (p = 0; p < mtrxSkipLen; p++) {
             iLow = iHigh & (mtrxSkipPowers[p] - ONE_BCI);
@@ -341,24 +372,81 @@ void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const b
         }
         i |= iHigh;
 
-        offset = (bitCapIntOcl)(i | mtrxSkipValueMask);
+        return ((bitCapIntOcl)(i | mtrxSkipValueMask)) * 4U;
+    };
+
+    if (isSparse) {
+        par_for_skip(0, maxQPower, targetPower, 1, [&](const bitCapInt lcv, const int cpu) {
+            bitCapIntOcl controlPerm = 0;
+            for (bitLenInt j = 0; j < controlLen; j++) {
+                if (lcv & qPowers[j]) {
+                    controlPerm |= pow2Ocl(j);
+                }
+            }
+
+            const complex* mtrx = mtrxs + mtrxOffset(controlPerm);
 
-        // Offset is permutation * 4, for the components of 2x2 matrices. (Note that this sacrifices 2 qubits of
-        // capacity for the unsigned bitCapInt.)
-        offset *= 4;
+            complex qubit[2];
 
-        complex qubit[2];
+            complex Y0 = stateVec->read(lcv);
+            qubit[1] = stateVec->read(lcv | targetPower);
 
-        complex Y0 = stateVec->read(lcv);
-        qubit[1] = stateVec->read(lcv | targetPower);
+            qubit[0] = nrm * ((mtrx[0] * Y0) + (mtrx[1] * qubit[1]));
+            qubit[1] = nrm * ((mtrx[2] * Y0) + (mtrx[3] * qubit[1]));
 
-        qubit[0] = nrm * ((mtrxs[0 + offset] * Y0) + (mtrxs[1 + offset] * qubit[1]));
-        qubit[1] = nrm * ((mtrxs[2 + offset] * Y0) + (mtrxs[3 + offset] * qubit[1]));
+            rngNrm[cpu] += norm(qubit[0]) + norm(qubit[1]);
 
-        rngNrm[cpu] += norm(qubit[0]) + norm(qubit[1]);
+            stateVec->write2(lcv, qubit[0], lcv | targetPower, qubit[1]);
+        });
+    } else {
+        // Visit pairs in control-major order: every pair with the same control permutation uses the same matrix, so
+        // each task looks up one matrix and sweeps a run of pairs, stepping only the free bits.
+        const bitCapInt freeMask = (maxQPower - ONE_BCI) ^ (controlMask | targetPower);
+        const bitLenInt freeLen = qubitCount - (controlLen + 1U);
+
+        // With few controls, split each run so that every core has work.
+        bitLenInt splitLen = 0;
+        while ((splitLen < freeLen) && (pow2(controlLen + splitLen) < (bitCapInt)(4 * numCores))) {
+            splitLen++;
+        }
+        const bitCapInt runLength = pow2(freeLen - splitLen);
+        const bitCapInt splitMask = pow2Mask(splitLen);
 
-        stateVec->write2(lcv, qubit[0], lcv | targetPower, qubit[1]);
-    });
+#if ENABLE_COMPLEX_X2
+        const bool isSimd = GetSimdLevel() != SIMD_NONE;
+#endif
+
+        par_for(0, pow2(controlLen + splitLen), [&](const bitCapInt task, const int cpu) {
+            const bitCapInt controlPerm = task >> splitLen;
+
+            bitCapInt offset = 0;
+            for (bitLenInt j = 0; j < controlLen; j++) {
+                if ((controlPerm >> j) & ONE_BCI) {
+                    offset |= qPowers[j];
+                }
+            }
+
+            // The split index selects the highest free bits of the first pair in the run.
+            bitCapInt splitBits = (task & splitMask) << (freeLen - splitLen);
+            bitCapInt freePerm = 0;
+            for (bitCapInt v = freeMask; splitBits; v &= v - ONE_BCI) {
+                if (splitBits & ONE_BCI) {
+                    freePerm |= v & ~(v - ONE_BCI);
+                }
+                splitBits >>= ONE_BCI;
+            }
+
+            const complex* mtrx = mtrxs + mtrxOffset(controlPerm);
+
+#if ENABLE_COMPLEX_X2
+            if (isSimd) {
+                rngNrm[cpu] += ApplyUniformRunSimd(mtrx, nrm, offset, freePerm, freeMask, targetPower, runLength);
+                return;
+            }
+#endif
+            rngNrm[cpu] += ApplyUniformRun(mtrx, nrm, offset, freePerm, freeMask, targetPower, runLength);
+        });
+    }
 
     runningNorm = ZERO_R1;
     for (int i = 0; i < numCores; i++) {
@@ -369,6 +457,36 @@ void QEngineCPU::UniformlyControlledSingleBit(const bitLenInt* controls, const b
     delete[] qPowers;
 }
 
+real1 QEngineCPU::ApplyUniformRun(const complex* mtrx, const real1& nrm, const bitCapInt& offset, bitCapInt freePerm,
+    const bitCapInt& freeMask, const bitCapInt& targetPower, const bitCapInt& runLength)
+{
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+    const complex mtrx0 = nrm * mtrx[0];
+    const complex mtrx1 = nrm * mtrx[1];
+    const complex mtrx2 = nrm * mtrx[2];
+    const complex mtrx3 = nrm * mtrx[3];
+
+    real1 partNrm = ZERO_R1;
+    for (bitCapInt k = 0; k < runLength; k++) {
+        bitCapInt i = offset | freePerm;
+
+        complex Y0 = sv->read(i);
+        complex Y1 = sv->read(i | targetPower);
+
+        complex qubit0 = (mtrx0 * Y0) + (mtrx1 * Y1);
+        complex qubit1 = (mtrx2 * Y0) + (mtrx3 * Y1);
+
+        partNrm += norm(qubit0) + norm(qubit1);
+
+        sv->write2(i, qubit0, i | targetPower, qubit1);
+
+        // Increment only the free bits, by carrying through all of the others.
+        freePerm = ((freePerm | ~freeMask) + ONE_BCI) & freeMask;
+    }
+
+    return partNrm;
+}
+
 /**
  * Combine (a copy of) another QEngineCPU with this one, after the last bit
  * index of this one. (If the programmer doesn't want to "cheat," it is left up
@@ -379,6 +497,9 @@ bitLenInt QEngineCPU::Compose(QEngineCPUPtr toCopy)
     // TODO: Sparse optimization
     bitLenInt result = qubitCount;
 
+    MaterializeState();
+    toCopy->MaterializeState();
+
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
@@ -418,6 +539,9 @@ bitLenInt QEngineCPU::Compose(QEngineCPUPtr toCopy)
  */
 bitLenInt QEngineCPU::Compose(QEngineCPUPtr toCopy, bitLenInt start)
 {
+    MaterializeState();
+    toCopy->MaterializeState();
+
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
@@ -473,9 +597,11 @@ std::map<QInterfacePtr, bitLenInt> QEngineCPU::Compose(std::vector<QInterfacePtr
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
+    MaterializeState();
 
     for (i = 0; i < toComposeCount; i++) {
         QEngineCPUPtr src = std::dynamic_pointer_cast<Qrack::QEngineCPU>(toCopy[i]);
+        src->MaterializeState();
         if ((src->doNormalize) && (src->runningNorm != ONE_R1)) {
             src->NormalizeState();
         }
@@ -523,6 +649,7 @@ void QEngineCPU::DecomposeDispose(bitLenInt start, bitLenInt length, QEngineCPUP
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
+    MaterializeState();
 
     bitLenInt nLength = qubitCount - length;
 
@@ -588,6 +715,11 @@ void QEngineCPU::DecomposeDispose(bitLenInt start, bitLenInt length, QEngineCPUP
     });
 
     if (destination != nullptr) {
+        // Every amplitude of the destination is overwritten below, indexed in logical bit order, so any qubit map it
+        // had is reset to the identity, (and any deferred phase terms it had are dropped).
+        destination->qubitMap.clear();
+        destination->phaseTerms.clear();
+        destination->globalPhaseTerm = ONE_CMPLX;
         par_for(0, partPower, [&](const bitCapInt lcv, const int cpu) {
             destination->stateVec->write(lcv,
                 (real1)(std::sqrt(partStateProb[(bitCapIntOcl)lcv])) *
@@ -630,6 +762,7 @@ void QEngineCPU::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPe
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
+    MaterializeState();
 
     bitLenInt nLength = qubitCount - length;
     bitCapInt remainderPower = pow2(nLength);
@@ -667,89 +800,426 @@ void QEngineCPU::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPe
     ResetStateVec(nStateVec);
 }
 
-/// PSEUDO-QUANTUM Direct measure of bit probability to be in |1> state
-real1 QEngineCPU::Prob(bitLenInt qubit)
+/**
+ * Measure (or force) a register, and dispose of its qubits, in one pass
+ *
+ * The outcome is drawn from the raw marginals of the register, as in ForceMReg(), and then the surviving amplitudes are
+ * copied straight into a state vector of the remaining qubits, scaled by the inverse square root of their raw norm.
+ * The full-size collapse, the renormalization and the separate Dispose() copy are all skipped, and the qubit map is
+ * carried over rather than materialized.
+ */
+bitCapInt QEngineCPU::ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce)
 {
-    if (doNormalize && (runningNorm != ONE_R1)) {
-        NormalizeState();
+    if (isSparse || (length == 0) || (length >= qubitCount)) {
+        return QInterface::ForceMRegDispose(start, length, result, doForce);
     }
 
-    bitCapInt qPower = pow2(qubit);
-    real1 oneChance = 0;
-
-    int numCores = GetConcurrencyLevel();
-    real1* oneChanceBuff = new real1[numCores]();
+    FlushPhaseTerms();
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
-        oneChanceBuff[cpu] += norm(stateVec->read(lcv | qPower));
-    };
+    const bitCapInt regMask = bitRegMask(start, length);
+    real1 nrmlzr = ZERO_R1;
 
-    stateVec->isReadLocked = false;
-    if (stateVec->is_sparse()) {
-        par_for_set(CastStateVecSparse()->iterable(qPower, qPower, qPower), fn);
+    if (doForce) {
+        nrmlzr = ProbMaskBase(regMask, result << (bitCapIntOcl)start);
     } else {
-        par_for_skip(0, maxQPower, qPower, 1U, fn);
+        const bitCapIntOcl lengthPower = pow2Ocl(length);
+        real1* probArray = new real1[lengthPower]();
+        ProbMaskAllBase(regMask, probArray);
+        real1 totProb = ZERO_R1;
+        for (bitCapIntOcl lcv = 0; lcv < lengthPower; lcv++) {
+            totProb += probArray[lcv];
+        }
+        result = DrawPermutation(probArray, lengthPower, totProb, nrmlzr);
+        delete[] probArray;
     }
-    stateVec->isReadLocked = true;
 
-    for (int i = 0; i < numCores; i++) {
-        oneChance += oneChanceBuff[i];
+    if (nrmlzr <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
     }
 
-    delete[] oneChanceBuff;
+    // Physical powers of the measured bits, in ascending order, and the physical outcome
+    std::vector<bitCapInt> measuredPowers(length);
+    bitCapInt physResult = 0;
+    for (bitLenInt j = 0; j < length; j++) {
+        measuredPowers[j] = pow2(MapQubit(start + j));
+        if ((result >> j) & ONE_BCI) {
+            physResult |= measuredPowers[j];
+        }
+    }
+    std::sort(measuredPowers.begin(), measuredPowers.end());
+
+    const bitLenInt nLength = qubitCount - length;
+    const complex nrm = GetNonunitaryPhase() / (real1)(std::sqrt(nrmlzr));
+    const real1 norm_thresh = PendingNormFloor();
+
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+    StateVectorPtr nStateVec = AllocStateVec(pow2(nLength));
+    StateVectorArray* nsv = static_cast<StateVectorArray*>(nStateVec.get());
+
+    par_for(0, pow2(nLength), [&](const bitCapInt lcv, const int cpu) {
+        // Open a zero bit at each measured position, from the lowest up, then fill in the outcome.
+        bitCapInt i = lcv;
+        for (bitLenInt j = 0; j < length; j++) {
+            const bitCapInt lowMask = measuredPowers[j] - ONE_BCI;
+            i = (i & lowMask) | ((i & ~lowMask) << ONE_BCI);
+        }
+        const complex amp = sv->read(i | physResult);
+        nsv->write(lcv, (norm(amp) < norm_thresh) ? ZERO_CMPLX : (nrm * amp));
+    });
 
-    return clampProb(oneChance);
+    // The remaining qubits keep their physical order, with the measured bits closed up.
+    if (qubitMap.size()) {
+        std::vector<bitLenInt> nQubitMap;
+        for (bitLenInt i = 0; i < qubitCount; i++) {
+            if ((i >= start) && (i < (start + length))) {
+                continue;
+            }
+            bitLenInt physical = qubitMap[i];
+            bitLenInt below = 0;
+            for (bitLenInt j = 0; j < length; j++) {
+                if (measuredPowers[j] < pow2(physical)) {
+                    below++;
+                }
+            }
+            nQubitMap.push_back(physical - below);
+        }
+        qubitMap = nQubitMap;
+    }
+
+    SetQubitCount(nLength);
+    ResetStateVec(nStateVec);
+    runningNorm = ONE_R1;
+
+    return result;
 }
 
-/// PSEUDO-QUANTUM Direct measure of full register probability to be in permutation state
-real1 QEngineCPU::ProbAll(bitCapInt fullRegister)
+/**
+ * PSEUDO-QUANTUM - Acts like a measurement gate, except with a specified forced result.
+ *
+ * One pass over the amplitude pairs of the bit sums the raw norms of both outcomes, and a second pass collapses the
+ * state, scaling the surviving half by the inverse square root of its raw norm. This leaves the state normalized,
+ * without the separate NormalizeState() pass. If that pass was pending, survivors under the amplitude floor are
+ * dropped, as it would have dropped them. Otherwise, as with any other ApplyM(), none are.
+ */
+bool QEngineCPU::ForceM(bitLenInt qubit, bool result, bool doForce, bool doApply)
 {
-    if (doNormalize && (runningNorm != ONE_R1)) {
-        NormalizeState();
+    if (isSparse) {
+        return QEngine::ForceM(qubit, result, doForce, doApply);
     }
 
-    return norm(stateVec->read(fullRegister));
-}
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+    const bitCapInt qPower = pow2(MapQubit(qubit));
 
-// Returns probability of permutation of the register
-real1 QEngineCPU::ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation)
-{
-    if (doNormalize && (runningNorm != ONE_R1)) {
-        NormalizeState();
+    int numCores = GetConcurrencyLevel();
+    real1* zeroBuff = new real1[numCores]();
+    real1* oneBuff = new real1[numCores]();
+
+    par_for_skip(0, maxQPower, qPower, 1U, [&](const bitCapInt lcv, const int cpu) {
+        zeroBuff[cpu] += norm(sv->read(lcv));
+        oneBuff[cpu] += norm(sv->read(lcv | qPower));
+    });
+
+    real1 zeroNorm = ZERO_R1;
+    real1 oneNorm = ZERO_R1;
+    for (int i = 0; i < numCores; i++) {
+        zeroNorm += zeroBuff[i];
+        oneNorm += oneBuff[i];
     }
 
-    int num_threads = GetConcurrencyLevel();
-    real1* probs = new real1[num_threads]();
+    delete[] zeroBuff;
+    delete[] oneBuff;
 
-    bitCapInt perm = permutation << start;
+    const real1 totNorm = zeroNorm + oneNorm;
+    if (totNorm <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
+    }
 
-    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | perm)); };
-    stateVec->isReadLocked = false;
-    if (stateVec->is_sparse()) {
-        par_for_set(CastStateVecSparse()->iterable(0, bitRegMask(start, length), perm), fn);
-    } else {
-        par_for_skip(0, maxQPower, pow2(start), length, fn);
+    if (!doForce) {
+        const real1 oneChance = oneNorm / totNorm;
+        if (oneChance >= ONE_R1) {
+            result = true;
+        } else if (oneChance <= ZERO_R1) {
+            result = false;
+        } else {
+            result = (Rand() <= oneChance);
+        }
     }
-    stateVec->isReadLocked = true;
 
-    real1 prob = ZERO_R1;
-    for (int thrd = 0; thrd < num_threads; thrd++) {
-        prob += probs[thrd];
+    const real1 nrmlzr = result ? oneNorm : zeroNorm;
+    if (nrmlzr <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
     }
 
-    delete[] probs;
+    if (!doApply) {
+        return result;
+    }
 
-    return clampProb(prob);
+    const complex nrm = GetNonunitaryPhase() / (real1)(std::sqrt(nrmlzr));
+    const real1 norm_thresh = PendingNormFloor();
+    const bitCapInt keep = result ? qPower : 0U;
+    const bitCapInt drop = result ? 0U : qPower;
+
+    par_for_skip(0, maxQPower, qPower, 1U, [&](const bitCapInt lcv, const int cpu) {
+        const complex amp = sv->read(lcv | keep);
+        sv->write(lcv | keep, (norm(amp) < norm_thresh) ? ZERO_CMPLX : (nrm * amp));
+        sv->write(lcv | drop, ZERO_CMPLX);
+    });
+
+    runningNorm = ONE_R1;
+
+    return result;
 }
 
-// Returns probability of permutation of the mask
-real1 QEngineCPU::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
+/// Measure permutation state of a register
+bitCapInt QEngineCPU::ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply)
+{
+    if (isSparse || (length == 1U)) {
+        return QEngine::ForceM(bits, length, values, doApply);
+    }
+
+    bitCapInt regMask = 0;
+    bitCapInt result = 0;
+    for (bitLenInt j = 0; j < length; j++) {
+        regMask |= pow2(bits[j]);
+        if (values && values[j]) {
+            result |= pow2(bits[j]);
+        }
+    }
+
+    // As with QEngine::ForceM(), a forced result is always applied.
+    return ForceMMask(regMask, result, values != NULL, doApply || (values != NULL));
+}
+
+/// Measure permutation state of a register
+bitCapInt QEngineCPU::ForceMReg(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce, bool doApply)
+{
+    if (isSparse || (length == 1U)) {
+        return QEngine::ForceMReg(start, length, result, doForce, doApply);
+    }
+
+    return ForceMMask(bitRegMask(start, length), result << (bitCapIntOcl)start, doForce, doApply) >>
+        (bitCapIntOcl)start;
+}
+
+bitCapInt QEngineCPU::ForceMMask(const bitCapInt& regMask, bitCapInt result, bool doForce, bool doApply)
+{
+    real1 nrmlzr = ZERO_R1;
+
+    if (doForce) {
+        nrmlzr = ProbMaskBase(regMask, result);
+    } else {
+        bitLenInt length = 0;
+        for (bitCapInt v = regMask; v; v &= v - ONE_BCI) {
+            length++;
+        }
+        const bitCapIntOcl lengthPower = pow2Ocl(length);
+
+        real1* probArray = new real1[lengthPower]();
+        ProbMaskAllBase(regMask, probArray);
+        real1 totProb = ZERO_R1;
+        for (bitCapIntOcl lcv = 0; lcv < lengthPower; lcv++) {
+            totProb += probArray[lcv];
+        }
+        const bitCapIntOcl perm = DrawPermutation(probArray, lengthPower, totProb, nrmlzr);
+        delete[] probArray;
+
+        // Deposit the outcome index into the mask bits, in ascending order.
+        result = 0;
+        bitCapInt v = regMask;
+        for (bitLenInt p = 0; p < length; p++) {
+            const bitCapInt lowBit = v & ~(v - ONE_BCI);
+            if ((perm >> p) & 1U) {
+                result |= lowBit;
+            }
+            v ^= lowBit;
+        }
+    }
+
+    if (nrmlzr <= ZERO_R1) {
+        throw "ERROR: Forced a measurement result with 0 probability";
+    }
+
+    if (doApply) {
+        ApplyMFloor(regMask, result, GetNonunitaryPhase() / (real1)(std::sqrt(nrmlzr)), PendingNormFloor());
+    }
+
+    return result;
+}
+
+/// PSEUDO-QUANTUM Direct measure of bit probability to be in |1> state
+real1 QEngineCPU::Prob(bitLenInt qubit)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    bitCapInt qPower = pow2(MapQubit(qubit));
+    real1 oneChance = 0;
+
+    int numCores = GetConcurrencyLevel();
+    real1* oneChanceBuff = new real1[numCores]();
+
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        oneChanceBuff[cpu] += norm(stateVec->read(lcv | qPower));
+    };
+
+    stateVec->isReadLocked = false;
+    if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(qPower, qPower, qPower), fn);
+    } else {
+        par_for_skip(0, maxQPower, qPower, 1U, fn);
+    }
+    stateVec->isReadLocked = true;
+
+    for (int i = 0; i < numCores; i++) {
+        oneChance += oneChanceBuff[i];
+    }
+
+    delete[] oneChanceBuff;
+
+    return clampProb(oneChance);
+}
+
+/**
+ * Every bit's probability to be in |1> state, in a single pass over the state vector
+ *
+ * The state vector is taken in blocks of contiguous amplitudes. Within a block, the odd entries of the block's
+ * probabilities sum to the marginal of its lowest bit; adding adjacent pairs then halves the block, and the odd entries
+ * of the result give the next bit, and so on, for two additions per amplitude in all. The remaining block total counts
+ * toward each high bit set in the block's offset.
+ */
+void QEngineCPU::ProbAllQubits(real1* probsArray)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    const int numCores = GetConcurrencyLevel();
+    real1* partials = new real1[numCores * qubitCount]();
+
+    stateVec->isReadLocked = false;
+    if (isSparse) {
+        ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+            const real1 prob = norm(stateVec->read(lcv));
+            real1* partial = partials + cpu * qubitCount;
+            for (bitLenInt b = 0; b < qubitCount; b++) {
+                if ((lcv >> b) & ONE_BCI) {
+                    partial[b] += prob;
+                }
+            }
+        };
+
+        if (stateVec->is_sparse()) {
+            par_for_set(CastStateVecSparse()->iterable(), fn);
+        } else {
+            par_for(0, maxQPower, fn);
+        }
+    } else {
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        const bitLenInt blockPow = (qubitCount < PROB_BLOCK_POW) ? qubitCount : PROB_BLOCK_POW;
+        const bitCapIntOcl blockSize = pow2Ocl(blockPow);
+
+        par_for(0, maxQPower >> blockPow, [&](const bitCapInt lcv, const int cpu) {
+            real1 probs[1U << PROB_BLOCK_POW];
+            const bitCapInt offset = lcv << blockPow;
+            for (bitCapIntOcl j = 0; j < blockSize; j++) {
+                probs[j] = norm(sv->read(offset | j));
+            }
+
+            real1* partial = partials + cpu * qubitCount;
+            bitCapIntOcl len = blockSize;
+            for (bitLenInt b = 0; b < blockPow; b++) {
+                len >>= 1U;
+                real1 oneProb = ZERO_R1;
+                for (bitCapIntOcl k = 0; k < len; k++) {
+                    oneProb += probs[(k << 1U) | 1U];
+                    probs[k] = probs[k << 1U] + probs[(k << 1U) | 1U];
+                }
+                partial[b] += oneProb;
+            }
+
+            for (bitLenInt b = blockPow; b < qubitCount; b++) {
+                if ((offset >> b) & ONE_BCI) {
+                    partial[b] += probs[0];
+                }
+            }
+        });
+    }
+    stateVec->isReadLocked = true;
+
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        const bitLenInt b = MapQubit(i);
+        real1 oneChance = ZERO_R1;
+        for (int thrd = 0; thrd < numCores; thrd++) {
+            oneChance += partials[thrd * qubitCount + b];
+        }
+        probsArray[i] = clampProb(oneChance);
+    }
+
+    delete[] partials;
+}
+
+/// PSEUDO-QUANTUM Direct measure of full register probability to be in permutation state
+real1 QEngineCPU::ProbAll(bitCapInt fullRegister)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    return norm(stateVec->read(MapPermutation(fullRegister)));
+}
+
+// Returns probability of permutation of the register
+real1 QEngineCPU::ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation)
+{
+    // Under a qubit map, the register is generally not contiguous.
+    if (qubitMap.size()) {
+        return ProbMask(bitRegMask(start, length), permutation << start);
+    }
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    int num_threads = GetConcurrencyLevel();
+    real1* probs = new real1[num_threads]();
+
+    bitCapInt perm = permutation << start;
+
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | perm)); };
+    stateVec->isReadLocked = false;
+    if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(0, bitRegMask(start, length), perm), fn);
+    } else {
+        par_for_skip(0, maxQPower, pow2(start), length, fn);
+    }
+    stateVec->isReadLocked = true;
+
+    real1 prob = ZERO_R1;
+    for (int thrd = 0; thrd < num_threads; thrd++) {
+        prob += probs[thrd];
+    }
+
+    delete[] probs;
+
+    return clampProb(prob);
+}
+
+// Returns probability of permutation of the mask
+real1 QEngineCPU::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
 {
     if (doNormalize && (runningNorm != ONE_R1)) {
         NormalizeState();
     }
 
-    bitCapInt v = mask; // count the number of bits set in v
+    return clampProb(ProbMaskBase(mask, permutation));
+}
+
+/// Total norm of the amplitudes matching a masked permutation, as they stand, (without normalization)
+real1 QEngineCPU::ProbMaskBase(const bitCapInt& mask, const bitCapInt& permutation)
+{
+    bitCapInt physicalPerm = MapPermutation(permutation);
+    bitCapInt v = MapPermutation(mask); // count the number of bits set in v
     bitCapInt oldV;
     bitLenInt length; // c accumulates the total bits set in v
     std::vector<bitCapInt> skipPowersVec;
@@ -767,7 +1237,7 @@ real1 QEngineCPU::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
 
     stateVec->isReadLocked = false;
     par_for_mask(0, maxQPower, skipPowers, skipPowersVec.size(),
-        [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | permutation)); });
+        [&](const bitCapInt lcv, const int cpu) { probs[cpu] += norm(stateVec->read(lcv | physicalPerm)); });
     stateVec->isReadLocked = true;
 
     delete[] skipPowers;
@@ -779,7 +1249,434 @@ real1 QEngineCPU::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
 
     delete[] probs;
 
-    return clampProb(prob);
+    return prob;
+}
+
+void QEngineCPU::ProbRegAll(const bitLenInt& start, const bitLenInt& length, real1* probsArray)
+{
+    // The logical register bits are the ascending bits of the mask, so the outcome indices coincide.
+    ProbMaskAll(bitRegMask(start, length), probsArray);
+}
+
+/**
+ * Marginal probabilities of all permutations of the mask bits, in a single pass over the state vector
+ *
+ * Each thread bins the amplitudes it visits into its own partial histogram, and the partial histograms are summed at
+ * the end. If there are too many outcomes for every thread to hold a histogram, the threads instead split the
+ * outcomes, and each one sums every amplitude that contributes to its own outcomes.
+ */
+void QEngineCPU::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
+{
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    ProbMaskAllBase(mask, probsArray);
+
+    bitLenInt length = 0;
+    for (bitCapInt v = mask; v; v &= v - ONE_BCI) {
+        length++;
+    }
+    const bitCapIntOcl lengthPower = pow2Ocl(length);
+    for (bitCapIntOcl lcv = 0; lcv < lengthPower; lcv++) {
+        probsArray[lcv] = clampProb(probsArray[lcv]);
+    }
+}
+
+/// Norms of all permutations of the mask bits, as they stand, (without normalization)
+void QEngineCPU::ProbMaskAllBase(const bitCapInt& mask, real1* probsArray)
+{
+    // Physical power of each mask bit, in order of logical significance
+    std::vector<bitCapInt> physPowers;
+    bitCapInt physMask = 0;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if ((mask >> i) & ONE_BCI) {
+            physPowers.push_back(pow2(MapQubit(i)));
+            physMask |= physPowers.back();
+        }
+    }
+
+    const bitLenInt length = physPowers.size();
+    const bitCapIntOcl lengthPower = pow2Ocl(length);
+    const bitCapIntOcl lengthMask = lengthPower - ONE_BCI;
+
+    // Without a qubit map, a register is a contiguous run of bits, and its outcome index is just a shifted slice.
+    bool isContiguous = true;
+    for (bitLenInt j = 1; j < length; j++) {
+        if (physPowers[j] != (physPowers[0] << j)) {
+            isContiguous = false;
+            break;
+        }
+    }
+    const bitLenInt shift = length ? log2(physPowers[0]) : 0;
+
+    // Otherwise, gather the scattered bits of the outcome index a byte of the physical index at a time.
+    const bitLenInt byteCount = (qubitCount + 7U) >> 3U;
+    std::vector<bitCapIntOcl> keyTable;
+    if (!isContiguous) {
+        keyTable.resize(byteCount << 8U, 0);
+        for (bitLenInt j = 0; j < length; j++) {
+            const bitLenInt bit = log2(physPowers[j]);
+            bitCapIntOcl* byteTable = &(keyTable[(bit >> 3U) << 8U]);
+            for (bitCapIntOcl b = 0; b < 256U; b++) {
+                if ((b >> (bit & 7U)) & 1U) {
+                    byteTable[b] |= pow2Ocl(j);
+                }
+            }
+        }
+    }
+    auto outcome = [&](const bitCapInt i) -> bitCapIntOcl {
+        if (isContiguous) {
+            return (bitCapIntOcl)(i >> shift) & lengthMask;
+        }
+        bitCapIntOcl key = 0;
+        for (bitLenInt b = 0; b < byteCount; b++) {
+            key |= keyTable[(b << 8U) | (bitCapIntOcl)((i >> (b << 3U)) & 0xFFU)];
+        }
+        return key;
+    };
+
+    const int num_threads = GetConcurrencyLevel();
+
+    if ((num_threads > 1) && !isSparse && ((lengthPower * num_threads) > (maxQPower >> ONE_BCI))) {
+        // Split the outcomes between the threads, and enumerate the complement bits as subsets of their mask.
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        const bitCapInt complementMask = (maxQPower - ONE_BCI) ^ physMask;
+
+        // Scatter the outcome bits to their physical positions a byte of the outcome index at a time.
+        const bitLenInt outcomeByteCount = (length + 7U) >> 3U;
+        std::vector<bitCapInt> depositTable;
+        if (!isContiguous) {
+            depositTable.resize(outcomeByteCount << 8U, 0);
+            for (bitLenInt j = 0; j < length; j++) {
+                bitCapInt* byteTable = &(depositTable[(j >> 3U) << 8U]);
+                for (bitCapIntOcl b = 0; b < 256U; b++) {
+                    if ((b >> (j & 7U)) & 1U) {
+                        byteTable[b] |= physPowers[j];
+                    }
+                }
+            }
+        }
+
+        par_for(0, lengthPower, [&](const bitCapInt lcv, const int cpu) {
+            bitCapInt base = isContiguous ? (lcv << shift) : 0;
+            for (bitLenInt b = 0; !isContiguous && (b < outcomeByteCount); b++) {
+                base |= depositTable[(b << 8U) | (bitCapIntOcl)((lcv >> (b << 3U)) & 0xFFU)];
+            }
+            real1 prob = norm(sv->read(base));
+            for (bitCapInt sub = complementMask; sub; sub = (sub - ONE_BCI) & complementMask) {
+                prob += norm(sv->read(base | sub));
+            }
+            probsArray[(bitCapIntOcl)lcv] = prob;
+        });
+
+        return;
+    }
+
+    // The first thread bins directly into the output.
+    std::fill(probsArray, probsArray + lengthPower, ZERO_R1);
+    real1* partials = NULL;
+    if (num_threads > 1) {
+        partials = new real1[lengthPower * (num_threads - 1)]();
+    }
+    auto histogram = [&](const int cpu) -> real1* { return cpu ? (partials + lengthPower * (cpu - 1)) : probsArray; };
+
+    stateVec->isReadLocked = false;
+    if (isSparse && stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(),
+            [&](const bitCapInt lcv, const int cpu) { histogram(cpu)[outcome(lcv)] += norm(stateVec->read(lcv)); });
+    } else if (isSparse) {
+        par_for(0, maxQPower,
+            [&](const bitCapInt lcv, const int cpu) { histogram(cpu)[outcome(lcv)] += norm(stateVec->read(lcv)); });
+    } else {
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        par_for(0, maxQPower,
+            [&](const bitCapInt lcv, const int cpu) { histogram(cpu)[outcome(lcv)] += norm(sv->read(lcv)); });
+    }
+    stateVec->isReadLocked = true;
+
+    for (bitCapIntOcl lcv = 0; (num_threads > 1) && (lcv < lengthPower); lcv++) {
+        for (int thrd = 1; thrd < num_threads; thrd++) {
+            probsArray[lcv] += partials[lengthPower * (thrd - 1) + lcv];
+        }
+    }
+
+    if (partials) {
+        delete[] partials;
+    }
+}
+
+/**
+ * Sample every qubit at once, without any buffer the size of the state vector
+ *
+ * The uniform variates are generated and sorted first. One pass sums the probability of each of a few large chunks of
+ * the state vector, and a second pass walks each chunk from its prefix sum, emitting the samples whose variates fall
+ * inside it. Peak memory beyond the state vector is proportional to the number of shots. Narrower masks, and states
+ * with fewer permutations than shots, fall back to the alias table sampler of QInterface::SampleMaskShots(), (on this
+ * engine's threads,) whose marginal histogram is then no larger than the variates would be.
+ */
+std::map<bitCapInt, int> QEngineCPU::MultiShotMeasureMask(
+    const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots)
+{
+    bitCapInt mask = 0;
+    for (bitLenInt i = 0; i < qPowerCount; i++) {
+        mask |= qPowers[i];
+    }
+
+    if (isSparse || (shots == 0U) || (maxQPower <= shots) || (qPowerCount != qubitCount) ||
+        (mask != (maxQPower - ONE_BCI))) {
+        return SampleMaskShots(qPowers, qPowerCount, shots, *this);
+    }
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    // Translate a physical index to the caller's result bit order, a byte at a time.
+    const bitLenInt byteCount = (qubitCount + 7U) >> 3U;
+    std::vector<bitCapInt> keyTable(byteCount << 8U, 0);
+    for (bitLenInt r = 0; r < qPowerCount; r++) {
+        const bitLenInt bit = MapQubit(log2(qPowers[r]));
+        bitCapInt* byteTable = &(keyTable[(bit >> 3U) << 8U]);
+        for (bitCapIntOcl b = 0; b < 256U; b++) {
+            if ((b >> (bit & 7U)) & 1U) {
+                byteTable[b] |= pow2(r);
+            }
+        }
+    }
+    auto resultKey = [&](const bitCapInt i) -> bitCapInt {
+        bitCapInt key = 0;
+        for (bitLenInt b = 0; b < byteCount; b++) {
+            key |= keyTable[(b << 8U) | (bitCapIntOcl)((i >> (b << 3U)) & 0xFFU)];
+        }
+        return key;
+    };
+
+    // Sorted uniform variates, generated in fixed blocks by independently seeded generators
+    const bitCapIntOcl variateChunkCount = (shots + STREAM_SHOT_CHUNK - 1U) / STREAM_SHOT_CHUNK;
+    std::vector<uint64_t> seeds = RandSeeds(variateChunkCount);
+    std::vector<double> variates(shots);
+    par_for(0, variateChunkCount, [&](const bitCapInt lcv, const int cpu) {
+        qrack_rand_gen gen(seeds[(bitCapIntOcl)lcv]);
+        std::uniform_real_distribution<double> dist(0.0, 1.0);
+        const bitCapIntOcl begin = (bitCapIntOcl)lcv * STREAM_SHOT_CHUNK;
+        const bitCapIntOcl end = ((begin + STREAM_SHOT_CHUNK) < shots) ? (begin + STREAM_SHOT_CHUNK) : shots;
+        for (bitCapIntOcl shot = begin; shot < end; shot++) {
+            variates[shot] = dist(gen);
+        }
+    });
+    std::sort(variates.begin(), variates.end());
+
+    // Several chunks per thread, to even out the load
+    bitLenInt chunkPow = log2((bitCapInt)GetConcurrencyLevel()) + 3U;
+    if (chunkPow > qubitCount) {
+        chunkPow = qubitCount;
+    }
+    const bitCapIntOcl chunkCount = pow2Ocl(chunkPow);
+    const bitCapInt chunkLength = maxQPower >> chunkPow;
+
+    StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+
+    std::vector<double> prefixSums(chunkCount + 1U, 0.0);
+    par_for(0, chunkCount, [&](const bitCapInt lcv, const int cpu) {
+        double partProb = 0.0;
+        const bitCapInt begin = lcv * chunkLength;
+        for (bitCapInt i = begin; i < (begin + chunkLength); i++) {
+            partProb += norm(sv->read(i));
+        }
+        prefixSums[(bitCapIntOcl)lcv + 1U] = partProb;
+    });
+    for (bitCapIntOcl c = 0; c < chunkCount; c++) {
+        prefixSums[c + 1U] += prefixSums[c];
+    }
+
+    // Scale the variates to the total, (in case it is not normalized,) and find where each chunk's variates begin.
+    const double totProb = prefixSums[chunkCount];
+    std::vector<bitCapIntOcl> variateStarts(chunkCount + 1U);
+    for (bitCapIntOcl c = 0; c <= chunkCount; c++) {
+        variateStarts[c] =
+            std::lower_bound(variates.begin(), variates.end(), prefixSums[c] / totProb) - variates.begin();
+    }
+    variateStarts[chunkCount] = shots;
+
+    std::vector<std::vector<std::pair<bitCapInt, int>>> chunkResults(chunkCount);
+    par_for(0, chunkCount, [&](const bitCapInt lcv, const int cpu) {
+        const bitCapIntOcl c = (bitCapIntOcl)lcv;
+        bitCapIntOcl v = variateStarts[c];
+        const bitCapIntOcl vEnd = variateStarts[c + 1U];
+        if (v == vEnd) {
+            return;
+        }
+
+        double cumProb = prefixSums[c];
+        int count;
+        bitCapInt lastNonzero = 0;
+        const bitCapInt begin = lcv * chunkLength;
+        for (bitCapInt i = begin; (i < (begin + chunkLength)) && (v < vEnd); i++) {
+            const real1 prob = norm(sv->read(i));
+            if (prob <= ZERO_R1) {
+                continue;
+            }
+            lastNonzero = i;
+            cumProb += prob;
+            for (count = 0; (v < vEnd) && ((variates[v] * totProb) < cumProb); v++) {
+                count++;
+            }
+            if (count) {
+                chunkResults[c].push_back(std::make_pair(resultKey(i), count));
+            }
+        }
+
+        // Rounding can leave the last few variates just past the chunk's running sum.
+        if (v < vEnd) {
+            chunkResults[c].push_back(std::make_pair(resultKey(lastNonzero), (int)(vEnd - v)));
+        }
+    });
+
+    std::map<bitCapInt, int> results;
+    for (bitCapIntOcl c = 0; c < chunkCount; c++) {
+        for (size_t k = 0; k < chunkResults[c].size(); k++) {
+            results[chunkResults[c][k].first] += chunkResults[c][k].second;
+        }
+    }
+
+    return results;
+}
+
+real1 QEngineCPU::ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length)
+{
+    real1 expectation;
+    ExpectationPauliAll(paulis, qubits, length, 1U, &expectation);
+    return expectation;
+}
+
+/**
+ * Pauli string expectation values, as reductions over amplitude pairs, without touching the state
+ *
+ * A Pauli string maps |i> to i^(Y count) * (-1)^parity(i & yzMask) |i ^ xyMask>, so its expectation value is a sum over
+ * pairs of amplitudes that differ by the X/Y bit flip mask. The strings are grouped by that mask, and each group is
+ * reduced in a single pass, with per-thread partial sums for every string in the group. Strings with no X or Y factor
+ * only need the probability of each permutation.
+ */
+void QEngineCPU::ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitCapIntOcl& stringCount, real1* expectations)
+{
+    if (stringCount == 0U) {
+        return;
+    }
+
+    if (doNormalize && (runningNorm != ONE_R1)) {
+        NormalizeState();
+    }
+
+    const complex iPowers[4] = { ONE_CMPLX, I_CMPLX, -ONE_CMPLX, -I_CMPLX };
+
+    std::vector<bitCapInt> yzMasks(stringCount, 0);
+    std::vector<complex> yFactors(stringCount);
+    std::map<bitCapInt, std::vector<bitCapIntOcl>> groups;
+    for (bitCapIntOcl s = 0; s < stringCount; s++) {
+        bitCapInt xyMask = 0;
+        bitLenInt yCount = 0;
+        for (bitLenInt i = 0; i < length; i++) {
+            const bitCapInt qPower = pow2(MapQubit(qubits[i]));
+            switch (paulis[s * length + i]) {
+            case PauliX:
+                xyMask |= qPower;
+                break;
+            case PauliY:
+                xyMask |= qPower;
+                yzMasks[s] |= qPower;
+                yCount++;
+                break;
+            case PauliZ:
+                yzMasks[s] |= qPower;
+                break;
+            default:
+                break;
+            }
+        }
+        yFactors[s] = iPowers[yCount & 3U];
+        groups[xyMask].push_back(s);
+    }
+
+    // Diagonal phase terms cancel in the probabilities, but not between the two members of a pair, (unless global).
+    if (phaseTerms.size() && ((groups.size() > 1U) || (groups.begin()->first != 0))) {
+        FlushPhaseTerms();
+    }
+
+    StateVectorArray* sv = isSparse ? NULL : static_cast<StateVectorArray*>(stateVec.get());
+    auto read = [&](const bitCapInt& i) { return sv ? sv->read(i) : stateVec->read(i); };
+
+    const int numCores = GetConcurrencyLevel();
+
+    std::map<bitCapInt, std::vector<bitCapIntOcl>>::iterator group;
+    for (group = groups.begin(); group != groups.end(); group++) {
+        const bitCapInt xyMask = group->first;
+        const std::vector<bitCapIntOcl>& members = group->second;
+        const bitCapIntOcl groupSize = members.size();
+
+        real1* partials = new real1[numCores * groupSize]();
+
+        ParallelFunc fn;
+        if (!xyMask) {
+            fn = [&](const bitCapInt lcv, const int cpu) {
+                const real1 prob = norm(read(lcv));
+                real1* partial = partials + cpu * groupSize;
+                for (bitCapIntOcl k = 0; k < groupSize; k++) {
+                    bool isOdd = false;
+                    for (bitCapInt v = lcv & yzMasks[members[k]]; v; v &= v - ONE_BCI) {
+                        isOdd = !isOdd;
+                    }
+                    partial[k] += isOdd ? -prob : prob;
+                }
+            };
+        } else {
+            // Each pair contributes twice the real part of one of its two (conjugate) cross terms.
+            fn = [&](const bitCapInt lcv, const int cpu) {
+                const complex cross = conj(read(lcv ^ xyMask)) * read(lcv);
+                real1* partial = partials + cpu * groupSize;
+                for (bitCapIntOcl k = 0; k < groupSize; k++) {
+                    bool isOdd = false;
+                    for (bitCapInt v = lcv & yzMasks[members[k]]; v; v &= v - ONE_BCI) {
+                        isOdd = !isOdd;
+                    }
+                    const real1 term = 2 * real(yFactors[members[k]] * cross);
+                    partial[k] += isOdd ? -term : term;
+                }
+            };
+        }
+
+        // Each pair is visited from the member with the highest X/Y bit clear.
+        bitCapInt pivot = xyMask;
+        while (pivot & (pivot - ONE_BCI)) {
+            pivot &= pivot - ONE_BCI;
+        }
+
+        stateVec->isReadLocked = false;
+        if (isSparse && stateVec->is_sparse()) {
+            std::vector<bitCapInt> nonzero = CastStateVecSparse()->iterable();
+            std::set<bitCapInt> visits;
+            for (size_t i = 0; i < nonzero.size(); i++) {
+                visits.insert((nonzero[i] & pivot) ? (nonzero[i] ^ xyMask) : nonzero[i]);
+            }
+            par_for_set(visits, fn);
+        } else if (pivot) {
+            par_for_skip(0, maxQPower, pivot, 1U, fn);
+        } else {
+            par_for(0, maxQPower, fn);
+        }
+        stateVec->isReadLocked = true;
+
+        for (bitCapIntOcl k = 0; k < groupSize; k++) {
+            real1 expectation = ZERO_R1;
+            for (int thrd = 0; thrd < numCores; thrd++) {
+                expectation += partials[thrd * groupSize + k];
+            }
+            expectations[members[k]] = expectation;
+        }
+
+        delete[] partials;
+    }
 }
 
 bool QEngineCPU::ApproxCompare(QEngineCPUPtr toCompare)
@@ -796,6 +1693,8 @@ bool QEngineCPU::ApproxCompare(QEngineCPUPtr toCompare)
     if (toCompare->doNormalize && (toCompare->runningNorm != ONE_R1)) {
         toCompare->NormalizeState();
     }
+    MaterializeState();
+    toCompare->MaterializeState();
 
     int numCores = GetConcurrencyLevel();
     real1* partError = new real1[numCores]();
@@ -838,31 +1737,201 @@ bool QEngineCPU::ApproxCompare(QEngineCPUPtr toCompare)
 /// For chips with a zero flag, flip the phase of the state where the register equals zero.
 void QEngineCPU::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
 {
-    par_for_skip(0, maxQPower, pow2(start), length,
-        [&](const bitCapInt lcv, const int cpu) { stateVec->write(lcv, -stateVec->read(lcv)); });
+    AddPhaseTerm(MapPermutation(bitRegMask(start, length)), 0, -ONE_CMPLX);
 }
 
 /// The 6502 uses its carry flag also as a greater-than/less-than flag, for the CMP operation.
 void QEngineCPU::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex)
 {
-    bitCapInt regMask = bitRegMask(start, length);
-    bitCapInt flagMask = pow2(flagIndex);
+    // The comparison needs the register to be contiguous.
+    if (qubitMap.size()) {
+        MaterializeState();
+    }
 
-    par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
-        if ((((lcv & regMask) >> start) < greaterPerm) & ((lcv & flagMask) == flagMask))
-            stateVec->write(lcv, -stateVec->read(lcv));
-    });
+    PhaseTerm term;
+    term.condition = PhaseTerm::LESS_THAN;
+    term.mask = bitRegMask(start, length);
+    term.value = greaterPerm;
+    term.flagMask = pow2(flagIndex);
+    term.shift = start;
+    term.factor = -ONE_CMPLX;
+    AddPhaseTerm(term);
 }
 
 /// This is an expedient for an adaptive Grover's search for a function's global minimum.
 void QEngineCPU::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length)
 {
-    bitCapInt regMask = bitRegMask(start, length);
+    // The comparison needs the register to be contiguous.
+    if (qubitMap.size()) {
+        MaterializeState();
+    }
+
+    PhaseTerm term;
+    term.condition = PhaseTerm::LESS_THAN;
+    term.mask = bitRegMask(start, length);
+    term.value = greaterPerm;
+    term.flagMask = 0;
+    term.shift = start;
+    term.factor = -ONE_CMPLX;
+    AddPhaseTerm(term);
+}
+
+/**
+ * Expectation value, (and optionally the distribution,) of a QUBO cost, in a single pass over the state vector
+ *
+ * The state vector is taken in aligned blocks, and each block is walked in Gray code order, so that consecutive
+ * amplitudes differ in a single bit. Each cost bit keeps its "field," (the change in cost for setting it, given the
+ * other bits,) so the cost moves by one field per flip, and only the other fields need updates, rather than the cost
+ * being evaluated from scratch. The state is normalized on the fly, by the total norm counted in the same pass.
+ */
+real1 QEngineCPU::ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+    real1* histogram, const bitCapIntOcl& binCount, const real1& minCost, const real1& maxCost)
+{
+    bitLenInt i, j;
+
+    // Linear terms, and symmetrized pair couplings, (with zeros on the diagonal)
+    std::vector<real1> linear(length);
+    std::vector<real1> couplings(length * length, ZERO_R1);
+    std::vector<bitCapInt> physPowers(length);
+    std::vector<int> localBit(qubitCount, -1);
+    for (i = 0; i < length; i++) {
+        linear[i] = weights[i * length + i];
+        for (j = 0; j < length; j++) {
+            if (i != j) {
+                couplings[i * length + j] = weights[i * length + j] + weights[j * length + i];
+            }
+        }
+        const bitLenInt physical = MapQubit(qubits[i]);
+        physPowers[i] = pow2(physical);
+        localBit[physical] = i;
+    }
 
-    par_for(0, maxQPower, [&](const bitCapInt lcv, const int cpu) {
-        if (((lcv & regMask) >> start) < greaterPerm)
-            stateVec->write(lcv, -stateVec->read(lcv));
-    });
+    const real1 binScale = (maxCost > minCost) ? (binCount / (maxCost - minCost)) : ZERO_R1;
+    const bool doHistogram = histogram && binCount;
+
+    const int numCores = GetConcurrencyLevel();
+    real1* expectBuff = new real1[numCores]();
+    real1* normBuff = new real1[numCores]();
+    real1* histBuff = doHistogram ? new real1[numCores * binCount]() : NULL;
+    real1* fieldBuff = new real1[numCores * (length ? length : 1U)];
+
+    auto tally = [&](const real1& nrm, const real1& cost, const int& cpu) {
+        const real1 bin = (cost - minCost) * binScale;
+        histBuff[cpu * binCount +
+            ((bin <= ZERO_R1) ? 0U : ((bin >= binCount) ? (binCount - 1U) : (bitCapIntOcl)bin))] += nrm;
+    };
+
+    // Cost of the full permutation "perm," and the field of every cost bit, from scratch
+    auto initCost = [&](const bitCapInt& perm, real1* fields) -> real1 {
+        real1 cost = ZERO_R1;
+        for (bitLenInt a = 0; a < length; a++) {
+            fields[a] = linear[a];
+            for (bitLenInt c = 0; c < length; c++) {
+                if (perm & physPowers[c]) {
+                    fields[a] += couplings[a * length + c];
+                }
+            }
+        }
+        for (bitLenInt a = 0; a < length; a++) {
+            if (perm & physPowers[a]) {
+                // Each pair is counted from both ends, so half of each coupling goes to each.
+                cost += (linear[a] + fields[a]) / 2;
+            }
+        }
+        return cost;
+    };
+
+    stateVec->isReadLocked = false;
+    if (isSparse) {
+        par_for_set(CastStateVecSparse()->iterable(), [&](const bitCapInt lcv, const int cpu) {
+            const real1 nrm = norm(stateVec->read(lcv));
+            if (nrm <= ZERO_R1) {
+                return;
+            }
+            const real1 cost = initCost(lcv, fieldBuff + cpu * length);
+            expectBuff[cpu] += nrm * cost;
+            normBuff[cpu] += nrm;
+            if (doHistogram) {
+                tally(nrm, cost, cpu);
+            }
+        });
+    } else {
+        StateVectorArray* sv = static_cast<StateVectorArray*>(stateVec.get());
+        const bitLenInt blockPow = (qubitCount < COST_GRAY_BLOCK_POW) ? qubitCount : COST_GRAY_BLOCK_POW;
+        const bitCapIntOcl blockSize = pow2Ocl(blockPow);
+
+        par_for(0, maxQPower >> blockPow, [&](const bitCapInt lcv, const int cpu) {
+            real1* fields = fieldBuff + cpu * length;
+            bitCapInt perm = lcv << blockPow;
+            real1 cost = initCost(perm, fields);
+            real1 expectation = ZERO_R1;
+            real1 totNorm = ZERO_R1;
+
+            for (bitCapIntOcl k = 0; k < blockSize; k++) {
+                if (k) {
+                    // Step "k" of the Gray code flips the lowest set bit of "k."
+                    bitLenInt flip = 0;
+                    while (!((k >> flip) & 1U)) {
+                        flip++;
+                    }
+                    perm ^= pow2(flip);
+
+                    const int a = localBit[flip];
+                    if (a >= 0) {
+                        const real1* aCouplings = &(couplings[a * length]);
+                        if (perm & physPowers[a]) {
+                            cost += fields[a];
+                            for (bitLenInt c = 0; c < length; c++) {
+                                fields[c] += aCouplings[c];
+                            }
+                        } else {
+                            cost -= fields[a];
+                            for (bitLenInt c = 0; c < length; c++) {
+                                fields[c] -= aCouplings[c];
+                            }
+                        }
+                    }
+                }
+
+                const real1 nrm = norm(sv->read(perm));
+                expectation += nrm * cost;
+                totNorm += nrm;
+                if (doHistogram) {
+                    tally(nrm, cost, cpu);
+                }
+            }
+
+            expectBuff[cpu] += expectation;
+            normBuff[cpu] += totNorm;
+        });
+    }
+    stateVec->isReadLocked = true;
+
+    real1 expectation = ZERO_R1;
+    real1 totNorm = ZERO_R1;
+    for (int cpu = 0; cpu < numCores; cpu++) {
+        expectation += expectBuff[cpu];
+        totNorm += normBuff[cpu];
+    }
+
+    if (histogram) {
+        std::fill(histogram, histogram + binCount, ZERO_R1);
+    }
+    if (doHistogram && (totNorm > ZERO_R1)) {
+        for (bitCapIntOcl bin = 0; bin < binCount; bin++) {
+            for (int cpu = 0; cpu < numCores; cpu++) {
+                histogram[bin] += histBuff[cpu * binCount + bin];
+            }
+            histogram[bin] /= totNorm;
+        }
+    }
+
+    delete[] expectBuff;
+    delete[] normBuff;
+    delete[] histBuff;
+    delete[] fieldBuff;
+
+    return (totNorm > ZERO_R1) ? (expectation / totNorm) : ZERO_R1;
 }
 
 void QEngineCPU::NormalizeState(real1 nrm, real1 norm_thresh)
@@ -921,4 +1990,178 @@ void QEngineCPU::ResetStateVec(StateVectorPtr sv)
     FreeStateVec();
     stateVec = sv;
 }
+
+bitCapInt QEngineCPU::MapPermutation(const bitCapInt& perm)
+{
+    if (!qubitMap.size()) {
+        return perm;
+    }
+
+    bitCapInt toRet = 0;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (perm & pow2(i)) {
+            toRet |= pow2(qubitMap[i]);
+        }
+    }
+
+    return toRet;
+}
+
+const bitCapInt* QEngineCPU::MapPairs(bitCapInt& offset1, bitCapInt& offset2, const bitLenInt bitCount,
+    const bitCapInt* qPowersSorted, std::vector<bitCapInt>& mappedPowers)
+{
+    if (!qubitMap.size()) {
+        return qPowersSorted;
+    }
+
+    offset1 = MapPermutation(offset1);
+    offset2 = MapPermutation(offset2);
+    mappedPowers.resize(bitCount);
+    for (bitLenInt i = 0; i < bitCount; i++) {
+        mappedPowers[i] = MapPermutation(qPowersSorted[i]);
+    }
+    std::sort(mappedPowers.begin(), mappedPowers.end());
+
+    return &(mappedPowers[0]);
+}
+
+void QEngineCPU::MaterializeState()
+{
+    // Phase terms are in physical bit positions, so they go first.
+    FlushPhaseTerms();
+
+    if (!qubitMap.size()) {
+        return;
+    }
+
+    std::vector<bitCapInt> physicalPowers(qubitCount);
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        physicalPowers[i] = pow2(qubitMap[i]);
+    }
+
+    StateVectorPtr nStateVec = AllocStateVec(maxQPower);
+    stateVec->isReadLocked = false;
+
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        bitCapInt logicalPerm = 0;
+        for (bitLenInt i = 0; i < qubitCount; i++) {
+            if (lcv & physicalPowers[i]) {
+                logicalPerm |= pow2(i);
+            }
+        }
+        nStateVec->write(logicalPerm, stateVec->read(lcv));
+    };
+
+    if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(), fn);
+    } else {
+        par_for(0, maxQPower, fn);
+    }
+
+    ResetStateVec(nStateVec);
+    qubitMap.clear();
+}
+
+void QEngineCPU::AddPhaseTerm(const PhaseTerm& term)
+{
+    if (term.factor == ONE_CMPLX) {
+        return;
+    }
+
+    // An unconditional term is a global phase, which is folded into a scalar, (or dropped, if global phase is random).
+    if ((term.condition == PhaseTerm::MASK_EQUALS) && !term.mask) {
+        if (!randGlobalPhase) {
+            globalPhaseTerm *= term.factor;
+        }
+        return;
+    }
+
+    // Diagonal operators commute, so a term can be merged into any other term with the same condition.
+    for (std::vector<PhaseTerm>::iterator it = phaseTerms.begin(); it != phaseTerms.end(); it++) {
+        if ((it->condition == term.condition) && (it->mask == term.mask) && (it->value == term.value) &&
+            (it->flagMask == term.flagMask) && (it->shift == term.shift)) {
+            it->factor *= term.factor;
+            if (it->factor == ONE_CMPLX) {
+                phaseTerms.erase(it);
+            }
+            return;
+        }
+    }
+
+    phaseTerms.push_back(term);
+
+    if (phaseTerms.size() >= MAX_PHASE_TERMS) {
+        FlushPhaseTerms();
+    }
+}
+
+void QEngineCPU::AddPhaseTerm(const bitCapInt& mask, const bitCapInt& value, const complex& factor)
+{
+    PhaseTerm term;
+    term.condition = PhaseTerm::MASK_EQUALS;
+    term.mask = mask;
+    term.value = value;
+    term.flagMask = 0;
+    term.shift = 0;
+    term.factor = factor;
+    AddPhaseTerm(term);
+}
+
+void QEngineCPU::FlushPhaseTerms()
+{
+    if (!phaseTerms.size() && (globalPhaseTerm == ONE_CMPLX)) {
+        return;
+    }
+
+    std::vector<PhaseTerm> terms;
+    std::swap(terms, phaseTerms);
+    const complex globalFactor = globalPhaseTerm;
+    globalPhaseTerm = ONE_CMPLX;
+
+    if (!stateVec) {
+        return;
+    }
+
+    // A lone masked term only needs to visit the permutations that it matches.
+    if ((terms.size() == 1U) && (terms[0].condition == PhaseTerm::MASK_EQUALS) && (globalFactor == ONE_CMPLX) &&
+        !stateVec->is_sparse()) {
+        const bitCapInt value = terms[0].value;
+        const complex factor = terms[0].factor;
+        std::vector<bitCapInt> skipPowers;
+        for (bitCapInt v = terms[0].mask; v; v &= v - ONE_BCI) {
+            skipPowers.push_back(v & ~(v - ONE_BCI));
+        }
+
+        ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+            stateVec->write(lcv | value, factor * stateVec->read(lcv | value));
+        };
+        if (skipPowers.size()) {
+            par_for_mask(0, maxQPower, &(skipPowers[0]), skipPowers.size(), fn);
+        } else {
+            par_for(0, maxQPower, fn);
+        }
+
+        return;
+    }
+
+    const PhaseTerm* termArray = terms.size() ? &(terms[0]) : NULL;
+    const size_t termCount = terms.size();
+    ParallelFunc fn = [&](const bitCapInt lcv, const int cpu) {
+        complex factor = globalFactor;
+        for (size_t i = 0; i < termCount; i++) {
+            if (termArray[i].Matches(lcv)) {
+                factor *= termArray[i].factor;
+            }
+        }
+        if (factor != ONE_CMPLX) {
+            stateVec->write(lcv, factor * stateVec->read(lcv));
+        }
+    };
+
+    if (stateVec->is_sparse()) {
+        par_for_set(CastStateVecSparse()->iterable(), fn);
+    } else {
+        par_for(0, maxQPower, fn);
+    }
+}
 } // namespace Qrack
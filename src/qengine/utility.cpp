@@ -20,7 +20,10 @@ QInterfacePtr QEngineCPU::Clone()
         CreateQuantumInterface(QINTERFACE_CPU, qubitCount, 0, rand_generator, complex(ONE_R1, ZERO_R1), doNormalize,
             randGlobalPhase, false, 0, (hardware_rand_generator == NULL) ? false : true, isSparse);
     if (stateVec) {
-        std::dynamic_pointer_cast<QEngineCPU>(clone)->stateVec->copy(stateVec);
+        FlushPhaseTerms();
+        QEngineCPUPtr engineClone = std::dynamic_pointer_cast<QEngineCPU>(clone);
+        engineClone->stateVec->copy(stateVec);
+        engineClone->qubitMap = qubitMap;
     }
     return clone;
 }
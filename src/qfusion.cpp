@@ -0,0 +1,805 @@
+//////////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Daniel Strano and the Qrack contributors 2017-2019. All rights reserved.
+//
+// QFusion adds an optional "gate fusion" layer on top of a QEngine or QUnit.
+// Single bit gates are buffered in per-bit 2x2 matrices, and buffered gates that
+// act on the same bit with the same controls are composed into single products, before
+// ever touching the state vector. Identity products are discarded outright.
+//
+// Every buffered gate has one target bit. Before a gate is buffered, any gate buffered on
+// one of its control bits is flushed, and any gate controlled by its target bit is flushed.
+// Hence, a bit is never both the target of one buffered gate and the control of another,
+// and all buffered gates commute with each other.
+//
+// Licensed under the GNU Lesser General Public License V3.
+// See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
+// for details.
+
+#include "qfactory.hpp"
+
+namespace Qrack {
+
+QFusion::QFusion(QInterfaceEngine eng, bitLenInt qBitCount, bitCapInt initState, qrack_rand_gen_ptr rgp,
+    complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceID, bool useHardwareRNG,
+    bool useSparseStateVec, real1 norm_thresh, std::vector<bitLenInt> devList)
+    : QFusion(eng, eng, qBitCount, initState, rgp, phaseFac, doNorm, randomGlobalPhase, useHostMem, deviceID,
+          useHardwareRNG, useSparseStateVec, norm_thresh, devList)
+{
+    // Intentionally left blank
+}
+
+QFusion::QFusion(QInterfaceEngine eng, QInterfaceEngine subEng, bitLenInt qBitCount, bitCapInt initState,
+    qrack_rand_gen_ptr rgp, complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceID,
+    bool useHardwareRNG, bool useSparseStateVec, real1 norm_thresh, std::vector<bitLenInt> devList)
+    : QInterface(qBitCount, rgp, doNorm, useHardwareRNG, randomGlobalPhase, norm_thresh)
+    , engine(eng)
+    , subengine(subEng)
+    , devID(deviceID)
+    , phaseFactor(phaseFac)
+    , useHostRam(useHostMem)
+    , useRDRAND(useHardwareRNG)
+    , isSparse(useSparseStateVec)
+    , bitBuffers(qBitCount)
+    , bitControls(qBitCount)
+{
+    qReg = CreateQuantumInterface(engine, subengine, qBitCount, initState, rand_generator, phaseFactor, doNormalize,
+        randGlobalPhase, useHostRam, devID, useRDRAND, isSparse, norm_thresh, devList);
+}
+
+QFusion::QFusion(QInterfacePtr reg, QInterfaceEngine eng, QInterfaceEngine subEng, qrack_rand_gen_ptr rgp,
+    complex phaseFac, bool doNorm, bool randomGlobalPhase, bool useHostMem, int deviceID, bool useHardwareRNG,
+    bool useSparseStateVec, real1 norm_thresh)
+    : QInterface(reg->GetQubitCount(), rgp, doNorm, useHardwareRNG, randomGlobalPhase, norm_thresh)
+    , engine(eng)
+    , subengine(subEng)
+    , devID(deviceID)
+    , phaseFactor(phaseFac)
+    , useHostRam(useHostMem)
+    , useRDRAND(useHardwareRNG)
+    , isSparse(useSparseStateVec)
+    , qReg(reg)
+    , bitBuffers(reg->GetQubitCount())
+    , bitControls(reg->GetQubitCount())
+{
+    // Intentionally left blank
+}
+
+void QFusion::UnregisterControls(const bitLenInt& target)
+{
+    std::vector<bitLenInt>& controls = bitBuffers[target]->controls;
+    for (bitLenInt i = 0; i < controls.size(); i++) {
+        std::vector<bitLenInt>& controlled = bitControls[controls[i]];
+        controlled.erase(std::find(controlled.begin(), controlled.end(), target));
+    }
+}
+
+void QFusion::ApplyBuffer(const bitLenInt& target)
+{
+    UnregisterControls(target);
+    // This also resets bitBuffers[target].
+    bitBuffers[target]->Apply(qReg, target, &bitBuffers);
+}
+
+void QFusion::DiscardBuffer(const bitLenInt& target)
+{
+    UnregisterControls(target);
+    bitBuffers[target] = NULL;
+}
+
+void QFusion::DiscardAll()
+{
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        bitBuffers[i] = NULL;
+        bitControls[i].clear();
+    }
+}
+
+void QFusion::FlushTargetReg(const bitLenInt& start, const bitLenInt& length)
+{
+    // Buffered gates all commute, so the uncontrolled ones can go to the engine together, as one sequence.
+    std::vector<bitLenInt> targets;
+    std::vector<complex> mtrxs;
+    bitLenInt i;
+    for (i = 0; i < length; i++) {
+        BitBufferPtr bfr = bitBuffers[start + i];
+        if (bfr && (bfr->controls.size() == 0)) {
+            const complex* mtrx = dynamic_cast<GateBuffer*>(bfr.get())->matrix.get();
+            targets.push_back(start + i);
+            mtrxs.insert(mtrxs.end(), mtrx, mtrx + 4U);
+            bitBuffers[start + i] = NULL;
+        }
+    }
+
+    if (targets.size() > 0) {
+        qReg->ApplySingleBitSequence(&(mtrxs[0]), &(targets[0]), targets.size());
+    }
+
+    for (i = 0; i < length; i++) {
+        FlushTarget(start + i);
+    }
+}
+
+void QFusion::FlushTargetMask(const bitCapInt& mask)
+{
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (mask & pow2(i)) {
+            FlushTarget(i);
+        }
+    }
+}
+
+void QFusion::FlushBit(const bitLenInt& qubitIndex)
+{
+    FlushTarget(qubitIndex);
+
+    // ApplyBuffer() removes entries from bitControls[qubitIndex], so we iterate over a copy.
+    std::vector<bitLenInt> controlled = bitControls[qubitIndex];
+    for (bitLenInt i = 0; i < controlled.size(); i++) {
+        ApplyBuffer(controlled[i]);
+    }
+}
+
+QInterfacePtr QFusion::FlushAndUnwrap(QInterfacePtr toUnwrap)
+{
+    QFusionPtr fusion = std::dynamic_pointer_cast<QFusion>(toUnwrap);
+    if (!fusion) {
+        return toUnwrap;
+    }
+
+    fusion->FlushAll();
+    return fusion->qReg;
+}
+
+void QFusion::BufferGate(GateBufferPtr bfr, const bitLenInt& target)
+{
+    // Gates that target our controls, or that are controlled by our target, do not commute with this gate.
+    bitLenInt i;
+    for (i = 0; i < bfr->controls.size(); i++) {
+        FlushTarget(bfr->controls[i]);
+    }
+    std::vector<bitLenInt> controlled = bitControls[target];
+    for (i = 0; i < controlled.size(); i++) {
+        ApplyBuffer(controlled[i]);
+    }
+
+    if (!bfr->Combinable(bitBuffers[target])) {
+        ApplyBuffer(target);
+    }
+
+    BitBufferPtr prevBfr = bitBuffers[target];
+    BitBufferPtr nBfr = bfr->LeftRightCompose(prevBfr);
+
+    if (nBfr->IsIdentity()) {
+        if (prevBfr) {
+            DiscardBuffer(target);
+        }
+        return;
+    }
+
+    if (!prevBfr) {
+        for (i = 0; i < nBfr->controls.size(); i++) {
+            bitControls[nBfr->controls[i]].push_back(target);
+        }
+    }
+
+    bitBuffers[target] = nBfr;
+}
+
+void QFusion::SetQuantumState(const complex* inputState)
+{
+    DiscardAll();
+    qReg->SetQuantumState(inputState);
+}
+
+void QFusion::GetQuantumState(complex* outputState)
+{
+    FlushAll();
+    qReg->GetQuantumState(outputState);
+}
+
+void QFusion::GetProbs(real1* outputProbs)
+{
+    FlushAll();
+    qReg->GetProbs(outputProbs);
+}
+
+complex QFusion::GetAmplitude(bitCapInt perm)
+{
+    FlushAll();
+    return qReg->GetAmplitude(perm);
+}
+
+std::vector<std::pair<bitCapInt, complex>> QFusion::GetTopAmplitudes(const bitCapIntOcl& k)
+{
+    FlushAll();
+    return qReg->GetTopAmplitudes(k);
+}
+
+void QFusion::GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps)
+{
+    FlushAll();
+    qReg->GetAmplitudes(perms, count, amps);
+}
+
+void QFusion::SetAmplitude(bitCapInt perm, complex amp)
+{
+    FlushAll();
+    qReg->SetAmplitude(perm, amp);
+}
+
+void QFusion::SetPermutation(bitCapInt perm, complex phaseFac)
+{
+    DiscardAll();
+    qReg->SetPermutation(perm, phaseFac);
+}
+
+bitLenInt QFusion::Compose(QInterfacePtr toCopy)
+{
+    // Appended bits don't change any existing indices, so our own buffers can stay.
+    bitLenInt toRet = qReg->Compose(FlushAndUnwrap(toCopy));
+    SetQubitCount(qReg->GetQubitCount());
+    return toRet;
+}
+
+bitLenInt QFusion::Compose(QInterfacePtr toCopy, bitLenInt start)
+{
+    FlushAll();
+    bitLenInt toRet = qReg->Compose(FlushAndUnwrap(toCopy), start);
+    SetQubitCount(qReg->GetQubitCount());
+    return toRet;
+}
+
+void QFusion::Decompose(bitLenInt start, bitLenInt length, QInterfacePtr dest)
+{
+    FlushAll();
+    qReg->Decompose(start, length, FlushAndUnwrap(dest));
+    SetQubitCount(qReg->GetQubitCount());
+}
+
+void QFusion::Dispose(bitLenInt start, bitLenInt length)
+{
+    FlushAll();
+    qReg->Dispose(start, length);
+    SetQubitCount(qReg->GetQubitCount());
+}
+
+void QFusion::Dispose(bitLenInt start, bitLenInt length, bitCapInt disposedPerm)
+{
+    FlushAll();
+    qReg->Dispose(start, length, disposedPerm);
+    SetQubitCount(qReg->GetQubitCount());
+}
+
+void QFusion::ApplySingleBit(const complex* mtrx, bitLenInt qubitIndex)
+{
+    BufferGate(std::make_shared<GateBuffer>(false, (const bitLenInt*)NULL, 0, mtrx), qubitIndex);
+}
+
+void QFusion::ApplyControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    BufferGate(std::make_shared<GateBuffer>(false, controls, controlLen, mtrx), target);
+}
+
+void QFusion::ApplyAntiControlledSingleBit(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& target, const complex* mtrx)
+{
+    BufferGate(std::make_shared<GateBuffer>(controlLen > 0, controls, controlLen, mtrx), target);
+}
+
+void QFusion::ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx)
+{
+    FlushArray(targets, targetLen);
+    qReg->ApplyMatrix(targets, targetLen, mtrx);
+}
+
+void QFusion::ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitLenInt* controls, const bitLenInt& controlLen, real1 radians)
+{
+    FlushArray(controls, controlLen);
+    FlushArray(qubits, length);
+    qReg->ExpPauli(paulis, qubits, length, controls, controlLen, radians);
+}
+
+void QFusion::TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance)
+{
+    FlushAll();
+    qReg->TimeEvolveExact(h, timeDiff, tolerance);
+}
+
+void QFusion::QFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    for (bitLenInt i = 0; i < length; i++) {
+        FlushBit(start + i);
+    }
+    qReg->QFT(start, length, trySeparate);
+}
+
+void QFusion::IQFT(bitLenInt start, bitLenInt length, bool trySeparate)
+{
+    for (bitLenInt i = 0; i < length; i++) {
+        FlushBit(start + i);
+    }
+    qReg->IQFT(start, length, trySeparate);
+}
+
+void QFusion::UniformlyControlledSingleBit(const bitLenInt* controls, const bitLenInt& controlLen,
+    bitLenInt qubitIndex, const complex* mtrxs, const bitCapInt* mtrxSkipPowers, const bitLenInt mtrxSkipLen,
+    const bitCapInt& mtrxSkipValueMask)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubitIndex);
+    qReg->UniformlyControlledSingleBit(
+        controls, controlLen, qubitIndex, mtrxs, mtrxSkipPowers, mtrxSkipLen, mtrxSkipValueMask);
+}
+
+void QFusion::CSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->CSwap(controls, controlLen, qubit1, qubit2);
+}
+
+void QFusion::AntiCSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->AntiCSwap(controls, controlLen, qubit1, qubit2);
+}
+
+void QFusion::CSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->CSqrtSwap(controls, controlLen, qubit1, qubit2);
+}
+
+void QFusion::AntiCSqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->AntiCSqrtSwap(controls, controlLen, qubit1, qubit2);
+}
+
+void QFusion::CISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->CISqrtSwap(controls, controlLen, qubit1, qubit2);
+}
+
+void QFusion::AntiCISqrtSwap(
+    const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
+{
+    FlushArray(controls, controlLen);
+    FlushBit(qubit1);
+    FlushBit(qubit2);
+    qReg->AntiCISqrtSwap(controls, controlLen, qubit1, qubit2);
+}
+
+// Measurement of a bit commutes with buffered gates that it only controls, and with buffered gates on other bits.
+
+bool QFusion::ForceM(bitLenInt qubitIndex, bool result, bool doForce, bool doApply)
+{
+    FlushTarget(qubitIndex);
+    return qReg->ForceM(qubitIndex, result, doForce, doApply);
+}
+
+bitCapInt QFusion::ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply)
+{
+    for (bitLenInt i = 0; i < length; i++) {
+        FlushTarget(bits[i]);
+    }
+    return qReg->ForceM(bits, length, values, doApply);
+}
+
+bitCapInt QFusion::ForceMReg(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce, bool doApply)
+{
+    FlushTargetReg(start, length);
+    return qReg->ForceMReg(start, length, result, doForce, doApply);
+}
+
+bitCapInt QFusion::ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce)
+{
+    FlushAll();
+    result = qReg->ForceMRegDispose(start, length, result, doForce);
+    SetQubitCount(qReg->GetQubitCount());
+    return result;
+}
+
+void QFusion::ROL(bitLenInt shift, bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->ROL(shift, start, length);
+}
+
+void QFusion::ROR(bitLenInt shift, bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->ROR(shift, start, length);
+}
+
+void QFusion::INC(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->INC(toAdd, start, length);
+}
+
+void QFusion::CINC(bitCapInt toAdd, bitLenInt inOutStart, bitLenInt length, bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inOutStart, length);
+    qReg->CINC(toAdd, inOutStart, length, controls, controlLen);
+}
+
+void QFusion::INCC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->INCC(toAdd, start, length, carryIndex);
+}
+
+void QFusion::INCS(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex)
+{
+    FlushReg(start, length);
+    FlushBit(overflowIndex);
+    qReg->INCS(toAdd, start, length, overflowIndex);
+}
+
+void QFusion::INCSC(
+    bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(overflowIndex);
+    FlushBit(carryIndex);
+    qReg->INCSC(toAdd, start, length, overflowIndex, carryIndex);
+}
+
+void QFusion::INCSC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->INCSC(toAdd, start, length, carryIndex);
+}
+
+void QFusion::INCBCD(bitCapInt toAdd, bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->INCBCD(toAdd, start, length);
+}
+
+void QFusion::INCBCDC(bitCapInt toAdd, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->INCBCDC(toAdd, start, length, carryIndex);
+}
+
+void QFusion::DECC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->DECC(toSub, start, length, carryIndex);
+}
+
+void QFusion::DECSC(
+    bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt overflowIndex, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(overflowIndex);
+    FlushBit(carryIndex);
+    qReg->DECSC(toSub, start, length, overflowIndex, carryIndex);
+}
+
+void QFusion::DECSC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->DECSC(toSub, start, length, carryIndex);
+}
+
+void QFusion::DECBCDC(bitCapInt toSub, bitLenInt start, bitLenInt length, bitLenInt carryIndex)
+{
+    FlushReg(start, length);
+    FlushBit(carryIndex);
+    qReg->DECBCDC(toSub, start, length, carryIndex);
+}
+
+void QFusion::MUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    FlushReg(inOutStart, length);
+    FlushReg(carryStart, length);
+    qReg->MUL(toMul, inOutStart, carryStart, length);
+}
+
+void QFusion::DIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length)
+{
+    FlushReg(inOutStart, length);
+    FlushReg(carryStart, length);
+    qReg->DIV(toDiv, inOutStart, carryStart, length);
+}
+
+void QFusion::MULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->MULModNOut(toMul, modN, inStart, outStart, length);
+}
+
+void QFusion::IMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->IMULModNOut(toMul, modN, inStart, outStart, length);
+}
+
+void QFusion::POWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length)
+{
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->POWModNOut(base, modN, inStart, outStart, length);
+}
+
+void QFusion::CMUL(bitCapInt toMul, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inOutStart, length);
+    FlushReg(carryStart, length);
+    qReg->CMUL(toMul, inOutStart, carryStart, length, controls, controlLen);
+}
+
+void QFusion::CDIV(bitCapInt toDiv, bitLenInt inOutStart, bitLenInt carryStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inOutStart, length);
+    FlushReg(carryStart, length);
+    qReg->CDIV(toDiv, inOutStart, carryStart, length, controls, controlLen);
+}
+
+void QFusion::CMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->CMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+}
+
+void QFusion::CIMULModNOut(bitCapInt toMul, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->CIMULModNOut(toMul, modN, inStart, outStart, length, controls, controlLen);
+}
+
+void QFusion::CPOWModNOut(bitCapInt base, bitCapInt modN, bitLenInt inStart, bitLenInt outStart, bitLenInt length,
+    bitLenInt* controls, bitLenInt controlLen)
+{
+    FlushArray(controls, controlLen);
+    FlushReg(inStart, length);
+    FlushReg(outStart, length);
+    qReg->CPOWModNOut(base, modN, inStart, outStart, length, controls, controlLen);
+}
+
+void QFusion::ZeroPhaseFlip(bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->ZeroPhaseFlip(start, length);
+}
+
+void QFusion::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length, bitLenInt flagIndex)
+{
+    FlushReg(start, length);
+    FlushBit(flagIndex);
+    qReg->CPhaseFlipIfLess(greaterPerm, start, length, flagIndex);
+}
+
+void QFusion::PhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    qReg->PhaseFlipIfLess(greaterPerm, start, length);
+}
+
+void QFusion::PhaseFlip()
+{
+    // A global phase factor commutes with everything.
+    qReg->PhaseFlip();
+}
+
+void QFusion::SetReg(bitLenInt start, bitLenInt length, bitCapInt value)
+{
+    FlushReg(start, length);
+    qReg->SetReg(start, length, value);
+}
+
+bitCapInt QFusion::IndexedLDA(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, unsigned char* values, bool resetValue)
+{
+    FlushReg(indexStart, indexLength);
+    FlushReg(valueStart, valueLength);
+    return qReg->IndexedLDA(indexStart, indexLength, valueStart, valueLength, values, resetValue);
+}
+
+bitCapInt QFusion::IndexedADC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    FlushReg(indexStart, indexLength);
+    FlushReg(valueStart, valueLength);
+    FlushBit(carryIndex);
+    return qReg->IndexedADC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+}
+
+bitCapInt QFusion::IndexedSBC(bitLenInt indexStart, bitLenInt indexLength, bitLenInt valueStart,
+    bitLenInt valueLength, bitLenInt carryIndex, unsigned char* values)
+{
+    FlushReg(indexStart, indexLength);
+    FlushReg(valueStart, valueLength);
+    FlushBit(carryIndex);
+    return qReg->IndexedSBC(indexStart, indexLength, valueStart, valueLength, carryIndex, values);
+}
+
+void QFusion::Hash(bitLenInt start, bitLenInt length, unsigned char* values)
+{
+    FlushReg(start, length);
+    qReg->Hash(start, length, values);
+}
+
+void QFusion::Swap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    FlushBit(qubitIndex1);
+    FlushBit(qubitIndex2);
+    qReg->Swap(qubitIndex1, qubitIndex2);
+}
+
+void QFusion::ISwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    FlushBit(qubitIndex1);
+    FlushBit(qubitIndex2);
+    qReg->ISwap(qubitIndex1, qubitIndex2);
+}
+
+void QFusion::SqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    FlushBit(qubitIndex1);
+    FlushBit(qubitIndex2);
+    qReg->SqrtSwap(qubitIndex1, qubitIndex2);
+}
+
+void QFusion::ISqrtSwap(bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    FlushBit(qubitIndex1);
+    FlushBit(qubitIndex2);
+    qReg->ISqrtSwap(qubitIndex1, qubitIndex2);
+}
+
+void QFusion::FSim(real1 theta, real1 phi, bitLenInt qubitIndex1, bitLenInt qubitIndex2)
+{
+    FlushBit(qubitIndex1);
+    FlushBit(qubitIndex2);
+    qReg->FSim(theta, phi, qubitIndex1, qubitIndex2);
+}
+
+// Gates on other bits, (controlled or not,) cannot change the marginal probability distribution of the bits we ask
+// about, so we only need to flush buffers that target them.
+
+real1 QFusion::Prob(bitLenInt qubitIndex)
+{
+    FlushTarget(qubitIndex);
+    return qReg->Prob(qubitIndex);
+}
+
+real1 QFusion::ProbAll(bitCapInt fullRegister)
+{
+    FlushAll();
+    return qReg->ProbAll(fullRegister);
+}
+
+void QFusion::ProbAllQubits(real1* probsArray)
+{
+    FlushAll();
+    qReg->ProbAllQubits(probsArray);
+}
+
+real1 QFusion::ProbReg(const bitLenInt& start, const bitLenInt& length, const bitCapInt& permutation)
+{
+    FlushTargetReg(start, length);
+    return qReg->ProbReg(start, length, permutation);
+}
+
+real1 QFusion::ProbMask(const bitCapInt& mask, const bitCapInt& permutation)
+{
+    FlushTargetMask(mask);
+    return qReg->ProbMask(mask, permutation);
+}
+
+void QFusion::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
+{
+    FlushTargetMask(mask);
+    qReg->ProbMaskAll(mask, probsArray);
+}
+
+std::map<bitCapInt, int> QFusion::MultiShotMeasureMask(
+    const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots)
+{
+    for (bitLenInt i = 0; i < qPowerCount; i++) {
+        FlushTarget(log2(qPowers[i]));
+    }
+    return qReg->MultiShotMeasureMask(qPowers, qPowerCount, shots);
+}
+
+real1 QFusion::ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length)
+{
+    FlushArray(qubits, length);
+    return qReg->ExpectationPauli(paulis, qubits, length);
+}
+
+void QFusion::ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitCapIntOcl& stringCount, real1* expectations)
+{
+    FlushArray(qubits, length);
+    qReg->ExpectationPauliAll(paulis, qubits, length, stringCount, expectations);
+}
+
+real1 QFusion::ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+    real1* histogram, const bitCapIntOcl& binCount, const real1& minCost, const real1& maxCost)
+{
+    FlushArray(qubits, length);
+    return qReg->ExpectationQUBO(qubits, length, weights, histogram, binCount, minCost, maxCost);
+}
+
+bool QFusion::ApproxCompare(QInterfacePtr toCompare)
+{
+    FlushAll();
+    return qReg->ApproxCompare(FlushAndUnwrap(toCompare));
+}
+
+void QFusion::UpdateRunningNorm(real1 norm_thresh)
+{
+    // Buffered gates are unitary, so they can't change the norm.
+    qReg->UpdateRunningNorm(norm_thresh);
+}
+
+void QFusion::NormalizeState(real1 nrm, real1 norm_thresh)
+{
+    FlushAll();
+    qReg->NormalizeState(nrm, norm_thresh);
+}
+
+void QFusion::Finish()
+{
+    FlushAll();
+    qReg->Finish();
+}
+
+bool QFusion::isFinished() { return qReg->isFinished(); }
+
+bool QFusion::TrySeparate(bitLenInt start, bitLenInt length)
+{
+    FlushReg(start, length);
+    return qReg->TrySeparate(start, length);
+}
+
+QInterfacePtr QFusion::Clone()
+{
+    FlushAll();
+
+    return QFusionPtr(new QFusion(qReg->Clone(), engine, subengine, rand_generator, phaseFactor, doNormalize,
+        randGlobalPhase, useHostRam, devID, useRDRAND, isSparse, amplitudeFloor));
+}
+
+} // namespace Qrack
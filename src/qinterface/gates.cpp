@@ -87,6 +87,166 @@ void QInterface::ApplyAntiControlledSingleInvert(const bitLenInt* controls, cons
     ApplyAntiControlledSingleBit(controls, controlLen, target, mtrx);
 }
 
+/// Apply an arbitrary dense transformation to several bits at once.
+void QInterface::ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    bitCapIntOcl targetPower = pow2Ocl(targetLen);
+    bitCapInt targetMask = 0;
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        if (targetMask & pow2(targets[i])) {
+            throw std::invalid_argument("ApplyMatrix target bits must be distinct.");
+        }
+        targetMask |= pow2(targets[i]);
+    }
+
+    bitCapInt* offsets = new bitCapInt[targetPower]();
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        for (bitCapIntOcl j = 0; j < targetPower; j++) {
+            if (j & pow2Ocl(i)) {
+                offsets[j] |= pow2(targets[i]);
+            }
+        }
+    }
+
+    // Without a native kernel, gather and scatter the whole state.
+    complex* stateVec = new complex[(bitCapIntOcl)maxQPower];
+    complex* amps = new complex[targetPower];
+    GetQuantumState(stateVec);
+
+    for (bitCapInt lcv = 0; lcv < maxQPower; lcv++) {
+        if (lcv & targetMask) {
+            continue;
+        }
+
+        for (bitCapIntOcl i = 0; i < targetPower; i++) {
+            amps[i] = stateVec[(bitCapIntOcl)(lcv | offsets[i])];
+        }
+
+        for (bitCapIntOcl i = 0; i < targetPower; i++) {
+            complex amp = ZERO_CMPLX;
+            for (bitCapIntOcl j = 0; j < targetPower; j++) {
+                amp += mtrx[i * targetPower + j] * amps[j];
+            }
+            stateVec[(bitCapIntOcl)(lcv | offsets[i])] = amp;
+        }
+    }
+
+    SetQuantumState(stateVec);
+
+    delete[] amps;
+    delete[] stateVec;
+    delete[] offsets;
+}
+
+/// Apply a sequence of arbitrary single bit gates, in order.
+void QInterface::ApplySingleBitSequence(const complex* mtrxs, const bitLenInt* targets, const unsigned int gateCount)
+{
+    for (unsigned int i = 0; i < gateCount; i++) {
+        ApplySingleBit(mtrxs + (4U * i), targets[i]);
+    }
+}
+
+/// Apply a layer of arbitrary single bit gates, one to each bit of a register.
+void QInterface::ApplySingleBitLayer(const complex* mtrxs, bitLenInt start, bitLenInt length)
+{
+    for (bitLenInt i = 0; i < length; i++) {
+        ApplySingleBit(mtrxs + (4U * i), start + i);
+    }
+}
+
+/// Parity phase gate, by computing the parity of the masked bits into the highest of them
+void QInterface::PhaseParity(real1 radians, bitCapInt mask)
+{
+    std::vector<bitLenInt> qubits;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (mask & pow2(i)) {
+            qubits.push_back(i);
+        }
+    }
+
+    if (qubits.size() == 0) {
+        return;
+    }
+
+    const bitLenInt end = qubits.size() - 1U;
+    for (bitLenInt i = 0; i < end; i++) {
+        CNOT(qubits[i], qubits[end]);
+    }
+    ApplySinglePhase(complex(cos(radians / 2), -sin(radians / 2)), complex(cos(radians / 2), sin(radians / 2)),
+        qubits[end]);
+    for (bitLenInt i = 0; i < end; i++) {
+        CNOT(qubits[end - (i + 1U)], qubits[end]);
+    }
+}
+
+/// Pauli string exponentiation, by rotating each factor into the Z basis around a parity phase gate
+void QInterface::ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitLenInt* controls, const bitLenInt& controlLen, real1 radians)
+{
+    if (length == 0) {
+        return;
+    }
+
+    std::vector<bitLenInt> zQubits;
+    for (bitLenInt i = 0; i < length; i++) {
+        if (paulis[i] != PauliI) {
+            zQubits.push_back(qubits[i]);
+        }
+    }
+
+    const complex phaseFac = complex(cos(radians), sin(radians));
+
+    // An identity string is only a phase, (which is relative, if there are controls).
+    if (zQubits.size() == 0) {
+        if (controlLen == 0) {
+            ApplySinglePhase(phaseFac, phaseFac, qubits[0]);
+        } else {
+            ApplyControlledSinglePhase(controls, controlLen, qubits[0], phaseFac, phaseFac);
+        }
+        return;
+    }
+
+    const complex adjSHGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, -M_SQRT1_2),
+        complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2) };
+    const complex hSGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2),
+        complex(ZERO_R1, -M_SQRT1_2) };
+
+    for (bitLenInt i = 0; i < length; i++) {
+        if (paulis[i] == PauliX) {
+            H(qubits[i]);
+        } else if (paulis[i] == PauliY) {
+            ApplySingleBit(adjSHGate, qubits[i]);
+        }
+    }
+
+    // The basis changes and the parity ladder undo themselves, so only the phase gate needs the controls.
+    const bitLenInt end = zQubits.size() - 1U;
+    for (bitLenInt i = 0; i < end; i++) {
+        CNOT(zQubits[i], zQubits[end]);
+    }
+    if (controlLen == 0) {
+        ApplySinglePhase(phaseFac, conj(phaseFac), zQubits[end]);
+    } else {
+        ApplyControlledSinglePhase(controls, controlLen, zQubits[end], phaseFac, conj(phaseFac));
+    }
+    for (bitLenInt i = 0; i < end; i++) {
+        CNOT(zQubits[end - (i + 1U)], zQubits[end]);
+    }
+
+    for (bitLenInt i = 0; i < length; i++) {
+        if (paulis[i] == PauliX) {
+            H(qubits[i]);
+        } else if (paulis[i] == PauliY) {
+            ApplySingleBit(hSGate, qubits[i]);
+        }
+    }
+}
+
 /// General unitary gate
 void QInterface::U(bitLenInt target, real1 theta, real1 phi, real1 lambda)
 {
@@ -281,53 +441,51 @@ void QInterface::UniformlyControlledSingleBit(const bitLenInt* controls, const b
 
 void QInterface::TimeEvolve(Hamiltonian h, real1 timeDiff)
 {
-    // Exponentiation of an arbitrary serial string of gates, each HamiltonianOp component times timeDiff, e^(-i * H *
-    // t) as e^(-i * H_(N - 1) * t) * e^(-i * H_(N - 2) * t) * ... e^(-i * H_0 * t)
+    if (!preparedHamiltonian || !preparedHamiltonian->IsPreparedFrom(h)) {
+        preparedHamiltonian = std::make_shared<PreparedHamiltonian>(h);
+    }
+    TimeEvolve(*preparedHamiltonian, timeDiff);
+}
 
-    for (bitLenInt i = 0; i < h.size(); i++) {
-        HamiltonianOpPtr op = h[i];
-        complex* opMtrx = op->matrix.get();
-        complex* mtrx;
+void QInterface::TimeEvolve(PreparedHamiltonian& h, real1 timeDiff)
+{
+    // Exponentiation of an arbitrary serial string of gates, each HamiltonianOp component times timeDiff, e^(-i * H *
+    // t) as e^(-i * H_(N - 1) * t) * e^(-i * H_(N - 2) * t) * ... e^(-i * H_0 * t), applied as fused steps
 
-        bitCapIntOcl maxJ = 4;
-        if (op->uniform) {
-            maxJ *= pow2Ocl(op->controlLen);
-        }
-        mtrx = new complex[maxJ];
+    const complex* mtrxs = h.GetMatrices(timeDiff);
+    const std::vector<PreparedHamiltonianStep>& steps = h.GetSteps();
 
-        for (bitCapIntOcl j = 0; j < maxJ; j++) {
-            mtrx[j] = opMtrx[j] * (-timeDiff);
-        }
+    for (size_t i = 0; i < steps.size(); i++) {
+        const PreparedHamiltonianStep& step = steps[i];
+        const complex* mtrx = mtrxs + step.mtrxOffset;
+        const bitLenInt controlLen = step.controls.size();
 
-        if (op->toggles) {
-            for (bitLenInt j = 0; j < op->controlLen; j++) {
-                if (op->toggles[j]) {
-                    X(op->controls[j]);
-                }
+        if (controlLen == 0) {
+            if (step.targets.size() == 1U) {
+                ApplySingleBit(mtrx, step.targets[0]);
+            } else {
+                ApplySingleBitSequence(mtrx, &(step.targets[0]), step.targets.size());
             }
-        }
-
-        if (op->uniform) {
-            complex* expMtrx = new complex[maxJ];
-            for (bitCapIntOcl j = 0; j < pow2(op->controlLen); j++) {
-                exp2x2(mtrx + (j * 4U), expMtrx + (j * 4U));
-            }
-            UniformlyControlledSingleBit(op->controls, op->controlLen, op->targetBit, expMtrx);
-            delete[] expMtrx;
+        } else if (step.isUniform) {
+            UniformlyControlledSingleBit(&(step.controls[0]), controlLen, step.targets[0], mtrx);
+        } else if (step.controlPerm == 0) {
+            ApplyAntiControlledSingleBit(&(step.controls[0]), controlLen, step.targets[0], mtrx);
         } else {
-            Exp(op->controls, op->controlLen, op->targetBit, mtrx, op->anti);
+            ApplyControlledSingleBit(&(step.controls[0]), controlLen, step.targets[0], mtrx);
         }
+    }
+}
 
-        if (op->toggles) {
-            for (bitLenInt j = 0; j < op->controlLen; j++) {
-                if (op->toggles[j]) {
-                    X(op->controls[j]);
-                }
-            }
-        }
+void QInterface::TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance)
+{
+    std::vector<complex> stateVec((bitCapIntOcl)maxQPower);
+    GetQuantumState(&(stateVec[0]));
 
-        delete[] mtrx;
-    }
+    // Engines with their own ParallelFor, (QEngineCPU,) override this. Any other engine sweeps its copy serially.
+    ParallelFor pf;
+    KrylovTimeEvolve(h, timeDiff, tolerance, &(stateVec[0]), qubitCount, pf);
+
+    SetQuantumState(&(stateVec[0]));
 }
 
 } // namespace Qrack
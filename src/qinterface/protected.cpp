@@ -101,16 +101,18 @@ void _expLog2x2(complex* matrix2x2, complex* outMatrix2x2, bool isExp)
         complex eigenvalue1 = (trace + quadraticRoot) / (real1)2.0;
         complex eigenvalue2 = (trace - quadraticRoot) / (real1)2.0;
 
+        // Since (M - eigenvalue1) * (M - eigenvalue2) = 0, the columns of (M - eigenvalue1) are eigenvectors of
+        // eigenvalue2, and vice versa.
         jacobian[0] = matrix2x2[0] - eigenvalue1;
         jacobian[2] = matrix2x2[2];
 
         jacobian[1] = matrix2x2[1];
         jacobian[3] = matrix2x2[3] - eigenvalue2;
 
-        expOfGate[0] = eigenvalue1;
+        expOfGate[0] = eigenvalue2;
         expOfGate[1] = complex(ZERO_R1, ZERO_R1);
         expOfGate[2] = complex(ZERO_R1, ZERO_R1);
-        expOfGate[3] = eigenvalue2;
+        expOfGate[3] = eigenvalue1;
 
         real1 nrm = std::sqrt(norm(jacobian[0]) + norm(jacobian[2]));
         jacobian[0] /= nrm;
@@ -233,7 +235,7 @@ bool QInterface::IsIdentity(const complex* mtrx, bool isControlled)
     // the user's purposes. If the global phase offset has not been randomized, user code might explicitly depend on
     // the global phase offset (but shouldn't).
 
-    if ((isControlled || !randGlobalPhase) && (imag(mtrx[0]) != 0)) {
+    if ((isControlled || !randGlobalPhase) && (mtrx[0] != ONE_CMPLX)) {
         return false;
     }
 
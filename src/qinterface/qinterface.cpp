@@ -10,8 +10,14 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
+#include <random>
+
 #include "qinterface.hpp"
 
+// Shots drawn by each independently seeded generator in MultiShotMeasureMask()
+#define MULTISHOT_CHUNK 4096U
+
 namespace Qrack {
 
 #define REG_GATE_1(gate)                                                                                               \
@@ -348,17 +354,26 @@ REG_GATE_C1_1D(CRZDyad);
 /// Apply general unitary gate to each bit in "length," starting from bit index "start"
 void QInterface::U(bitLenInt start, bitLenInt length, real1 theta, real1 phi, real1 lambda)
 {
+    if (!length) {
+        return;
+    }
+
+    real1 cos0 = cos(theta / 2);
+    real1 sin0 = sin(theta / 2);
+    const complex uGate[4] = { complex(cos0, ZERO_R1), sin0 * complex(-cos(lambda), -sin(lambda)),
+        sin0 * complex(cos(phi), sin(phi)), cos0 * complex(cos(phi + lambda), sin(phi + lambda)) };
+
+    std::vector<complex> mtrxs(4U * length);
     for (bitLenInt bit = 0; bit < length; bit++) {
-        U(start + bit, theta, phi, lambda);
+        std::copy(uGate, uGate + 4, mtrxs.begin() + (4U * bit));
     }
+    ApplySingleBitLayer(&(mtrxs[0]), start, length);
 }
 
 /// Apply 2-parameter unitary gate to each bit in "length," starting from bit index "start"
 void QInterface::U2(bitLenInt start, bitLenInt length, real1 phi, real1 lambda)
 {
-    for (bitLenInt bit = 0; bit < length; bit++) {
-        U2(start + bit, phi, lambda);
-    }
+    U(start, length, M_PI / 2, phi, lambda);
 }
 
 /// Apply "PhaseRootN" gate (1/(2^N) phase rotation) to each bit in "length", starting from bit index "start"
@@ -535,6 +550,13 @@ bitCapInt QInterface::ForceMReg(bitLenInt start, bitLenInt length, bitCapInt res
     return res;
 }
 
+bitCapInt QInterface::ForceMRegDispose(bitLenInt start, bitLenInt length, bitCapInt result, bool doForce)
+{
+    result = ForceMReg(start, length, result, doForce);
+    Dispose(start, length, result);
+    return result;
+}
+
 /// Bit-wise apply measurement gate to a register
 bitCapInt QInterface::ForceM(const bitLenInt* bits, const bitLenInt& length, const bool* values, bool doApply)
 {
@@ -604,6 +626,68 @@ std::map<QInterfacePtr, bitLenInt> QInterface::Compose(std::vector<QInterfacePtr
     return ret;
 }
 
+void QInterface::ProbAllQubits(real1* probsArray)
+{
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        probsArray[i] = Prob(i);
+    }
+}
+
+void QInterface::OfferTopAmplitude(std::vector<std::pair<bitCapInt, complex>>& heap, const bitCapIntOcl& k,
+    const bitCapInt& perm, const complex& amp)
+{
+    if (norm(amp) <= ZERO_R1) {
+        return;
+    }
+
+    const std::pair<bitCapInt, complex> entry(perm, amp);
+    if (heap.size() < k) {
+        heap.push_back(entry);
+        std::push_heap(heap.begin(), heap.end(), IsAmplitudeAhead);
+    } else if (IsAmplitudeAhead(entry, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), IsAmplitudeAhead);
+        heap.back() = entry;
+        std::push_heap(heap.begin(), heap.end(), IsAmplitudeAhead);
+    }
+}
+
+std::vector<std::pair<bitCapInt, complex>> QInterface::GetTopAmplitudes(const bitCapIntOcl& k)
+{
+    std::vector<std::pair<bitCapInt, complex>> toRet;
+    if (!k) {
+        return toRet;
+    }
+
+    bitCapIntOcl maxQPowerOcl = (bitCapIntOcl)maxQPower;
+    complex* state = new complex[maxQPowerOcl];
+    GetQuantumState(state);
+    for (bitCapIntOcl lcv = 0; lcv < maxQPowerOcl; lcv++) {
+        OfferTopAmplitude(toRet, k, lcv, state[lcv]);
+    }
+    delete[] state;
+
+    std::sort(toRet.begin(), toRet.end(), IsAmplitudeAhead);
+
+    return toRet;
+}
+
+void QInterface::GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps)
+{
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        amps[i] = GetAmplitude(perms[i]);
+    }
+}
+
+void QInterface::ProbAllBatch(const bitCapInt* perms, const bitCapIntOcl& count, real1* probs)
+{
+    complex* amps = new complex[count];
+    GetAmplitudes(perms, count, amps);
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        probs[i] = clampProb(norm(amps[i]));
+    }
+    delete[] amps;
+}
+
 void QInterface::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
 {
     bitCapInt v = mask; // count the number of bits set in v
@@ -647,9 +731,184 @@ void QInterface::ProbMaskAll(const bitCapInt& mask, real1* probsArray)
     }
 }
 
+/// Pauli string expectation value, by rotating the string into the Z basis and back around a parity of marginals
+real1 QInterface::ExpectationPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length)
+{
+    const complex adjSHGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, -M_SQRT1_2),
+        complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2) };
+    const complex hSGate[4] = { complex(M_SQRT1_2, ZERO_R1), complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2),
+        complex(ZERO_R1, -M_SQRT1_2) };
+
+    bitLenInt i;
+    bitCapInt mask = 0;
+    bitLenInt maskLength = 0;
+    for (i = 0; i < length; i++) {
+        if (paulis[i] == PauliX) {
+            H(qubits[i]);
+        } else if (paulis[i] == PauliY) {
+            ApplySingleBit(adjSHGate, qubits[i]);
+        }
+        if (paulis[i] != PauliI) {
+            mask |= pow2(qubits[i]);
+            maskLength++;
+        }
+    }
+
+    bitCapIntOcl maskPower = pow2Ocl(maskLength);
+    real1* probsArray = new real1[maskPower];
+    ProbMaskAll(mask, probsArray);
+
+    real1 expectation = ZERO_R1;
+    for (bitCapIntOcl j = 0; j < maskPower; j++) {
+        bool isOdd = false;
+        for (bitCapIntOcl v = j; v; v &= v - ONE_BCI) {
+            isOdd = !isOdd;
+        }
+        expectation += isOdd ? -probsArray[j] : probsArray[j];
+    }
+
+    delete[] probsArray;
+
+    for (i = 0; i < length; i++) {
+        if (paulis[i] == PauliX) {
+            H(qubits[i]);
+        } else if (paulis[i] == PauliY) {
+            ApplySingleBit(hSGate, qubits[i]);
+        }
+    }
+
+    return expectation;
+}
+
+void QInterface::ExpectationPauliAll(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitCapIntOcl& stringCount, real1* expectations)
+{
+    for (bitCapIntOcl s = 0; s < stringCount; s++) {
+        expectations[s] = ExpectationPauli(paulis + (s * length), qubits, length);
+    }
+}
+
+real1 QInterface::QUBOCost(const real1* weights, const bitLenInt& length, const bitCapInt& x)
+{
+    real1 cost = ZERO_R1;
+    for (bitLenInt i = 0; i < length; i++) {
+        if (!((x >> i) & ONE_BCI)) {
+            continue;
+        }
+        for (bitLenInt j = 0; j < length; j++) {
+            if ((x >> j) & ONE_BCI) {
+                cost += weights[i * length + j];
+            }
+        }
+    }
+    return cost;
+}
+
+real1 QInterface::ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+    real1* histogram, const bitCapIntOcl& binCount, const real1& minCost, const real1& maxCost)
+{
+    bitLenInt i;
+    bitCapIntOcl j;
+
+    // Bit "k" of a ProbMaskAll() outcome is the k-th lowest qubit, which is cost bit maskMap[k].
+    std::vector<bitLenInt> sortedQubits(qubits, qubits + length);
+    std::sort(sortedQubits.begin(), sortedQubits.end());
+    bitCapInt mask = 0;
+    std::vector<bitLenInt> maskMap(length);
+    for (bitLenInt k = 0; k < length; k++) {
+        mask |= pow2(sortedQubits[k]);
+        for (i = 0; i < length; i++) {
+            if (qubits[i] == sortedQubits[k]) {
+                maskMap[k] = i;
+                break;
+            }
+        }
+    }
+
+    bitCapIntOcl lengthPower = pow2Ocl(length);
+    real1* probsArray = new real1[lengthPower];
+    ProbMaskAll(mask, probsArray);
+
+    if (histogram) {
+        std::fill(histogram, histogram + binCount, ZERO_R1);
+    }
+    const real1 binScale = (maxCost > minCost) ? (binCount / (maxCost - minCost)) : ZERO_R1;
+
+    real1 expectation = ZERO_R1;
+    for (j = 0; j < lengthPower; j++) {
+        bitCapInt x = 0;
+        for (bitLenInt k = 0; k < length; k++) {
+            if ((j >> k) & 1U) {
+                x |= pow2(maskMap[k]);
+            }
+        }
+        const real1 cost = QUBOCost(weights, length, x);
+        expectation += probsArray[j] * cost;
+
+        if (histogram && binCount) {
+            const real1 bin = (cost - minCost) * binScale;
+            histogram[(bin <= ZERO_R1) ? 0U : ((bin >= binCount) ? (binCount - 1U) : (bitCapIntOcl)bin)] +=
+                probsArray[j];
+        }
+    }
+
+    delete[] probsArray;
+
+    return expectation;
+}
+
+real1 QInterface::ExpectationIsing(const bitLenInt* qubits, const bitLenInt& length, const real1* fields,
+    const real1* couplings, real1* histogram, const bitCapIntOcl& binCount, const real1& minCost,
+    const real1& maxCost)
+{
+    // With z = 1 - 2x, h*z = h - 2h*x, and J*z1*z2 = J - 2J*x1 - 2J*x2 + 4J*x1*x2.
+    std::vector<real1> weights(length * length, ZERO_R1);
+    real1 offset = ZERO_R1;
+    for (bitLenInt i = 0; i < length; i++) {
+        offset += fields[i];
+        weights[i * length + i] -= 2 * fields[i];
+        for (bitLenInt j = i + 1U; j < length; j++) {
+            const real1 coupling = couplings[i * length + j];
+            offset += coupling;
+            weights[i * length + i] -= 2 * coupling;
+            weights[j * length + j] -= 2 * coupling;
+            weights[i * length + j] += 4 * coupling;
+        }
+    }
+
+    return offset +
+        ExpectationQUBO(qubits, length, length ? &(weights[0]) : NULL, histogram, binCount, minCost - offset,
+            maxCost - offset);
+}
+
+std::vector<uint64_t> QInterface::RandSeeds(const bitCapIntOcl& count)
+{
+    std::vector<uint64_t> seeds(count);
+    for (bitCapIntOcl i = 0; i < count; i++) {
+        if (hardware_rand_generator != NULL) {
+            // The hardware generator only yields real1 variates, of at most 32 bits of randomness, so take two.
+            seeds[i] = ((uint64_t)(Rand() * 4294967296.0) << 32U) ^ (uint64_t)(Rand() * 4294967296.0);
+        } else {
+            seeds[i] = (*rand_generator)();
+        }
+    }
+    return seeds;
+}
+
 std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
     const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots)
 {
+    ParallelFor pf;
+    return SampleMaskShots(qPowers, qPowerCount, shots, pf);
+}
+
+std::map<bitCapInt, int> QInterface::SampleMaskShots(
+    const bitCapInt* qPowers, const bitLenInt qPowerCount, const unsigned int shots, ParallelFor& pf)
+{
+    if (shots == 0U) {
+        return std::map<bitCapInt, int>();
+    }
+
     bitLenInt i;
     bitCapIntOcl j;
 
@@ -660,8 +919,9 @@ std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
         qPowersSorted[i] = qPowers[i];
     }
 
+    // Bit "k" of a ProbMaskAll() outcome is the k-th lowest mask bit, which is result bit maskMap[k].
     std::sort(qPowersSorted, qPowersSorted + qPowerCount);
-    std::map<bitLenInt, bitCapInt> maskMap;
+    std::vector<bitCapInt> maskMap(qPowerCount);
     for (bitLenInt k = 0; k < qPowerCount; k++) {
         for (i = 0; i < qPowerCount; i++) {
             if (qPowersSorted[k] == qPowers[i]) {
@@ -670,39 +930,114 @@ std::map<bitCapInt, int> QInterface::MultiShotMeasureMask(
             }
         }
     }
+    delete[] qPowersSorted;
 
     bitCapIntOcl subsetCap = pow2Ocl(qPowerCount);
     real1* probsArray = new real1[subsetCap];
     ProbMaskAll(mask, probsArray);
 
-    real1 totProb = 0;
+    // Build a Walker alias table, (by Vose's method,) so each shot costs one table lookup.
+    double totProb = 0;
     for (j = 0; j < subsetCap; j++) {
         totProb += probsArray[j];
     }
 
+    std::vector<double> aliasProbs(subsetCap);
+    std::vector<bitCapIntOcl> aliases(subsetCap);
+    std::vector<bitCapIntOcl> small, large;
+    for (j = 0; j < subsetCap; j++) {
+        aliasProbs[j] = (totProb > 0) ? ((probsArray[j] * (double)subsetCap) / totProb) : 1.0;
+        aliases[j] = j;
+        if (aliasProbs[j] < 1.0) {
+            small.push_back(j);
+        } else {
+            large.push_back(j);
+        }
+    }
+    delete[] probsArray;
+
+    while (small.size() && large.size()) {
+        bitCapIntOcl s = small.back();
+        small.pop_back();
+        bitCapIntOcl l = large.back();
+        aliases[s] = l;
+        aliasProbs[l] -= 1.0 - aliasProbs[s];
+        if (aliasProbs[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever remains is 1, up to rounding.
+    for (j = 0; j < small.size(); j++) {
+        aliasProbs[small[j]] = 1.0;
+    }
+    for (j = 0; j < large.size(); j++) {
+        aliasProbs[large[j]] = 1.0;
+    }
+
+    // Shots are drawn in fixed-size chunks, each with its own generator, seeded in order from this QInterface's own
+    // random source, so the samples do not depend on how the chunks are scheduled across threads.
+    const bitCapIntOcl chunkCount = (shots + MULTISHOT_CHUNK - 1U) / MULTISHOT_CHUNK;
+    std::vector<uint64_t> seeds = RandSeeds(chunkCount);
+
+    // Each thread tallies its own histogram: dense, if the outcomes are no more than the shots in a block, and
+    // otherwise sparse, so memory stays proportional to the outcomes actually drawn, rather than to the shots.
+    const bool isDense = subsetCap <= MULTISHOT_CHUNK;
+    std::vector<std::vector<int>> denseCounts(pf.GetConcurrencyLevel());
+    std::vector<std::map<bitCapIntOcl, int>> sparseCounts(pf.GetConcurrencyLevel());
+    pf.par_for(0, chunkCount, [&](const bitCapInt lcv, const int cpu) {
+        qrack_rand_gen gen(seeds[(bitCapIntOcl)lcv]);
+        std::uniform_int_distribution<bitCapIntOcl> indexDist(0, subsetCap - 1U);
+        std::uniform_real_distribution<double> coinDist(0.0, 1.0);
+
+        std::vector<int>& dense = denseCounts[cpu];
+        if (isDense && !dense.size()) {
+            dense.resize(subsetCap, 0);
+        }
+        std::map<bitCapIntOcl, int>& sparse = sparseCounts[cpu];
+
+        const bitCapIntOcl begin = (bitCapIntOcl)lcv * MULTISHOT_CHUNK;
+        const bitCapIntOcl end = ((begin + MULTISHOT_CHUNK) < shots) ? (begin + MULTISHOT_CHUNK) : shots;
+        for (bitCapIntOcl shot = begin; shot < end; shot++) {
+            bitCapIntOcl index = indexDist(gen);
+            if (coinDist(gen) >= aliasProbs[index]) {
+                index = aliases[index];
+            }
+            if (isDense) {
+                dense[index]++;
+            } else {
+                sparse[index]++;
+            }
+        }
+    });
+
+    // Merge the threads' histograms.
+    std::map<bitCapIntOcl, int> counts;
+    for (size_t t = 0; t < denseCounts.size(); t++) {
+        for (j = 0; j < denseCounts[t].size(); j++) {
+            if (denseCounts[t][j]) {
+                counts[j] += denseCounts[t][j];
+            }
+        }
+        std::map<bitCapIntOcl, int>::iterator it;
+        for (it = sparseCounts[t].begin(); it != sparseCounts[t].end(); it++) {
+            counts[it->first] += it->second;
+        }
+    }
+
     std::map<bitCapInt, int> results;
-    real1 maskProb, cumProb;
     bitCapInt key;
-    for (unsigned int shot = 0; shot < shots; shot++) {
-        maskProb = Rand();
-        cumProb = ZERO_R1;
-        for (j = 0; j < subsetCap; j++) {
-            cumProb += probsArray[j];
-            if ((maskProb < cumProb) || (cumProb >= totProb)) {
-                key = 0;
-                for (i = 0; i < qPowerCount; i++) {
-                    if (j & pow2(i)) {
-                        key |= maskMap[i];
-                    }
-                }
-                results[key]++;
-                break;
+    std::map<bitCapIntOcl, int>::iterator it;
+    for (it = counts.begin(); it != counts.end(); it++) {
+        key = 0;
+        for (i = 0; i < qPowerCount; i++) {
+            if ((it->first >> i) & 1U) {
+                key |= maskMap[i];
             }
         }
+        results[key] = it->second;
     }
 
-    delete[] probsArray;
-
     return results;
 }
 
@@ -21,6 +21,7 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
 #include <ctime>
 #include <initializer_list>
 #include <map>
@@ -176,6 +177,148 @@ complex QUnit::GetAmplitude(bitCapInt perm)
     return result;
 }
 
+std::map<QInterfacePtr, std::vector<bitLenInt>> QUnit::UnitQubitMap()
+{
+    ToPermBasisAll();
+    EndAllEmulation();
+
+    std::map<QInterfacePtr, std::vector<bitLenInt>> unitQubits;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        std::vector<bitLenInt>& qubits = unitQubits[shards[i].unit];
+        qubits.resize(shards[i].unit->GetQubitCount());
+        qubits[shards[i].mapped] = i;
+    }
+
+    return unitQubits;
+}
+
+/**
+ * The "k" largest amplitudes, by norm, without building the product state
+ *
+ * Each separable unit supplies its own best "k" amplitudes, (which are all that any of the best "k" products can use,)
+ * sorted by norm. A best-first search then walks the products of one entry per unit, from the product of the leading
+ * entries, in descending order of norm. A candidate's successors advance a single unit's index, only at or after the
+ * last unit index it advanced, so that every combination is reached exactly once, and never before its parent.
+ */
+std::vector<std::pair<bitCapInt, complex>> QUnit::GetTopAmplitudes(const bitCapIntOcl& k)
+{
+    std::vector<std::pair<bitCapInt, complex>> toRet;
+    if (!k) {
+        return toRet;
+    }
+
+    std::map<QInterfacePtr, std::vector<bitLenInt>> unitQubits = UnitQubitMap();
+
+    // Each unit's best amplitudes, with their permutations translated to QUnit qubits
+    std::vector<std::vector<std::pair<bitCapInt, complex>>> factors;
+    std::map<QInterfacePtr, std::vector<bitLenInt>>::iterator it;
+    for (it = unitQubits.begin(); it != unitQubits.end(); it++) {
+        std::vector<std::pair<bitCapInt, complex>> factor = it->first->GetTopAmplitudes(k);
+        if (!factor.size()) {
+            return toRet;
+        }
+        for (size_t j = 0; j < factor.size(); j++) {
+            bitCapInt perm = 0;
+            for (bitLenInt b = 0; b < it->second.size(); b++) {
+                if ((factor[j].first >> b) & ONE_BCI) {
+                    perm |= pow2(it->second[b]);
+                }
+            }
+            factor[j].first = perm;
+        }
+        factors.push_back(factor);
+    }
+
+    struct Candidate {
+        real1 nrm;
+        std::vector<size_t> indices;
+        size_t lastAdvanced;
+    };
+    auto isBehind = [](const Candidate& a, const Candidate& b) { return a.nrm < b.nrm; };
+
+    Candidate first;
+    first.nrm = ONE_R1;
+    first.indices.resize(factors.size(), 0);
+    first.lastAdvanced = 0;
+    for (size_t f = 0; f < factors.size(); f++) {
+        first.nrm *= norm(factors[f][0].second);
+    }
+
+    std::vector<Candidate> frontier;
+    frontier.push_back(first);
+
+    while (frontier.size() && (toRet.size() < k)) {
+        std::pop_heap(frontier.begin(), frontier.end(), isBehind);
+        Candidate c = frontier.back();
+        frontier.pop_back();
+
+        bitCapInt perm = 0;
+        complex amp = ONE_CMPLX;
+        for (size_t f = 0; f < factors.size(); f++) {
+            perm |= factors[f][c.indices[f]].first;
+            amp *= factors[f][c.indices[f]].second;
+        }
+        toRet.push_back(std::make_pair(perm, amp));
+
+        for (size_t f = c.lastAdvanced; f < factors.size(); f++) {
+            if ((c.indices[f] + 1U) >= factors[f].size()) {
+                continue;
+            }
+            Candidate next = c;
+            next.indices[f]++;
+            next.lastAdvanced = f;
+            next.nrm = ONE_R1;
+            for (size_t g = 0; g < factors.size(); g++) {
+                next.nrm *= norm(factors[g][next.indices[g]].second);
+            }
+            frontier.push_back(next);
+            std::push_heap(frontier.begin(), frontier.end(), isBehind);
+        }
+    }
+
+    std::sort(toRet.begin(), toRet.end(), IsAmplitudeAhead);
+
+    return toRet;
+}
+
+/**
+ * Amplitudes of a list of permutations, as products over the separable units
+ *
+ * The shards are walked once for the whole list, rather than once per permutation, and each unit answers for all of
+ * the permutations in a single call of its own.
+ */
+void QUnit::GetAmplitudes(const bitCapInt* perms, const bitCapIntOcl& count, complex* amps)
+{
+    std::map<QInterfacePtr, std::vector<bitLenInt>> unitQubits = UnitQubitMap();
+
+    std::fill(amps, amps + count, ONE_CMPLX);
+
+    bitCapInt* unitPerms = new bitCapInt[count];
+    complex* unitAmps = new complex[count];
+    std::map<QInterfacePtr, std::vector<bitLenInt>>::iterator it;
+    for (it = unitQubits.begin(); it != unitQubits.end(); it++) {
+        const std::vector<bitLenInt>& qubits = it->second;
+        // (Gathering the unit's bits is cheap, next to the amplitude lookups, which run on the unit's own engine.)
+        for (bitCapIntOcl i = 0; i < count; i++) {
+            bitCapInt unitPerm = 0;
+            for (bitLenInt b = 0; b < qubits.size(); b++) {
+                if ((perms[i] >> qubits[b]) & ONE_BCI) {
+                    unitPerm |= pow2(b);
+                }
+            }
+            unitPerms[i] = unitPerm;
+        }
+
+        it->first->GetAmplitudes(unitPerms, count, unitAmps);
+
+        for (bitCapIntOcl i = 0; i < count; i++) {
+            amps[i] *= unitAmps[i];
+        }
+    }
+    delete[] unitPerms;
+    delete[] unitAmps;
+}
+
 void QUnit::SetAmplitude(bitCapInt perm, complex amp)
 {
     EntangleAll();
@@ -609,23 +752,29 @@ real1 QUnit::ProbBase(const bitLenInt& qubit)
     QEngineShard& shard = shards[qubit];
 
     if (shard.isProbDirty) {
-        real1 prob = (shard.unit->Prob)(shard.mapped);
-        shard.amp1 = complex(sqrt(prob), ZERO_R1);
-        shard.amp0 = complex(sqrt(ONE_R1 - prob), ZERO_R1);
-        if (doNormalize) {
-            if (shard.ClampAmps(amplitudeFloor) && (shard.unit->GetQubitCount() == 1U)) {
-                shard.unit->SetPermutation((prob < (ONE_R1 / 2)) ? 0 : 1);
-            }
-        }
-        shard.isProbDirty = false;
-        shard.isEmulated = false;
-
-        CheckShardSeparable(qubit);
+        CacheShardProb(qubit, (shard.unit->Prob)(shard.mapped));
     }
 
     return norm(shard.amp1);
 }
 
+void QUnit::CacheShardProb(const bitLenInt& qubit, const real1& prob)
+{
+    QEngineShard& shard = shards[qubit];
+
+    shard.amp1 = complex(sqrt(prob), ZERO_R1);
+    shard.amp0 = complex(sqrt(ONE_R1 - prob), ZERO_R1);
+    if (doNormalize) {
+        if (shard.ClampAmps(amplitudeFloor) && (shard.unit->GetQubitCount() == 1U)) {
+            shard.unit->SetPermutation((prob < (ONE_R1 / 2)) ? 0 : 1);
+        }
+    }
+    shard.isProbDirty = false;
+    shard.isEmulated = false;
+
+    CheckShardSeparable(qubit);
+}
+
 real1 QUnit::Prob(bitLenInt qubit)
 {
     ToPermBasis(qubit);
@@ -634,6 +783,57 @@ real1 QUnit::Prob(bitLenInt qubit)
 
 real1 QUnit::ProbAll(bitCapInt perm) { return clampProb(norm(GetAmplitude(perm))); }
 
+/// Every bit's probability, from the shard caches where they are fresh, and otherwise from one pass per entangled unit
+void QUnit::ProbAllQubits(real1* probsArray)
+{
+    ToPermBasisAll();
+
+    bitLenInt i;
+    std::map<QInterfacePtr, std::vector<bitLenInt>> dirtyUnits;
+    for (i = 0; i < qubitCount; i++) {
+        if (shards[i].isProbDirty) {
+            dirtyUnits[shards[i].unit].push_back(i);
+        }
+    }
+
+    std::map<QInterfacePtr, std::vector<bitLenInt>>::iterator it;
+    for (it = dirtyUnits.begin(); it != dirtyUnits.end(); it++) {
+        std::vector<real1> unitProbs(it->first->GetQubitCount());
+        it->first->ProbAllQubits(&(unitProbs[0]));
+        // Every mapping is read before any shard can separate from the unit.
+        std::vector<real1> probs(it->second.size());
+        for (i = 0; i < it->second.size(); i++) {
+            probs[i] = unitProbs[shards[it->second[i]].mapped];
+        }
+        for (i = 0; i < it->second.size(); i++) {
+            CacheShardProb(it->second[i], probs[i]);
+        }
+    }
+
+    for (i = 0; i < qubitCount; i++) {
+        probsArray[i] = norm(shards[i].amp1);
+    }
+}
+
+/// The cost depends jointly on all of its qubits, so they answer together, from one entangled unit.
+real1 QUnit::ExpectationQUBO(const bitLenInt* qubits, const bitLenInt& length, const real1* weights,
+    real1* histogram, const bitCapIntOcl& binCount, const real1& minCost, const real1& maxCost)
+{
+    if (!length) {
+        return QInterface::ExpectationQUBO(qubits, length, weights, histogram, binCount, minCost, maxCost);
+    }
+
+    // Entangle() maps each bit in place, so the mapped order still matches the weight matrix order.
+    std::vector<bitLenInt> bits(qubits, qubits + length);
+    std::vector<bitLenInt*> ebits(length);
+    for (bitLenInt i = 0; i < length; i++) {
+        ebits[i] = &bits[i];
+    }
+
+    QInterfacePtr unit = Entangle(ebits);
+    return unit->ExpectationQUBO(&(bits[0]), length, weights, histogram, binCount, minCost, maxCost);
+}
+
 void QUnit::SeparateBit(bool value, bitLenInt qubit, bool doDispose)
 {
     QInterfacePtr unit = shards[qubit].unit;
@@ -1821,6 +2021,118 @@ void QUnit::ApplyAntiControlledSingleBit(
     CTRLED_GEN_WRAP(ApplyAntiControlledSingleBit(CTRL_GEN_ARGS), ApplySingleBit(mtrx, target), true);
 }
 
+void QUnit::ApplyMatrix(const bitLenInt* targets, const bitLenInt& targetLen, const complex* mtrx)
+{
+    if (targetLen == 1U) {
+        ApplySingleBit(mtrx, targets[0]);
+        return;
+    }
+
+    // Entangle() maps each bit in place, so the mapped order still matches the matrix index bit order.
+    std::vector<bitLenInt> bits(targets, targets + targetLen);
+    std::vector<bitLenInt*> ebits(targetLen);
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        ebits[i] = &bits[i];
+    }
+
+    QInterfacePtr unit = Entangle(ebits);
+    unit->ApplyMatrix(&(bits[0]), targetLen, mtrx);
+
+    for (bitLenInt i = 0; i < targetLen; i++) {
+        shards[targets[i]].MakeDirty();
+    }
+}
+
+void QUnit::ExpPauli(const Pauli* paulis, const bitLenInt* qubits, const bitLenInt& length,
+    const bitLenInt* controls, const bitLenInt& controlLen, real1 radians)
+{
+    // Identity factors don't need to join the entangled unit.
+    std::vector<Pauli> factors;
+    std::vector<bitLenInt> targets;
+    for (bitLenInt i = 0; i < length; i++) {
+        if (paulis[i] != PauliI) {
+            factors.push_back(paulis[i]);
+            targets.push_back(qubits[i]);
+        }
+    }
+
+    if (targets.size() < 2U) {
+        QInterface::ExpPauli(paulis, qubits, length, controls, controlLen, radians);
+        return;
+    }
+
+    for (bitLenInt i = 0; i < targets.size(); i++) {
+        ToPermBasis(targets[i]);
+    }
+
+    ApplyEitherControlled(controls, controlLen, targets, false,
+        [&](QInterfacePtr unit, std::vector<bitLenInt> mappedControls) {
+            std::vector<bitLenInt> mappedTargets(targets.size());
+            for (bitLenInt i = 0; i < targets.size(); i++) {
+                mappedTargets[i] = shards[targets[i]].mapped;
+            }
+            unit->ExpPauli(&(factors[0]), &(mappedTargets[0]), mappedTargets.size(), &(mappedControls[0]),
+                mappedControls.size(), radians);
+        },
+        [&]() {
+            QInterfacePtr unit = Entangle(targets);
+            std::vector<bitLenInt> mappedTargets(targets.size());
+            for (bitLenInt i = 0; i < targets.size(); i++) {
+                mappedTargets[i] = shards[targets[i]].mapped;
+            }
+            unit->ExpPauli(&(factors[0]), &(mappedTargets[0]), mappedTargets.size(), NULL, 0, radians);
+            for (bitLenInt i = 0; i < targets.size(); i++) {
+                shards[targets[i]].MakeDirty();
+            }
+        });
+}
+
+void QUnit::TimeEvolveExact(Hamiltonian h, real1 timeDiff, real1 tolerance)
+{
+    // Only the bits that the ops act on join the entangled unit, which then evolves under the ops on its mapped bits.
+    std::vector<bitLenInt> bits;
+    for (size_t i = 0; i < h.size(); i++) {
+        bits.push_back(h[i]->targetBit);
+        bits.insert(bits.end(), h[i]->controls, h[i]->controls + h[i]->controlLen);
+    }
+    std::sort(bits.begin(), bits.end());
+    bits.erase(std::unique(bits.begin(), bits.end()), bits.end());
+
+    if (bits.size() == 0) {
+        return;
+    }
+
+    for (bitLenInt i = 0; i < bits.size(); i++) {
+        ToPermBasis(bits[i]);
+    }
+
+    QInterfacePtr unit = Entangle(bits);
+
+    Hamiltonian mappedH(h.size());
+    std::vector<bitLenInt> mappedControls;
+    for (size_t i = 0; i < h.size(); i++) {
+        const HamiltonianOp& op = *(h[i]);
+        mappedControls.resize(op.controlLen);
+        for (bitLenInt j = 0; j < op.controlLen; j++) {
+            mappedControls[j] = shards[op.controls[j]].mapped;
+        }
+
+        if (op.controlLen) {
+            mappedH[i] = std::make_shared<HamiltonianOp>(&(mappedControls[0]), op.controlLen,
+                shards[op.targetBit].mapped, op.matrix, op.anti, op.toggles);
+        } else {
+            mappedH[i] = std::make_shared<HamiltonianOp>(shards[op.targetBit].mapped, op.matrix);
+        }
+        mappedH[i]->uniform = op.uniform;
+    }
+
+    unit->TimeEvolveExact(mappedH, timeDiff, tolerance);
+
+    for (bitLenInt i = 0; i < bits.size(); i++) {
+        shards[bits[i]].MakeDirty();
+    }
+}
+
 void QUnit::CSwap(
     const bitLenInt* controls, const bitLenInt& controlLen, const bitLenInt& qubit1, const bitLenInt& qubit2)
 {
@@ -2861,6 +3173,55 @@ void QUnit::CPhaseFlipIfLess(bitCapInt greaterPerm, bitLenInt start, bitLenInt l
     shards[flagIndex].isPhaseDirty = true;
 }
 
+void QUnit::PhaseParity(real1 radians, bitCapInt mask)
+{
+    // Bits in cached permutation eigenstates only contribute a known parity, (which reverses the phase, if odd):
+    std::vector<bitLenInt> qubits;
+    bitLenInt firstBit = qubitCount;
+    for (bitLenInt i = 0; i < qubitCount; i++) {
+        if (!(mask & pow2(i))) {
+            continue;
+        }
+        if (firstBit == qubitCount) {
+            firstBit = i;
+        }
+        if (!CheckBitPermutation(i)) {
+            qubits.push_back(i);
+        } else if (SHARD_STATE(shards[i])) {
+            radians = -radians;
+        }
+    }
+
+    if (firstBit == qubitCount) {
+        return;
+    }
+
+    const complex phaseFac = complex(cos(radians / 2), sin(radians / 2));
+
+    if (qubits.size() == 0) {
+        // This is only a global phase, for even parity, (counting the sign already absorbed into "radians").
+        ApplySinglePhase(ONE_CMPLX / phaseFac, ONE_CMPLX / phaseFac, firstBit);
+        return;
+    }
+
+    if (qubits.size() == 1U) {
+        ApplySinglePhase(ONE_CMPLX / phaseFac, phaseFac, qubits[0]);
+        return;
+    }
+
+    // Otherwise, hand the whole gate to the engine of the remaining bits, which can batch it with other diagonal gates,
+    // instead of breaking it into the (non-diagonal) CNOT ladder of QInterface::PhaseParity().
+    QInterfacePtr unit = Entangle(qubits);
+
+    bitCapInt mappedMask = 0;
+    for (bitLenInt i = 0; i < qubits.size(); i++) {
+        mappedMask |= pow2(shards[qubits[i]].mapped);
+        shards[qubits[i]].isPhaseDirty = true;
+    }
+
+    unit->PhaseParity(radians, mappedMask);
+}
+
 void QUnit::PhaseFlip()
 {
     QEngineShard& shard = shards[0];
@@ -3106,8 +3467,8 @@ QInterfacePtr QUnit::Clone()
     ToPermBasisAll();
     EndAllEmulation();
 
-    QUnitPtr copyPtr = std::make_shared<QUnit>(
-        engine, subengine, qubitCount, 0, rand_generator, ONE_CMPLX, doNormalize, randGlobalPhase, useHostRam);
+    QUnitPtr copyPtr = std::make_shared<QUnit>(engine, subengine, qubitCount, 0, rand_generator, ONE_CMPLX,
+        doNormalize, randGlobalPhase, useHostRam, devID, useRDRAND, isSparse);
 
     return CloneBody(copyPtr);
 }
@@ -247,6 +247,16 @@ TEST_CASE("test_x_all", "[gates]")
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->X(0, n); });
 }
 
+TEST_CASE("test_h_all", "[gates]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->H(0, n); });
+}
+
+TEST_CASE("test_u_all", "[gates]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->U(0, n, 0.4f, 1.1f, -0.3f); });
+}
+
 TEST_CASE("test_y_all", "[gates]")
 {
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->Y(0, n); });
@@ -307,6 +317,25 @@ TEST_CASE("test_crt_all", "[gates]")
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->CRT(M_PI, 0, n / 2, n / 2); });
 }
 
+TEST_CASE("test_uniformly_controlled_ry", "[gates]")
+{
+    // One target under 10 to 16 controls, (or as many as the register has room for)
+    const bitLenInt controls[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    std::vector<real1> angles(pow2Ocl(16));
+    for (bitCapIntOcl i = 0; i < angles.size(); i++) {
+        angles[i] = (real1)(2 * M_PI * i) / angles.size();
+    }
+
+    for (bitLenInt controlLen = 10; controlLen <= 16; controlLen += 2) {
+        benchmarkLoop(
+            [&](QInterfacePtr qftReg, bitLenInt n) {
+                bitLenInt len = (controlLen < n) ? controlLen : (n - 1);
+                qftReg->UniformlyControlledRY(controls, len, 0, &(angles[0]));
+            },
+            true, true);
+    }
+}
+
 TEST_CASE("test_rol", "[gates]")
 {
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->ROL(1, 0, n); });
@@ -357,6 +386,32 @@ TEST_CASE("test_mreg", "[measure]")
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->MReg(0, n); });
 }
 
+TEST_CASE("test_probmaskall", "[measure]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        // Every other qubit, so the outcome bits are scattered through the permutation index
+        bitCapInt mask = 0;
+        for (bitLenInt i = 0; i < n; i += 2) {
+            mask |= pow2(i);
+        }
+        real1* probs = new real1[pow2Ocl((n + 1) / 2)];
+        qftReg->ProbMaskAll(mask, probs);
+        delete[] probs;
+    });
+}
+
+TEST_CASE("test_multishot_all", "[measure]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        bitCapInt* qPowers = new bitCapInt[n];
+        for (bitLenInt i = 0; i < n; i++) {
+            qPowers[i] = pow2(i);
+        }
+        qftReg->MultiShotMeasureMask(qPowers, n, 1U << 16U);
+        delete[] qPowers;
+    });
+}
+
 void benchmarkSuperpose(std::function<void(QInterfacePtr, int, unsigned char*)> fn)
 {
     bitCapIntOcl i, j;
@@ -404,6 +459,69 @@ TEST_CASE("test_proball", "[aux]")
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->ProbAll(0x02); });
 }
 
+TEST_CASE("test_proballqubits", "[aux]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        real1* probs = new real1[n];
+        qftReg->ProbAllQubits(probs);
+        delete[] probs;
+    });
+}
+
+TEST_CASE("test_gettopamplitudes", "[aux]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->GetTopAmplitudes(100U); });
+}
+
+TEST_CASE("test_getamplitudes", "[aux]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        // A fixed spread of 1024 bitstrings
+        const bitCapIntOcl count = 1024U;
+        bitCapInt* perms = new bitCapInt[count];
+        for (bitCapIntOcl i = 0; i < count; i++) {
+            perms[i] = (i * 0x9E3779B97F4A7C15ULL) & (qftReg->GetMaxQPower() - ONE_BCI);
+        }
+        complex* amps = new complex[count];
+        qftReg->GetAmplitudes(perms, count, amps);
+        delete[] perms;
+        delete[] amps;
+    });
+}
+
+TEST_CASE("test_expectation_pauli", "[aux]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        // Alternating X and Z factors over every qubit
+        std::vector<Pauli> paulis(n);
+        std::vector<bitLenInt> qubits(n);
+        for (bitLenInt i = 0; i < n; i++) {
+            paulis[i] = (i & 1U) ? PauliZ : PauliX;
+            qubits[i] = i;
+        }
+        qftReg->ExpectationPauli(&(paulis[0]), &(qubits[0]), n);
+    });
+}
+
+TEST_CASE("test_expectation_qubo", "[aux]")
+{
+    benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) {
+        // MaxCut on a ring of every qubit, (the cost of each edge is x1 + x2 - 2 * x1 * x2,) with its histogram
+        std::vector<real1> weights(n * n, ZERO_R1);
+        std::vector<bitLenInt> qubits(n);
+        for (bitLenInt i = 0; i < n; i++) {
+            const bitLenInt j = (i + 1U) % n;
+            weights[i * n + i] += ONE_R1;
+            weights[j * n + j] += ONE_R1;
+            weights[i * n + j] -= ONE_R1;
+            weights[j * n + i] -= ONE_R1;
+            qubits[i] = i;
+        }
+        std::vector<real1> histogram(n + 1U);
+        qftReg->ExpectationQUBO(&(qubits[0]), n, &(weights[0]), &(histogram[0]), n + 1U, -0.5f, n + 0.5f);
+    });
+}
+
 TEST_CASE("test_set_reg", "[aux]")
 {
     benchmarkLoop([](QInterfacePtr qftReg, bitLenInt n) { qftReg->SetReg(0, n, 1); });
@@ -40,6 +40,7 @@ int main(int argc, char* argv[])
 
     bool qengine = false;
     bool qunit = false;
+    bool qfusion = false;
     bool cpu = false;
     bool opencl_single = false;
     bool opencl_multi = false;
@@ -51,6 +52,7 @@ int main(int argc, char* argv[])
      */
     auto cli = session.cli() | Opt(qengine)["--layer-qengine"]("Enable Basic QEngine tests") |
         Opt(qunit)["--layer-qunit"]("Enable QUnit implementation tests") |
+        Opt(qfusion)["--layer-qfusion"]("Enable gate fusion (QFusion) tests") |
         Opt(cpu)["--proc-cpu"]("Enable the CPU-based implementation tests") |
         Opt(opencl_single)["--proc-opencl-single"]("Single (parallel) processor OpenCL tests") |
         Opt(opencl_multi)["--proc-opencl-multi"]("Multiple processor OpenCL tests") |
@@ -102,9 +104,10 @@ int main(int argc, char* argv[])
 #endif
     session.config().stream() << std::endl;
 
-    if (!qengine && !qunit) {
+    if (!qengine && !qunit && !qfusion) {
         qunit = true;
         qengine = true;
+        qfusion = true;
     }
 
     if (!cpu && !opencl_single && !opencl_multi) {
@@ -175,6 +178,26 @@ int main(int argc, char* argv[])
 #endif
     }
 
+    if (num_failed == 0 && qfusion) {
+        testEngineType = QINTERFACE_QFUSION;
+        if (num_failed == 0 && cpu) {
+            session.config().stream() << "############ QFusion -> QEngine -> CPU ############" << std::endl;
+            testSubEngineType = QINTERFACE_CPU;
+            testSubSubEngineType = QINTERFACE_CPU;
+            num_failed = session.run();
+        }
+
+#if ENABLE_OPENCL
+        if (num_failed == 0 && opencl_single) {
+            session.config().stream() << "############ QFusion -> QEngine -> OpenCL ############" << std::endl;
+            testSubEngineType = QINTERFACE_OPENCL;
+            testSubSubEngineType = QINTERFACE_OPENCL;
+            CreateQuantumInterface(QINTERFACE_OPENCL, 1, 0).reset(); /* Get the OpenCL banner out of the way. */
+            num_failed = session.run();
+        }
+#endif
+    }
+
     return num_failed;
 }
 
@@ -10,13 +10,16 @@
 // See LICENSE.md in the project root or https://www.gnu.org/licenses/lgpl-3.0.en.html
 // for details.
 
+#include <algorithm>
 #include <atomic>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "catch.hpp"
+#include "common/cpufeatures.hpp"
 #include "qfactory.hpp"
 #include "qneuron.hpp"
 
@@ -35,6 +38,7 @@ using namespace Qrack;
 
 void print_bin(int bits, int d);
 void log(QInterfacePtr p);
+void hermitian_propagator(const complex* h, real1 t, complex* u);
 
 void print_bin(int bits, int d)
 {
@@ -47,6 +51,20 @@ void print_bin(int bits, int d)
 
 void log(QInterfacePtr p) { std::cout << std::endl << std::showpoint << p << std::endl; }
 
+// The closed form of e^(-i * h * t), for a 2x2 Hermitian "h": with "h" = m * I + K, where K^2 = w^2 * I, it is
+// e^(-i * m * t) * (cos(w * t) * I - i * sin(w * t) / w * K).
+void hermitian_propagator(const complex* h, real1 t, complex* u)
+{
+    const real1 m = (real(h[0]) + real(h[3])) / 2;
+    const real1 w = sqrt(((real(h[0]) - real(h[3])) * (real(h[0]) - real(h[3])) / 4) + norm(h[1]));
+    const complex phase = complex(cos(m * t), -sin(m * t));
+    const complex sinTerm = complex(ZERO_R1, -sin(w * t) / w);
+    u[0] = phase * (cos(w * t) + sinTerm * (h[0] - m));
+    u[1] = phase * sinTerm * h[1];
+    u[2] = phase * sinTerm * h[2];
+    u[3] = phase * (cos(w * t) + sinTerm * (h[3] - m));
+}
+
 QInterfacePtr MakeEngine(bitLenInt qubitCount)
 {
     if (testSubEngineType == testSubSubEngineType) {
@@ -247,6 +265,70 @@ TEST_CASE("test_qengine_cpu_par_for_mask")
     });
 }
 
+TEST_CASE("test_qengine_cpu_simd_levels")
+{
+    // The QRACK_SIMD environment variable forces the plain kernels, (as the "qrack_tests_scalar" CTest entry does).
+    if (getenv("QRACK_SIMD") && (std::string(getenv("QRACK_SIMD")) == "none")) {
+        REQUIRE(GetSimdLevel() == SIMD_NONE);
+    }
+
+    const SimdLevel initLevel = GetSimdLevel();
+    const bitLenInt qubitCount = 9;
+    const bitCapIntOcl maxPower = pow2Ocl(qubitCount);
+
+    // Single bit gates, (normalized,) controlled gates with up to 7 controls, (where there are fewer pairs than vector
+    // lanes,) and uniformly controlled gates with short runs
+    auto runCircuit = [&](complex* output) {
+        QEngineCPUPtr qengine =
+            std::make_shared<QEngineCPU>(qubitCount, 0, nullptr, ONE_CMPLX, true, false, false, -1, false);
+        bitLenInt controls[8] = { 0, 2, 4, 6, 8, 1, 3, 5 };
+        real1 angles[128];
+        for (bitCapIntOcl i = 0; i < 128U; i++) {
+            angles[i] = (real1)(0.1 + 0.05 * i);
+        }
+
+        for (bitLenInt i = 0; i < qubitCount; i++) {
+            qengine->U(i, (real1)(0.3 + 0.2 * i), (real1)(0.5 - 0.1 * i), (real1)(0.7 * i));
+        }
+        for (bitLenInt c = 1; c < 8; c++) {
+            complex mtrx[4];
+            real1 angle = (real1)(0.4 * c);
+            mtrx[0] = complex(cos(angle), ZERO_R1);
+            mtrx[1] = complex(ZERO_R1, -sin(angle));
+            mtrx[2] = complex(ZERO_R1, -sin(angle));
+            mtrx[3] = complex(cos(angle), ZERO_R1);
+            qengine->ApplyControlledSingleBit(controls, c, 7, mtrx);
+        }
+        qengine->UniformlyControlledRY(controls, 2, 7, angles);
+        qengine->UniformlyControlledRY(controls, 7, 7, angles);
+        for (bitLenInt i = 0; i < qubitCount; i++) {
+            qengine->U(i, (real1)(0.2 * i), (real1)(0.1 + 0.3 * i), (real1)(0.6 - 0.05 * i));
+        }
+
+        qengine->GetQuantumState(output);
+    };
+
+    complex* reference = new complex[maxPower];
+    complex* state = new complex[maxPower];
+
+    REQUIRE(SetSimdLevel(SIMD_NONE) == SIMD_NONE);
+    runCircuit(reference);
+
+    for (int level = SIMD_SSE2; level <= DetectSimdLevel(); level++) {
+        REQUIRE(SetSimdLevel((SimdLevel)level) == level);
+        runCircuit(state);
+        for (bitCapIntOcl i = 0; i < maxPower; i++) {
+            REQUIRE_FLOAT(real(state[i]), real(reference[i]));
+            REQUIRE_FLOAT(imag(state[i]), imag(reference[i]));
+        }
+    }
+
+    SetSimdLevel(initLevel);
+
+    delete[] reference;
+    delete[] state;
+}
+
 TEST_CASE("test_exp2x2_log2x2")
 {
     complex mtrx1[4] = { complex(ONE_R1, ZERO_R1), complex(ZERO_R1, ZERO_R1), complex(ZERO_R1, ZERO_R1),
@@ -274,6 +356,33 @@ TEST_CASE("test_exp2x2_log2x2")
     REQUIRE_FLOAT(imag(mtrx1[3]), ZERO_R1);
 }
 
+TEST_CASE("test_exp2x2_log2x2_hermitian")
+{
+    // A Hermitian matrix with unequal diagonal entries tells each eigenvalue apart from the other's eigenvector.
+    const complex h[4] = { complex(0.9f, ZERO_R1), complex(0.3f, -0.4f), complex(0.3f, 0.4f), complex(-0.5f, ZERO_R1) };
+    const real1 t = 0.7f;
+    complex expected[4];
+    hermitian_propagator(h, t, expected);
+
+    complex mtrx1[4];
+    complex mtrx2[4];
+    for (bitLenInt i = 0; i < 4; i++) {
+        mtrx1[i] = complex(ZERO_R1, -t) * h[i];
+    }
+
+    exp2x2(mtrx1, mtrx2);
+    for (bitLenInt i = 0; i < 4; i++) {
+        REQUIRE_FLOAT(real(mtrx2[i]), real(expected[i]));
+        REQUIRE_FLOAT(imag(mtrx2[i]), imag(expected[i]));
+    }
+
+    log2x2(mtrx2, expected);
+    for (bitLenInt i = 0; i < 4; i++) {
+        REQUIRE_FLOAT(real(expected[i]), real(mtrx1[i]));
+        REQUIRE_FLOAT(imag(expected[i]), imag(mtrx1[i]));
+    }
+}
+
 #if ENABLE_OPENCL
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_oclengine")
 {
@@ -411,6 +520,135 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_swap")
     REQUIRE_THAT(qftReg, HasProbability(0x2b000));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_swap_relabel")
+{
+    // Gates between swaps act on relabeled bits, in engines that track a qubit map.
+    qftReg->SetPermutation(0x3A5);
+    qftReg->H(0, 3);
+    qftReg->T(1);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->Swap(0, 9);
+    qftReg->Reverse(2, 8);
+    qftReg->ROL(3, 4, 12);
+    qftReg->CNOT(0, 5);
+    qftReg->CZ(9, 2);
+    qftReg->RY(0.3, 4);
+    qftReg->FSim(0.4, 0.7, 5, 9);
+    qftReg->Swap(4, 7);
+
+    qftReg2->CNOT(0, 9);
+    qftReg2->CNOT(9, 0);
+    qftReg2->CNOT(0, 9);
+    for (bitLenInt i = 0; i < 3; i++) {
+        qftReg2->CNOT(2 + i, 7 - i);
+        qftReg2->CNOT(7 - i, 2 + i);
+        qftReg2->CNOT(2 + i, 7 - i);
+    }
+    qftReg2->ROL(3, 4, 12);
+    qftReg2->CNOT(0, 5);
+    qftReg2->CZ(9, 2);
+    qftReg2->RY(0.3, 4);
+    qftReg2->FSim(0.4, 0.7, 5, 9);
+    qftReg2->CNOT(4, 7);
+    qftReg2->CNOT(7, 4);
+    qftReg2->CNOT(4, 7);
+
+    REQUIRE(qftReg->Prob(9) == Approx(qftReg2->Prob(9)));
+    REQUIRE(qftReg->ProbReg(4, 8, 0x0A) == Approx(qftReg2->ProbReg(4, 8, 0x0A)));
+    REQUIRE(norm(qftReg->GetAmplitude(0x3A5) - qftReg2->GetAmplitude(0x3A5)) < 0.0001f);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->Swap(1, 3);
+    qftReg2->Swap(1, 3);
+    qftReg->INC(5, 0, 8);
+    qftReg2->INC(5, 0, 8);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_swap_amplitudes")
+{
+    // Swaps, and the (controlled) X gates applied as pure amplitude swaps, are checked amplitude by amplitude against a
+    // reference state vector, once with every amplitude occupied and once with only a few.
+    const bitLenInt qubitCount = 5;
+    const bitCapIntOcl maxPower = 1U << qubitCount;
+    const bitLenInt controls[2] = { 4, 1 };
+    std::vector<complex> reference(maxPower);
+    complex state[1U << 5U];
+
+    // For each index with every bit in "setMask" and no bit in "clearMask," pair its amplitude with the amplitude at
+    // the index with "flipMask" flipped.
+    auto refPairs = [&](bitCapIntOcl setMask, bitCapIntOcl clearMask, bitCapIntOcl flipMask,
+                        std::function<void(complex&, complex&)> fn) {
+        for (bitCapIntOcl i = 0; i < maxPower; i++) {
+            if (((i & setMask) == setMask) && !(i & clearMask)) {
+                fn(reference[i], reference[i ^ flipMask]);
+            }
+        }
+    };
+    auto swap = [](complex& a, complex& b) { std::swap(a, b); };
+    auto iSwap = [](complex& a, complex& b) {
+        std::swap(a, b);
+        a *= complex(ZERO_R1, ONE_R1);
+        b *= complex(ZERO_R1, ONE_R1);
+    };
+    auto sqrtSwap = [](complex& a, complex& b) {
+        const complex c0 = complex(ONE_R1 / 2, ONE_R1 / 2);
+        const complex c1 = complex(ONE_R1 / 2, -ONE_R1 / 2);
+        const complex a0 = a;
+        a = c0 * a0 + c1 * b;
+        b = c1 * a0 + c0 * b;
+    };
+
+    for (bitCapIntOcl stride = 1U; stride <= 8U; stride += 7U) {
+        real1 nrm = ZERO_R1;
+        for (bitCapIntOcl i = 0; i < maxPower; i++) {
+            reference[i] = ((i % stride) == 0U) ? complex((real1)(i + 1U), (real1)(i % 3U) - ONE_R1) : ZERO_CMPLX;
+            nrm += norm(reference[i]);
+        }
+        for (bitCapIntOcl i = 0; i < maxPower; i++) {
+            reference[i] /= (real1)sqrt(nrm);
+        }
+
+        if (testSubEngineType == testSubSubEngineType) {
+            qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, qubitCount, 0, rng, ONE_CMPLX,
+                enable_normalization, true, false, device_id, !disable_hardware_rng, sparse);
+        } else {
+            qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, qubitCount, 0, rng,
+                ONE_CMPLX, enable_normalization, true, false, device_id, !disable_hardware_rng, sparse);
+        }
+        qftReg->SetQuantumState(&(reference[0]));
+
+        // Engines that track a qubit map relabel bits on a swap, so the gates after it act on mapped bits.
+        qftReg->Swap(0, 3);
+        refPairs(0x01, 0x08, 0x09, swap);
+        qftReg->X(2);
+        refPairs(0x00, 0x04, 0x04, swap);
+        qftReg->CNOT(4, 0);
+        refPairs(0x10, 0x01, 0x01, swap);
+        qftReg->CCNOT(4, 1, 3);
+        refPairs(0x12, 0x08, 0x08, swap);
+        qftReg->AntiCNOT(1, 4);
+        refPairs(0x00, 0x12, 0x10, swap);
+        qftReg->CSwap(controls, 1, 0, 3);
+        refPairs(0x11, 0x08, 0x09, swap);
+        qftReg->AntiCSwap(controls + 1, 1, 2, 4);
+        refPairs(0x04, 0x12, 0x14, swap);
+        qftReg->CSwap(controls, 2, 0, 2);
+        refPairs(0x13, 0x04, 0x05, swap);
+        qftReg->ISwap(1, 4);
+        refPairs(0x02, 0x10, 0x12, iSwap);
+        qftReg->SqrtSwap(3, 0);
+        refPairs(0x08, 0x01, 0x09, sqrtSwap);
+
+        qftReg->GetQuantumState(state);
+        for (bitCapIntOcl i = 0; i < maxPower; i++) {
+            REQUIRE_FLOAT(real(state[i]), real(reference[i]));
+            REQUIRE_FLOAT(imag(state[i]), imag(reference[i]));
+        }
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_iswap")
 {
     qftReg->SetPermutation(1);
@@ -594,6 +832,164 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_fsim")
     REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x03));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_phase_parity")
+{
+    real1 radians = 0.7;
+
+    qftReg->SetPermutation(0);
+    qftReg->H(0, 2);
+    qftReg->PhaseParity(radians, 3);
+    complex amp0 = qftReg->GetAmplitude(0);
+    complex amp1 = qftReg->GetAmplitude(1);
+    complex amp2 = qftReg->GetAmplitude(2);
+    complex amp3 = qftReg->GetAmplitude(3);
+    complex oddPhase = complex(cos(radians), sin(radians));
+    REQUIRE(norm(amp1 - oddPhase * amp0) < 1e-5);
+    REQUIRE(norm(amp2 - oddPhase * amp0) < 1e-5);
+    REQUIRE(norm(amp3 - amp0) < 1e-5);
+
+    qftReg->PhaseParity(-radians, 3);
+    qftReg->H(0, 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x00));
+
+    qftReg->SetPermutation(0x05);
+    qftReg->H(1);
+    qftReg->PhaseParity(M_PI, 0x07);
+    qftReg->H(1);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x07));
+
+    // The gate agrees with the parity ladder decomposition, also when some of its bits are in known permutations.
+    qftReg->SetPermutation(0x29);
+    qftReg->H(0);
+    qftReg->H(4, 2);
+    qftReg->CNOT(4, 1);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+    qftReg->PhaseParity(0.8, 0x3B);
+    qftReg2->QInterface::PhaseParity(0.8, 0x3B);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_phase_batch")
+{
+    // Consecutive diagonal gates give the same state whether or not anything reads the state in between.
+    qftReg->SetPermutation(0x2C);
+    qftReg->H(0, 8);
+    qftReg->RY(0.5, 2);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->RZ(0.3, 0);
+    qftReg->CZ(1, 2);
+    qftReg->CPhaseRootN(3, 3, 4);
+    qftReg->ZeroPhaseFlip(0, 3);
+    qftReg->Swap(0, 5);
+    qftReg->PhaseFlipIfLess(5, 3, 4);
+    qftReg->PhaseParity(0.9, 0x51);
+    qftReg->T(6);
+    qftReg->H(1);
+    qftReg->S(2);
+    qftReg->PhaseParity(0.4, 0x06);
+    qftReg->ROL(2, 0, 8);
+    qftReg->CPhaseFlipIfLess(3, 0, 3, 7);
+    qftReg->RZ(1.1, 5);
+
+    qftReg2->RZ(0.3, 0);
+    qftReg2->GetAmplitude(0);
+    qftReg2->CZ(1, 2);
+    qftReg2->GetAmplitude(0);
+    qftReg2->CPhaseRootN(3, 3, 4);
+    qftReg2->GetAmplitude(0);
+    qftReg2->ZeroPhaseFlip(0, 3);
+    qftReg2->GetAmplitude(0);
+    qftReg2->Swap(0, 5);
+    qftReg2->PhaseFlipIfLess(5, 3, 4);
+    qftReg2->GetAmplitude(0);
+    qftReg2->PhaseParity(0.9, 0x51);
+    qftReg2->GetAmplitude(0);
+    qftReg2->T(6);
+    qftReg2->GetAmplitude(0);
+    qftReg2->H(1);
+    qftReg2->S(2);
+    qftReg2->GetAmplitude(0);
+    qftReg2->PhaseParity(0.4, 0x06);
+    qftReg2->GetAmplitude(0);
+    qftReg2->ROL(2, 0, 8);
+    qftReg2->CPhaseFlipIfLess(3, 0, 3, 7);
+    qftReg2->GetAmplitude(0);
+    qftReg2->RZ(1.1, 5);
+    qftReg2->GetAmplitude(0);
+
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE("test_qengine_cpu_global_phase_term")
+{
+    // Without a random global phase, the global part of a deferred diagonal gate is kept, as a scalar, until it is
+    // read, or carried along by the next pass over the state vector.
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(3, 0, nullptr, ONE_CMPLX, false, false);
+    const complex topLeft = complex((real1)cos(0.3), (real1)sin(0.3));
+    const complex bottomRight = complex((real1)cos(1.1), (real1)sin(1.1));
+    const complex oddPhase = complex((real1)cos(0.6), (real1)sin(0.6));
+
+    qengine->H(0);
+    qengine->ApplySinglePhase(topLeft, bottomRight, 1);
+    REQUIRE_FLOAT(norm(qengine->GetAmplitude(1) - topLeft * (real1)M_SQRT1_2), ZERO_R1);
+
+    qengine->H(2);
+    REQUIRE_FLOAT(norm(qengine->GetAmplitude(5) - topLeft / (real1)2), ZERO_R1);
+
+    qengine->PhaseParity(0.6, 0x5);
+    complex state[8];
+    qengine->GetQuantumState(state);
+    REQUIRE_FLOAT(norm(state[0] - complex(ONE_R1 / 2, ZERO_R1)), ZERO_R1);
+    REQUIRE_FLOAT(norm(state[1] - oddPhase / (real1)2), ZERO_R1);
+    REQUIRE_FLOAT(norm(state[4] - oddPhase / (real1)2), ZERO_R1);
+    REQUIRE_FLOAT(norm(state[5] - complex(ONE_R1 / 2, ZERO_R1)), ZERO_R1);
+    REQUIRE_FLOAT(norm(state[2]) + norm(state[3]) + norm(state[6]) + norm(state[7]), ZERO_R1);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_exp_pauli")
+{
+    const Pauli paulis[4] = { PauliX, PauliI, PauliY, PauliZ };
+    const bitLenInt qubits[4] = { 0, 5, 2, 3 };
+    const bitLenInt controls[2] = { 4, 6 };
+
+    // e^(i*pi/2*P) is i*P.
+    qftReg->SetPermutation(0x08);
+    qftReg->ExpPauli(paulis, qubits, 4, NULL, 0, M_PI / 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x0D));
+    qftReg->ExpPauli(paulis, qubits, 4, controls, 2, M_PI / 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x0D));
+    qftReg->X(4);
+    qftReg->X(6);
+    qftReg->ExpPauli(paulis, qubits, 4, controls, 2, M_PI / 2);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x58));
+
+    // The native kernels agree with the basis change and parity ladder decomposition.
+    qftReg->SetPermutation(0x2C);
+    qftReg->H(0, 8);
+    qftReg->RY(0.5, 2);
+    qftReg->CNOT(2, 5);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->ExpPauli(paulis, qubits, 4, NULL, 0, 0.3);
+    qftReg2->QInterface::ExpPauli(paulis, qubits, 4, NULL, 0, 0.3);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ExpPauli(paulis, qubits, 4, controls, 2, 0.7);
+    qftReg2->QInterface::ExpPauli(paulis, qubits, 4, controls, 2, 0.7);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    const Pauli zPaulis[3] = { PauliZ, PauliI, PauliZ };
+    qftReg->ExpPauli(zPaulis, qubits, 3, controls, 1, 1.1);
+    qftReg2->QInterface::ExpPauli(zPaulis, qubits, 3, controls, 1, 1.1);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    const Pauli iPaulis[2] = { PauliI, PauliI };
+    qftReg->ExpPauli(iPaulis, qubits, 2, controls, 2, 0.9);
+    qftReg2->QInterface::ExpPauli(iPaulis, qubits, 2, controls, 2, 0.9);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_single_bit")
 {
     complex pauliX[4] = { complex(0.0, 0.0), complex(1.0, 0.0), complex(1.0, 0.0), complex(0.0, 0.0) };
@@ -691,6 +1087,29 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_anticontrolled_single_bit")
     REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x01));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_controlled_global_phase")
+{
+    // A scalar matrix is only a global phase without controls, but a relative phase on the controls with them.
+    complex minusI[4] = { -ONE_CMPLX, ZERO_CMPLX, ZERO_CMPLX, -ONE_CMPLX };
+    bitLenInt controls[2] = { 0, 3 };
+
+    qftReg->SetPermutation(0x08);
+    qftReg->H(0);
+    qftReg->ApplyControlledSingleBit(controls, 2, 5, minusI);
+    qftReg->H(0);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x09));
+
+    qftReg->SetPermutation(0x00);
+    qftReg->H(0);
+    qftReg->ApplyAntiControlledSingleBit(controls, 2, 5, minusI);
+    qftReg->H(0);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x01));
+
+    qftReg->ApplyControlledSingleBit(NULL, 0, 5, minusI);
+    qftReg->ApplyAntiControlledSingleBit(NULL, 0, 5, minusI);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x01));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_anticontrolled_single_invert")
 {
     complex topRight = ONE_CMPLX;
@@ -780,6 +1199,187 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_anti_controlled_single_phase
     REQUIRE_THAT(qftReg, HasProbability(0x02));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_phase_invert_generic")
+{
+    bitLenInt controls[2] = { 0, 3 };
+    complex topLeft = complex(ONE_R1 / 2, -ONE_R1 / 2) * (real1)M_SQRT2;
+    complex bottomRight = complex(ZERO_R1, ONE_R1);
+
+    qftReg->SetPermutation(0x05);
+    qftReg->H(0, 6);
+    qftReg->RY(M_PI / 3, 2);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->ApplySinglePhase(topLeft, bottomRight, 1);
+    qftReg2->QInterface::ApplySinglePhase(topLeft, bottomRight, 1);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplySingleInvert(bottomRight, topLeft, 2);
+    qftReg2->QInterface::ApplySingleInvert(bottomRight, topLeft, 2);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplyControlledSinglePhase(controls, 2, 4, ONE_CMPLX, bottomRight);
+    qftReg2->QInterface::ApplyControlledSinglePhase(controls, 2, 4, ONE_CMPLX, bottomRight);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplyControlledSingleInvert(controls, 2, 1, topLeft, bottomRight);
+    qftReg2->QInterface::ApplyControlledSingleInvert(controls, 2, 1, topLeft, bottomRight);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplyAntiControlledSinglePhase(controls, 2, 5, topLeft, ONE_CMPLX);
+    qftReg2->QInterface::ApplyAntiControlledSinglePhase(controls, 2, 5, topLeft, ONE_CMPLX);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplyAntiControlledSingleInvert(controls, 2, 2, bottomRight, topLeft);
+    qftReg2->QInterface::ApplyAntiControlledSingleInvert(controls, 2, 2, bottomRight, topLeft);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_matrix")
+{
+    bitLenInt i, j;
+
+    // Two bit: the Kronecker product of two single bit gates, with the first target as the low index bit.
+    complex mtrxA[4] = { complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2), complex(ZERO_R1, M_SQRT1_2),
+        complex(M_SQRT1_2, ZERO_R1) };
+    complex mtrxB[4] = { complex(ONE_R1 / 2, ZERO_R1), complex(-sqrt(3) / 2, ZERO_R1), complex(sqrt(3) / 2, ZERO_R1),
+        complex(ONE_R1 / 2, ZERO_R1) };
+    complex kron[16];
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            kron[i * 4 + j] = mtrxB[(i >> 1) * 2 + (j >> 1)] * mtrxA[(i & 1) * 2 + (j & 1)];
+        }
+    }
+
+    bitLenInt targets2[2] = { 3, 1 };
+    qftReg->SetPermutation(0x0A);
+    qftReg->H(0, 4);
+    qftReg->T(1);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->ApplyMatrix(targets2, 2, kron);
+    qftReg2->ApplySingleBit(mtrxA, 3);
+    qftReg2->ApplySingleBit(mtrxB, 1);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+    qftReg->ApplyMatrix(targets2, 2, kron);
+    qftReg2->QInterface::ApplyMatrix(targets2, 2, kron);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    // Repeated targets are rejected, by the native kernel and by the default path alike.
+    bitLenInt repeated[2] = { 1, 1 };
+    REQUIRE_THROWS(qftReg->ApplyMatrix(repeated, 2, kron));
+    REQUIRE_THROWS(qftReg->QInterface::ApplyMatrix(repeated, 2, kron));
+
+    // Three bit: a Toffoli gate, targeting the most significant index bit.
+    complex toffoli[64];
+    std::fill(toffoli, toffoli + 64, ZERO_CMPLX);
+    for (i = 0; i < 8; i++) {
+        j = (i == 3) ? 7 : ((i == 7) ? 3 : i);
+        toffoli[i * 8 + j] = ONE_CMPLX;
+    }
+
+    bitLenInt targets3[3] = { 4, 0, 2 };
+    qftReg->SetPermutation(0x11);
+    qftReg->ApplyMatrix(targets3, 3, toffoli);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x15));
+    qftReg->ApplyMatrix(targets3, 3, toffoli);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0x11));
+
+    // Five bit: increment modulo 32.
+    complex inc[1024];
+    std::fill(inc, inc + 1024, ZERO_CMPLX);
+    for (i = 0; i < 32; i++) {
+        inc[((i + 1) & 31) * 32 + i] = ONE_CMPLX;
+    }
+
+    bitLenInt targets5[5] = { 0, 1, 2, 3, 4 };
+    qftReg->SetPermutation(31);
+    qftReg->ApplyMatrix(targets5, 5, inc);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 0));
+    qftReg->ApplyMatrix(targets5, 5, inc);
+    REQUIRE_THAT(qftReg, HasProbability(0, 8, 1));
+
+    // "FSim" with both a swap and a phase factor:
+    qftReg->SetPermutation(0x01);
+    qftReg->H(0, 2);
+    qftReg2 = qftReg->Clone();
+    qftReg->FSim(M_PI / 3, M_PI / 5, 0, 1);
+    qftReg2->FSim(M_PI / 3, ZERO_R1, 0, 1);
+    qftReg2->FSim(ZERO_R1, M_PI / 5, 0, 1);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE("test_apply_matrix_pending_norm")
+{
+    // SetAmplitude() leaves a normalization pending, which ApplyMatrix() should apply as it goes, as Apply2x2() does.
+    complex mtrxA[4] = { complex(M_SQRT1_2, ZERO_R1), complex(ZERO_R1, M_SQRT1_2), complex(ZERO_R1, M_SQRT1_2),
+        complex(M_SQRT1_2, ZERO_R1) };
+    complex mtrxB[4] = { complex(ONE_R1 / 2, ZERO_R1), complex(-sqrt(3) / 2, ZERO_R1), complex(sqrt(3) / 2, ZERO_R1),
+        complex(ONE_R1 / 2, ZERO_R1) };
+    complex kron[16];
+    for (bitLenInt i = 0; i < 4; i++) {
+        for (bitLenInt j = 0; j < 4; j++) {
+            kron[i * 4 + j] = mtrxB[(i >> 1) * 2 + (j >> 1)] * mtrxA[(i & 1) * 2 + (j & 1)];
+        }
+    }
+    bitLenInt targets[2] = { 2, 0 };
+
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(3, 0, nullptr, ONE_CMPLX, true, false, false, -1, false);
+    qengine->H(0, 2);
+    qengine->SetAmplitude(0, complex((real1)1.5, ZERO_R1));
+    QInterfacePtr qengine2 = qengine->Clone();
+
+    qengine->ApplyMatrix(targets, 2, kron);
+    qengine2->ApplySingleBit(mtrxA, 2);
+    qengine2->ApplySingleBit(mtrxB, 0);
+
+    complex state[8];
+    complex state2[8];
+    qengine->GetQuantumState(state);
+    qengine2->GetQuantumState(state2);
+
+    real1 totNorm = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < 8U; i++) {
+        REQUIRE_FLOAT(real(state[i]), real(state2[i]));
+        REQUIRE_FLOAT(imag(state[i]), imag(state2[i]));
+        totNorm += norm(state[i]);
+    }
+    REQUIRE_FLOAT(totNorm, ONE_R1);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_apply_single_bit_sequence")
+{
+    // Three passes over every bit of the register, (so at least some targets fall outside of any cache block,) with a
+    // different general unitary on each gate.
+    const bitLenInt qubitCount = qftReg->GetQubitCount();
+    const unsigned int gateCount = 3U * qubitCount;
+    bitLenInt* targets = new bitLenInt[gateCount];
+    complex* mtrxs = new complex[4U * gateCount];
+    real1 theta, phi, lambda;
+    for (unsigned int i = 0; i < gateCount; i++) {
+        targets[i] = (i * 7U) % qubitCount;
+        theta = (real1)(0.1 + 0.05 * i);
+        phi = (real1)(0.3 - 0.02 * i);
+        lambda = (real1)(0.7 + 0.03 * i);
+        mtrxs[4U * i] = complex(cos(theta / 2), ZERO_R1);
+        mtrxs[4U * i + 1U] = -exp(complex(ZERO_R1, lambda)) * sin(theta / 2);
+        mtrxs[4U * i + 2U] = exp(complex(ZERO_R1, phi)) * sin(theta / 2);
+        mtrxs[4U * i + 3U] = exp(complex(ZERO_R1, phi + lambda)) * cos(theta / 2);
+    }
+
+    qftReg->SetPermutation(0x5A5A5);
+    qftReg->H(0, 4);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->ApplySingleBitSequence(mtrxs, targets, gateCount);
+    qftReg2->QInterface::ApplySingleBitSequence(mtrxs, targets, gateCount);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+    REQUIRE_FLOAT(qftReg->Prob(qubitCount - 1), qftReg2->Prob(qubitCount - 1));
+
+    delete[] targets;
+    delete[] mtrxs;
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_u")
 {
     qftReg->SetReg(0, 8, 0x02);
@@ -3190,6 +3790,109 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_qft_h")
     REQUIRE_THAT(qftReg, HasProbability(0, 8, randPerm));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_qft_decomposition")
+{
+    // Native QFT implementations must match the gate decomposition, bit order included.
+    qftReg->SetPermutation(0x5A3C1);
+    qftReg->H(0, 12);
+    qftReg->RY(0.4, 5);
+    qftReg->CNOT(5, 18);
+    qftReg->T(2);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->QFT(3, 6);
+    qftReg2->QInterface::QFT(3, 6);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->IQFT(2, 17);
+    qftReg2->QInterface::IQFT(2, 17);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->QFT(0, 20);
+    qftReg2->QInterface::QFT(0, 20);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->Swap(4, 11);
+    qftReg->IQFT(14, 1);
+    qftReg->IQFT(9, 5);
+    qftReg2->Swap(4, 11);
+    qftReg2->QInterface::IQFT(14, 1);
+    qftReg2->QInterface::IQFT(9, 5);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_h_reg")
+{
+    // Register-wide H must match one H per bit, for both cache-blocked and full-pass bits.
+    qftReg->SetPermutation(0x5A3C1);
+    qftReg->RY(0.4, 5);
+    qftReg->CNOT(5, 18);
+    qftReg->T(2);
+    qftReg->Swap(1, 17);
+    qftReg->ZeroPhaseFlip(3, 4);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->H(0, 20);
+    qftReg2->QInterface::H(0, 20);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->H(3, 14);
+    qftReg2->QInterface::H(3, 14);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->H(15, 4);
+    qftReg2->QInterface::H(15, 4);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->SetPermutation(0x3C);
+    qftReg->H(0, 20);
+    qftReg->H(0, 20);
+    REQUIRE_THAT(qftReg, HasProbability(0x3C));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_single_bit_layer")
+{
+    // A layer must match one gate per bit, for both cache-blocked and full-pass bits.
+    complex mtrxs[4U * 20U];
+    for (bitLenInt i = 0; i < 20; i++) {
+        real1 theta = 0.3f * (i + 1);
+        real1 phi = 0.7f * i;
+        mtrxs[4U * i] = complex(cos(theta), ZERO_R1);
+        mtrxs[4U * i + 1U] = complex(-sin(theta) * cos(phi), -sin(theta) * sin(phi));
+        mtrxs[4U * i + 2U] = complex(sin(theta), ZERO_R1);
+        mtrxs[4U * i + 3U] = complex(cos(theta) * cos(phi), cos(theta) * sin(phi));
+    }
+    mtrxs[4U * 6U] = ONE_CMPLX;
+    mtrxs[4U * 6U + 1U] = ZERO_CMPLX;
+    mtrxs[4U * 6U + 2U] = ZERO_CMPLX;
+    mtrxs[4U * 6U + 3U] = ONE_CMPLX;
+
+    qftReg->SetPermutation(0x5A3C1);
+    qftReg->H(0, 4);
+    qftReg->CNOT(2, 18);
+    qftReg->Swap(1, 17);
+    qftReg->ZeroPhaseFlip(3, 4);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    qftReg->ApplySingleBitLayer(mtrxs, 0, 20);
+    qftReg2->QInterface::ApplySingleBitLayer(mtrxs, 0, 20);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplySingleBitLayer(mtrxs + 8, 3, 14);
+    qftReg2->QInterface::ApplySingleBitLayer(mtrxs + 8, 3, 14);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->ApplySingleBitLayer(mtrxs + 4, 14, 5);
+    qftReg2->QInterface::ApplySingleBitLayer(mtrxs + 4, 14, 5);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->U(2, 17, 0.4f, 1.1f, -0.3f);
+    for (bitLenInt i = 2; i < 19; i++) {
+        qftReg2->U(i, 0.4f, 1.1f, -0.3f);
+    }
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_isfinished") { REQUIRE(qftReg->isFinished()); }
 
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_tryseparate")
@@ -3449,6 +4152,36 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_clone")
     REQUIRE_THAT(qftReg2, HasProbability(0, 20, 0xd4));
 }
 
+TEST_CASE("test_qunit_clone_sparse")
+{
+    // Engines that a clone of a sparse QUnit makes, (here, in SetPermutation(),) must also be sparse, or entangling
+    // them with engines of the original mixes sparse and dense state vectors.
+    QInterfacePtr qUnit =
+        std::make_shared<QUnit>(QINTERFACE_CPU, 4, 0, nullptr, ONE_CMPLX, true, false, false, -1, false, true);
+    QInterfacePtr qUnit2 = qUnit->Clone();
+
+    qUnit->H(0);
+    qUnit->CNOT(0, 2);
+    qUnit->CNOT(0, 3);
+
+    qUnit2->SetPermutation(0x2);
+    qUnit2->H(0);
+    qUnit2->CNOT(0, 2);
+    qUnit2->CNOT(0, 3);
+
+    // (Reading a probability applies any buffered phase gates, which Compose() does not carry over.)
+    qUnit->ProbAll(0);
+    qUnit2->ProbAll(0);
+
+    qUnit->Compose(qUnit2);
+    qUnit->CNOT(2, 4);
+
+    REQUIRE_FLOAT(qUnit->ProbAll(0x20), ONE_R1 / 4);
+    REQUIRE_FLOAT(qUnit->ProbAll(0xF0), ONE_R1 / 4);
+    REQUIRE_FLOAT(qUnit->ProbAll(0x3D), ONE_R1 / 4);
+    REQUIRE_FLOAT(qUnit->ProbAll(0xED), ONE_R1 / 4);
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_decompose")
 {
     QInterfacePtr qftReg2 = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 4, 0, rng);
@@ -3551,6 +4284,24 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_probmask")
     REQUIRE(qftReg->ProbMask(0x3, 0x3) < 0.01);
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_proballqubits")
+{
+    qftReg->SetPermutation(0x8C215);
+    qftReg->H(0, 3);
+    qftReg->RY(0.7f, 9);
+    qftReg->CNOT(9, 16);
+    qftReg->RX(2.1f, 12);
+    qftReg->CCNOT(0, 1, 19);
+    qftReg->Swap(4, 17);
+    qftReg->Swap(2, 13);
+
+    real1 probs[20];
+    qftReg->ProbAllQubits(probs);
+    for (bitLenInt i = 0; i < 20; i++) {
+        REQUIRE_FLOAT(probs[i], qftReg->Prob(i));
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_probmaskall")
 {
     // We're trying to hit a hardware-specific case of the method, by allocating 1 qubit, but it might not work if the
@@ -3571,6 +4322,50 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_probmaskall")
     }
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_probmaskall_histogram")
+{
+    // Compare the single-pass marginals against outcome-by-outcome ProbMask(), for a contiguous register and for a
+    // scattered mask, after swaps have permuted the physical qubit order.
+    qftReg->SetPermutation(0x2C5A3);
+    qftReg->H(0, 6);
+    qftReg->RY(0.7f, 7);
+    qftReg->CNOT(7, 12);
+    qftReg->RX(1.3f, 15);
+    qftReg->CNOT(3, 17);
+    qftReg->Swap(2, 14);
+    qftReg->Swap(5, 9);
+
+    const bitCapInt masks[3] = { 0xF0, 0x8A214, 0x0 };
+    for (int m = 0; m < 3; m++) {
+        bitLenInt length = 0;
+        std::vector<bitCapInt> powers;
+        for (bitLenInt i = 0; i < 20; i++) {
+            if ((masks[m] >> i) & 1U) {
+                powers.push_back(pow2(i));
+                length++;
+            }
+        }
+
+        real1* probs = new real1[pow2Ocl(length)];
+        qftReg->ProbMaskAll(masks[m], probs);
+
+        real1 totProb = ZERO_R1;
+        for (bitCapIntOcl j = 0; j < pow2Ocl(length); j++) {
+            bitCapInt perm = 0;
+            for (bitLenInt i = 0; i < length; i++) {
+                if ((j >> i) & 1U) {
+                    perm |= powers[i];
+                }
+            }
+            REQUIRE_FLOAT(probs[j], qftReg->ProbMask(masks[m], perm));
+            totProb += probs[j];
+        }
+        REQUIRE_FLOAT(totProb, ONE_R1);
+
+        delete[] probs;
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_multishotmeasuremask")
 {
     qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 8, 0, rng);
@@ -3592,6 +4387,185 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_multishotmeasuremask")
     }
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_multishotmeasuremask_distribution")
+{
+    bitCapInt qPowers[4] = { pow2(9), pow2(1), pow2(15), pow2(4) };
+
+    qftReg->SetPermutation(0);
+    qftReg->RY(0.6f, 9);
+    qftReg->RY(1.9f, 1);
+    qftReg->H(15);
+    qftReg->CNOT(15, 4);
+    qftReg->RY(2.4f, 4);
+
+    const unsigned int shots = 200000U;
+    std::map<bitCapInt, int> results = qftReg->MultiShotMeasureMask(qPowers, 4U, shots);
+
+    int totCount = 0;
+    for (bitCapInt key = 0; key < 16U; key++) {
+        bitCapInt perm = 0;
+        for (bitLenInt i = 0; i < 4U; i++) {
+            if ((key >> i) & 1U) {
+                perm |= qPowers[i];
+            }
+        }
+        const real1 prob = qftReg->ProbMask(pow2(9) | pow2(1) | pow2(15) | pow2(4), perm);
+        const int count = (results.find(key) == results.end()) ? 0 : results[key];
+        totCount += count;
+        // Well over 5 standard deviations of a binomial count, at these probabilities
+        REQUIRE(std::abs(count - (int)(prob * shots)) < 1200);
+    }
+    REQUIRE(totCount == (int)shots);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_multishotmeasuremask_full")
+{
+    // Every qubit, in a scrambled result order, after swaps have permuted the physical qubit order, with fewer shots
+    // than permutations
+    qftReg = CreateQuantumInterface(testEngineType, testSubEngineType, testSubSubEngineType, 14, 0, rng);
+    bitCapInt qPowers[14];
+    for (bitLenInt i = 0; i < 14U; i++) {
+        qPowers[i] = pow2((5U * i) % 14U);
+    }
+
+    qftReg->SetPermutation(0x2421);
+    qftReg->RY(0.8f, 0);
+    qftReg->H(3);
+    qftReg->CNOT(3, 6);
+    qftReg->RY(2.2f, 9);
+    qftReg->H(12);
+    qftReg->Swap(0, 13);
+    qftReg->Swap(2, 9);
+
+    const unsigned int shots = 10000U;
+    std::map<bitCapInt, int> results = qftReg->MultiShotMeasureMask(qPowers, 14U, shots);
+
+    int totCount = 0;
+    real1 totProb = ZERO_R1;
+    std::map<bitCapInt, int>::iterator it;
+    for (it = results.begin(); it != results.end(); it++) {
+        bitCapInt perm = 0;
+        for (bitLenInt i = 0; i < 14U; i++) {
+            if ((it->first >> i) & 1U) {
+                perm |= qPowers[i];
+            }
+        }
+        const real1 prob = qftReg->ProbAll(perm);
+        REQUIRE(prob > ZERO_R1);
+        REQUIRE(std::abs(it->second - (int)(prob * shots)) < 300);
+        totCount += it->second;
+        totProb += prob;
+    }
+    REQUIRE(totCount == (int)shots);
+    REQUIRE_FLOAT(totProb, ONE_R1);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_expectation_qubo")
+{
+    qftReg->SetPermutation(0);
+    qftReg->H(0, 4);
+    qftReg->RY(0.7f, 11);
+    qftReg->CNOT(3, 17);
+    qftReg->RX(1.3f, 6);
+    qftReg->Swap(2, 6);
+
+    const bitLenInt length = 5;
+    const bitLenInt qubits[length] = { 11, 3, 17, 0, 6 };
+    const real1 weights[length * length] = { 2, -1, 0, 3, 0, 0, -2, 1, 0, 2, 1, 0, 1, 0, -3, 0, 2, 0, -1, 0, 1, -1, 0,
+        2, 3 };
+    const real1 fields[length] = { 1, -2, 0, 3, -1 };
+    const real1 couplings[length * length] = { 0, 1, -1, 0, 2, 0, 0, 2, 0, 0, 0, 0, 0, -1, 1, 0, 0, 0, 0, 3, 0, 0, 0, 0,
+        0 };
+
+    // Brute force, over the whole probability distribution
+    const bitCapIntOcl binCount = 41U;
+    real1 expectedQubo = ZERO_R1;
+    real1 expectedIsing = ZERO_R1;
+    std::vector<real1> quboHist(binCount, ZERO_R1);
+    std::vector<real1> isingHist(binCount, ZERO_R1);
+    real1* probs = new real1[1U << 20U];
+    qftReg->GetProbs(probs);
+    for (bitCapIntOcl perm = 0; perm < (1U << 20U); perm++) {
+        bool x[length];
+        for (bitLenInt i = 0; i < length; i++) {
+            x[i] = (perm >> qubits[i]) & 1U;
+        }
+        real1 qubo = ZERO_R1;
+        real1 ising = ZERO_R1;
+        for (bitLenInt i = 0; i < length; i++) {
+            ising += fields[i] * (x[i] ? -1 : 1);
+            for (bitLenInt j = 0; j < length; j++) {
+                qubo += (x[i] && x[j]) ? weights[i * length + j] : ZERO_R1;
+                if (j > i) {
+                    ising += couplings[i * length + j] * ((x[i] == x[j]) ? 1 : -1);
+                }
+            }
+        }
+        expectedQubo += probs[perm] * qubo;
+        expectedIsing += probs[perm] * ising;
+        quboHist[(bitCapIntOcl)(qubo + 20)] += probs[perm];
+        isingHist[(bitCapIntOcl)(ising + 20)] += probs[perm];
+    }
+    delete[] probs;
+
+    real1 hist[binCount];
+    REQUIRE_FLOAT(qftReg->ExpectationQUBO(qubits, length, weights), expectedQubo);
+    REQUIRE_FLOAT(qftReg->ExpectationQUBO(qubits, length, weights, hist, binCount, -20.5f, 20.5f), expectedQubo);
+    for (bitCapIntOcl i = 0; i < binCount; i++) {
+        REQUIRE_FLOAT(hist[i], quboHist[i]);
+    }
+    REQUIRE_FLOAT(qftReg->ExpectationIsing(qubits, length, fields, couplings, hist, binCount, -20.5f, 20.5f),
+        expectedIsing);
+    for (bitCapIntOcl i = 0; i < binCount; i++) {
+        REQUIRE_FLOAT(hist[i], isingHist[i]);
+    }
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_expectation_pauli")
+{
+    // A Bell pair on (1, 18), a Y eigenstate on 5, and a Y rotation on 11, with the physical qubit order permuted
+    qftReg->SetPermutation(0);
+    qftReg->H(14);
+    qftReg->CNOT(14, 18);
+    qftReg->Swap(14, 1);
+    qftReg->H(7);
+    qftReg->S(7);
+    qftReg->Swap(7, 5);
+    qftReg->RY(0.9f, 11);
+
+    const bitLenInt qubits[4] = { 1, 18, 5, 11 };
+    const Pauli paulis[9][4] = {
+        { PauliX, PauliX, PauliI, PauliI },
+        { PauliY, PauliY, PauliI, PauliI },
+        { PauliZ, PauliZ, PauliI, PauliI },
+        { PauliZ, PauliI, PauliI, PauliI },
+        { PauliI, PauliI, PauliY, PauliI },
+        { PauliI, PauliI, PauliX, PauliI },
+        { PauliI, PauliI, PauliI, PauliZ },
+        { PauliI, PauliI, PauliI, PauliX },
+        { PauliX, PauliX, PauliY, PauliX },
+    };
+    const real1 expected[9] = { ONE_R1, -ONE_R1, ONE_R1, ZERO_R1, ONE_R1, ZERO_R1, (real1)cos(0.9f), (real1)sin(0.9f),
+        (real1)sin(0.9f) };
+
+    for (int s = 0; s < 9; s++) {
+        REQUIRE_FLOAT(qftReg->ExpectationPauli(paulis[s], qubits, 4), expected[s]);
+    }
+
+    real1 expectations[9];
+    qftReg->ExpectationPauliAll(&(paulis[0][0]), qubits, 4, 9, expectations);
+    for (int s = 0; s < 9; s++) {
+        REQUIRE_FLOAT(expectations[s], expected[s]);
+    }
+
+    // The state is left as it was.
+    REQUIRE_FLOAT(qftReg->ProbMask(pow2(1) | pow2(18), 0), 0.5);
+    REQUIRE_FLOAT(qftReg->Prob(11), (real1)((ONE_R1 - cos(0.9f)) / 2));
+    qftReg->IS(5);
+    qftReg->H(5);
+    REQUIRE_FLOAT(qftReg->Prob(5), ZERO_R1);
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_forcem")
 {
     qftReg->SetPermutation(0x0);
@@ -3624,6 +4598,141 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_forcem")
     REQUIRE_THAT(qftReg, HasProbability(0xE6));
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_forcem_collapse")
+{
+    // The collapsed state must come out normalized, including through a qubit map, with the surviving correlations.
+    qftReg->SetPermutation(0x0);
+    qftReg->H(0, 4);
+    qftReg->RY(0.9f, 5);
+    qftReg->CNOT(5, 11);
+    qftReg->CNOT(2, 12);
+    qftReg->Swap(1, 14);
+    qftReg->Swap(0, 9);
+
+    bool b = qftReg->M(11);
+    REQUIRE_FLOAT(qftReg->Prob(5), b ? ONE_R1 : ZERO_R1);
+
+    bitLenInt bits[2] = { 14, 9 };
+    bitCapInt result = qftReg->M(bits, 2);
+    REQUIRE_FLOAT(qftReg->ProbMask(pow2(14) | pow2(9), result), ONE_R1);
+
+    result = qftReg->MReg(2, 1) | (qftReg->MReg(12, 2) << 1U);
+    REQUIRE(((result & 1U) == ((result >> 1U) & 1U)));
+
+    qftReg->ForceM(3, true);
+    real1 probs[16];
+    qftReg->ProbMaskAll(0xF, probs);
+    real1 totProb = ZERO_R1;
+    for (bitCapIntOcl i = 0; i < 16; i++) {
+        totProb += probs[i];
+    }
+    REQUIRE_FLOAT(totProb, ONE_R1);
+    REQUIRE_FLOAT(qftReg->Prob(3), ONE_R1);
+
+    // Outcomes are drawn with the Born rule probabilities, for single bits and for registers. (The bounds are 5
+    // standard deviations of a binomial count, on a small register, so the trials stay cheap.)
+    const int trials = 10000;
+    const real1 theta = 2 * asin(sqrt(0.3f));
+    qftReg = MakeEngine(3);
+    int ones = 0;
+    int regCounts[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < trials; i++) {
+        qftReg->SetPermutation(0x0);
+        qftReg->RY(theta, 2);
+        qftReg->CNOT(2, 0);
+        qftReg->H(1);
+        if (qftReg->M(0)) {
+            ones++;
+        }
+        REQUIRE_FLOAT(qftReg->Prob(2), qftReg->Prob(0));
+
+        qftReg->SetPermutation(0x0);
+        qftReg->RY(theta, 2);
+        qftReg->H(1);
+        regCounts[qftReg->MReg(1, 2)]++;
+    }
+    REQUIRE(std::abs(ones - (int)(0.3 * trials)) < 230);
+    const real1 regProbs[4] = { 0.35f, 0.35f, 0.15f, 0.15f };
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(std::abs(regCounts[i] - (int)(regProbs[i] * trials)) < 240);
+    }
+}
+
+TEST_CASE("test_forcem_amplitude_floor")
+{
+    // Survivors under the amplitude floor are dropped only if a collapse replaces a pending normalization, as
+    // NormalizeState() would have dropped them. Otherwise, a measurement keeps them, on every measurement path.
+    const complex tiny = complex((real1)1e-8f, ZERO_R1);
+    const complex state[8] = { complex((real1)0.6f, ZERO_R1), tiny, complex((real1)0.8f, ZERO_R1), ZERO_CMPLX,
+        ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX, ZERO_CMPLX };
+
+    QEngineCPUPtr qengine = std::make_shared<QEngineCPU>(3, 0, nullptr, ONE_CMPLX, true, false, false, -1, false);
+    qengine->SetQuantumState(state);
+    qengine->ForceM(1, false);
+    REQUIRE(norm(qengine->GetAmplitude(1)) > ZERO_R1);
+    REQUIRE_FLOAT(norm(qengine->GetAmplitude(0)), ONE_R1);
+
+    qengine->SetQuantumState(state);
+    REQUIRE(qengine->ForceMReg(1, 2, 0) == 0);
+    REQUIRE(norm(qengine->GetAmplitude(1)) > ZERO_R1);
+
+    // SetAmplitude() leaves a normalization pending.
+    qengine->SetQuantumState(state);
+    qengine->SetAmplitude(0, complex((real1)1.2f, ZERO_R1));
+    qengine->ForceM(1, false);
+    REQUIRE(norm(qengine->GetAmplitude(1)) == ZERO_R1);
+    REQUIRE_FLOAT(norm(qengine->GetAmplitude(0)), ONE_R1);
+
+    qengine->SetQuantumState(state);
+    qengine->SetAmplitude(0, complex((real1)1.2f, ZERO_R1));
+    REQUIRE(qengine->ForceMReg(1, 2, 0) == 0);
+    REQUIRE(norm(qengine->GetAmplitude(1)) == ZERO_R1);
+
+    // Measuring and disposing of a register follows the same rule for the bits that are kept.
+    qengine->SetQuantumState(state);
+    REQUIRE(qengine->ForceMRegDispose(2, 1, 0) == 0);
+    REQUIRE(qengine->GetQubitCount() == 2);
+    REQUIRE(norm(qengine->GetAmplitude(1)) > ZERO_R1);
+
+    qengine = std::make_shared<QEngineCPU>(3, 0, nullptr, ONE_CMPLX, true, false, false, -1, false);
+    qengine->SetQuantumState(state);
+    qengine->SetAmplitude(0, complex((real1)1.2f, ZERO_R1));
+    REQUIRE(qengine->ForceMRegDispose(2, 1, 0) == 0);
+    REQUIRE(norm(qengine->GetAmplitude(1)) == ZERO_R1);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_mregdispose")
+{
+    qftReg->SetPermutation(0x0);
+    qftReg->H(0);
+    qftReg->CNOT(0, 9);
+    qftReg->H(3);
+    qftReg->CNOT(3, 15);
+    qftReg->RY(0.7f, 5);
+    qftReg->Swap(1, 12);
+    qftReg->X(12);
+
+    // Qubits 8 and 9 are measured and dropped, and 10 through 19 shift down by 2.
+    bitCapInt result = qftReg->MRegDispose(8, 2);
+    REQUIRE(qftReg->GetQubitCount() == 18);
+    REQUIRE((result & 1U) == 0);
+    REQUIRE_FLOAT(qftReg->Prob(0), (result >> 1U) ? ONE_R1 : ZERO_R1);
+    REQUIRE_FLOAT(qftReg->Prob(10), ONE_R1);
+    REQUIRE_FLOAT(qftReg->Prob(5), sin(0.35f) * sin(0.35f));
+    REQUIRE_FLOAT(qftReg->Prob(13), 0.5f);
+
+    // Forcing old qubit 3 to |1> leaves its partner, (old qubit 15, now 11,) in |1> too.
+    REQUIRE(qftReg->ForceMRegDispose(2, 2, 0x2) == 0x2);
+    REQUIRE(qftReg->GetQubitCount() == 16);
+    REQUIRE_FLOAT(qftReg->Prob(11), ONE_R1);
+    REQUIRE_FLOAT(qftReg->Prob(8), ONE_R1);
+    REQUIRE_FLOAT(qftReg->Prob(0), (result >> 1U) ? ONE_R1 : ZERO_R1);
+
+    real1 probs[4];
+    qftReg->ProbMaskAll(0x9, probs);
+    REQUIRE_FLOAT(probs[0] + probs[1] + probs[2] + probs[3], ONE_R1);
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_getamplitude")
 {
     qftReg->SetPermutation(0x03);
@@ -3631,6 +4740,67 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_getamplitude")
     REQUIRE(norm((qftReg->GetAmplitude(0x01)) + (qftReg->GetAmplitude(0x03))) < 0.01);
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_gettopamplitudes")
+{
+    // Three separable rotations and a Bell pair, behind a qubit map, leave 16 nonzero amplitudes.
+    qftReg->SetPermutation(0x80001);
+    qftReg->RY(0.3f, 2);
+    qftReg->RY(0.9f, 7);
+    qftReg->RY(1.7f, 13);
+    qftReg->H(5);
+    qftReg->CNOT(5, 17);
+    qftReg->Swap(2, 11);
+    qftReg->Swap(0, 7);
+
+    real1* probs = new real1[1U << 20U];
+    qftReg->GetProbs(probs);
+    std::vector<real1> sorted(probs, probs + (1U << 20U));
+    std::sort(sorted.begin(), sorted.end(), std::greater<real1>());
+
+    std::vector<std::pair<bitCapInt, complex>> top = qftReg->GetTopAmplitudes(5U);
+    REQUIRE(top.size() == 5U);
+    for (size_t i = 0; i < top.size(); i++) {
+        REQUIRE_FLOAT(norm(top[i].second), sorted[i]);
+        REQUIRE_FLOAT(norm(top[i].second), probs[(bitCapIntOcl)top[i].first]);
+        REQUIRE_FLOAT(norm(top[i].second - qftReg->GetAmplitude(top[i].first)), ZERO_R1);
+    }
+    delete[] probs;
+
+    top = qftReg->GetTopAmplitudes(40U);
+    REQUIRE(top.size() == 16U);
+    real1 totProb = ZERO_R1;
+    for (size_t i = 0; i < top.size(); i++) {
+        totProb += norm(top[i].second);
+        if (i > 0) {
+            REQUIRE(norm(top[i].second) <= norm(top[i - 1U].second));
+        }
+    }
+    REQUIRE_FLOAT(totProb, ONE_R1);
+
+    REQUIRE(qftReg->GetTopAmplitudes(0U).size() == 0U);
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_getamplitudes")
+{
+    qftReg->SetPermutation(0x40003);
+    qftReg->H(0, 4);
+    qftReg->CNOT(2, 11);
+    qftReg->RY(0.6f, 7);
+    qftReg->T(3);
+    qftReg->Swap(1, 16);
+
+    bitCapInt perms[6] = { 0x40003, 0x40002, 0x4080B, 0x5008E, 0x40886, 0x7 };
+    complex amps[6];
+    real1 probs[6];
+    qftReg->GetAmplitudes(perms, 6, amps);
+    qftReg->ProbAllBatch(perms, 6, probs);
+    for (bitLenInt i = 0; i < 6; i++) {
+        REQUIRE_FLOAT(norm(amps[i] - qftReg->GetAmplitude(perms[i])), ZERO_R1);
+        REQUIRE_FLOAT(probs[i], qftReg->ProbAll(perms[i]));
+    }
+    REQUIRE(norm(amps[5]) < 0.01);
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_getquantumstate")
 {
     complex state[1U << 4U];
@@ -4403,6 +5573,41 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve")
     REQUIRE_FLOAT(abs((ONE_R1 - qftReg->Prob(0)) - cos(aParam * tDiff) * cos(aParam * tDiff)), 0);
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_closed_form")
+{
+    // Exp() and TimeEvolve() with a Hermitian matrix with unequal diagonal entries both apply e^(-i * H * t).
+    const real1 tDiff = 0.7f;
+    BitOp mtrx(new complex[4], std::default_delete<complex[]>());
+    mtrx.get()[0] = complex(0.9f, ZERO_R1);
+    mtrx.get()[1] = complex(0.3f, -0.4f);
+    mtrx.get()[2] = complex(0.3f, 0.4f);
+    mtrx.get()[3] = complex(-0.5f, ZERO_R1);
+    complex expected[4];
+    hermitian_propagator(mtrx.get(), tDiff, expected);
+
+    complex scaled[4];
+    for (bitLenInt i = 0; i < 4; i++) {
+        scaled[i] = -tDiff * mtrx.get()[i];
+    }
+
+    Hamiltonian h(1);
+    h[0] = std::make_shared<HamiltonianOp>(2, mtrx);
+
+    // (The global phase is arbitrary, so compare the amplitudes of |1> relative to |0>.)
+    for (int method = 0; method < 2; method++) {
+        qftReg->SetPermutation(0);
+        if (method == 0) {
+            qftReg->Exp(NULL, 0, 2, scaled);
+        } else {
+            qftReg->TimeEvolve(h, tDiff);
+        }
+        REQUIRE_FLOAT(qftReg->Prob(2), norm(expected[2]));
+        const complex ratio = qftReg->GetAmplitude(4) / qftReg->GetAmplitude(0);
+        REQUIRE_FLOAT(real(ratio), real(expected[2] / expected[0]));
+        REQUIRE_FLOAT(imag(ratio), imag(expected[2] / expected[0]));
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_uniform")
 {
     real1 aParam = (real1)1e-4;
@@ -4434,6 +5639,254 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_uniform")
     REQUIRE_FLOAT(abs((ONE_R1 - qftReg->Prob(0)) - cos(aParam * tDiff) * cos(aParam * tDiff)), 0);
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_prepared")
+{
+    real1 tDiff = 0.7f;
+
+    BitOp mtrxA(new complex[4], std::default_delete<complex[]>());
+    mtrxA.get()[0] = complex(0.3f, ZERO_R1);
+    mtrxA.get()[1] = complex(0.5f, -0.2f);
+    mtrxA.get()[2] = complex(0.5f, 0.2f);
+    mtrxA.get()[3] = complex(-0.4f, ZERO_R1);
+
+    BitOp mtrxB(new complex[4], std::default_delete<complex[]>());
+    mtrxB.get()[0] = complex(-0.6f, ZERO_R1);
+    mtrxB.get()[1] = complex(ZERO_R1, 0.9f);
+    mtrxB.get()[2] = complex(ZERO_R1, -0.9f);
+    mtrxB.get()[3] = complex(0.1f, ZERO_R1);
+
+    BitOp mtrxU(new complex[8], std::default_delete<complex[]>());
+    std::copy(mtrxA.get(), mtrxA.get() + 4, mtrxU.get());
+    std::copy(mtrxB.get(), mtrxB.get() + 4, mtrxU.get() + 4);
+
+    bitLenInt controls[2] = { 3, 5 };
+    bitLenInt reversed[2] = { 5, 3 };
+    bool toggles[2] = { true, false };
+
+    // Same-target terms separated by disjoint terms are fused, and toggled terms on one target share a uniform pass.
+    Hamiltonian h;
+    h.push_back(std::make_shared<HamiltonianOp>(0, mtrxA));
+    h.push_back(std::make_shared<HamiltonianOp>(controls, 2, 4, mtrxB, false, toggles));
+    h.push_back(std::make_shared<HamiltonianOp>(1, mtrxB));
+    h.push_back(std::make_shared<HamiltonianOp>(0, mtrxB));
+    h.push_back(std::make_shared<HamiltonianOp>(reversed, 2, 4, mtrxA, true, toggles));
+    h.push_back(std::make_shared<HamiltonianOp>(controls, 2, 4, mtrxA));
+    h.push_back(std::make_shared<HamiltonianOp>(controls, 1, 2, mtrxA, true));
+    h.push_back(std::make_shared<UniformHamiltonianOp>(controls, 1, 6, mtrxU));
+    h.push_back(std::make_shared<HamiltonianOp>(4, mtrxA));
+    h.push_back(std::make_shared<HamiltonianOp>(6, mtrxB));
+
+    PreparedHamiltonian prepared(h);
+    REQUIRE(prepared.GetSteps().size() < h.size());
+
+    qftReg->SetPermutation(0x5A3C1);
+    qftReg->H(0, 8);
+    qftReg->T(3);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    // Apply the original per-op algorithm, with toggles as X gates, for reference.
+    auto referenceEvolve = [&](real1 t) {
+        for (size_t i = 0; i < h.size(); i++) {
+            HamiltonianOpPtr op = h[i];
+            const bitCapIntOcl mtrxCount = op->uniform ? (4U << op->controlLen) : 4U;
+            std::vector<complex> mtrx(mtrxCount);
+            std::vector<complex> expMtrx(mtrxCount);
+            for (bitCapIntOcl j = 0; j < mtrxCount; j++) {
+                mtrx[j] = op->matrix.get()[j] * (-t);
+            }
+            for (bitLenInt j = 0; op->toggles && (j < op->controlLen); j++) {
+                if (op->toggles[j]) {
+                    qftReg2->X(op->controls[j]);
+                }
+            }
+            if (op->uniform) {
+                for (bitCapIntOcl j = 0; j < mtrxCount; j += 4U) {
+                    exp2x2(&(mtrx[j]), &(expMtrx[j]));
+                }
+                qftReg2->UniformlyControlledSingleBit(op->controls, op->controlLen, op->targetBit, &(expMtrx[0]));
+            } else {
+                qftReg2->Exp(op->controls, op->controlLen, op->targetBit, &(mtrx[0]), op->anti);
+            }
+            for (bitLenInt j = 0; op->toggles && (j < op->controlLen); j++) {
+                if (op->toggles[j]) {
+                    qftReg2->X(op->controls[j]);
+                }
+            }
+        }
+    };
+
+    qftReg->TimeEvolve(prepared, tDiff);
+    referenceEvolve(tDiff);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    // Cached and recomputed time steps give the same result.
+    qftReg->TimeEvolve(prepared, tDiff);
+    referenceEvolve(tDiff);
+    qftReg->TimeEvolve(prepared, -tDiff / 2);
+    referenceEvolve(-tDiff / 2);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    qftReg->TimeEvolve(h, tDiff);
+    referenceEvolve(tDiff);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    // The preparation is reused for the same ops, but not with stale matrices, if an op matrix changes in place.
+    qftReg->TimeEvolve(h, tDiff);
+    referenceEvolve(tDiff);
+    mtrxA.get()[0] = complex(-0.8f, ZERO_R1);
+    qftReg->TimeEvolve(h, tDiff);
+    referenceEvolve(tDiff);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_timeevolve_exact")
+{
+    real1 tDiff = 0.7f;
+
+    BitOp mtrxA(new complex[4], std::default_delete<complex[]>());
+    mtrxA.get()[0] = complex(0.3f, ZERO_R1);
+    mtrxA.get()[1] = complex(0.5f, -0.2f);
+    mtrxA.get()[2] = complex(0.5f, 0.2f);
+    mtrxA.get()[3] = complex(-0.4f, ZERO_R1);
+
+    BitOp mtrxB(new complex[4], std::default_delete<complex[]>());
+    mtrxB.get()[0] = complex(-0.6f, ZERO_R1);
+    mtrxB.get()[1] = complex(ZERO_R1, 0.9f);
+    mtrxB.get()[2] = complex(ZERO_R1, -0.9f);
+    mtrxB.get()[3] = complex(0.1f, ZERO_R1);
+
+    BitOp mtrxZ(new complex[4], std::default_delete<complex[]>());
+    mtrxZ.get()[0] = complex(0.8f, ZERO_R1);
+    mtrxZ.get()[1] = ZERO_CMPLX;
+    mtrxZ.get()[2] = ZERO_CMPLX;
+    mtrxZ.get()[3] = complex(-0.8f, ZERO_R1);
+
+    BitOp mtrxU(new complex[8], std::default_delete<complex[]>());
+    std::copy(mtrxA.get(), mtrxA.get() + 4, mtrxU.get());
+    std::copy(mtrxB.get(), mtrxB.get() + 4, mtrxU.get() + 4);
+
+    qftReg->SetPermutation(0x5A3C1);
+    qftReg->H(0, 8);
+    qftReg->T(3);
+    QInterfacePtr qftReg2 = qftReg->Clone();
+
+    // When the ops commute, the exact propagator is the product of the per-op exponentials.
+    bitLenInt controls[2] = { 1, 5 };
+    bool toggles[1] = { true };
+    Hamiltonian h;
+    h.push_back(std::make_shared<HamiltonianOp>(0, mtrxA));
+    h.push_back(std::make_shared<HamiltonianOp>(controls, 1, 3, mtrxB, false, toggles));
+    h.push_back(std::make_shared<HamiltonianOp>(1, mtrxZ));
+    h.push_back(std::make_shared<UniformHamiltonianOp>(controls + 1, 1, 6, mtrxU));
+
+    qftReg->TimeEvolveExact(h, tDiff);
+
+    complex scaled[8];
+    complex expMtrx[8];
+    for (bitLenInt i = 0; i < 3; i++) {
+        complex* opMtrx = h[i]->matrix.get();
+        for (bitLenInt j = 0; j < 4; j++) {
+            scaled[j] = opMtrx[j] * (-tDiff);
+        }
+        if (h[i]->toggles) {
+            qftReg2->X(h[i]->controls[0]);
+        }
+        qftReg2->Exp(h[i]->controls, h[i]->controlLen, h[i]->targetBit, scaled);
+        if (h[i]->toggles) {
+            qftReg2->X(h[i]->controls[0]);
+        }
+    }
+    for (bitLenInt j = 0; j < 8; j++) {
+        scaled[j] = complex(ZERO_R1, -tDiff) * mtrxU.get()[j];
+    }
+    exp2x2(scaled, expMtrx);
+    exp2x2(scaled + 4, expMtrx + 4);
+    qftReg2->UniformlyControlledSingleBit(controls + 1, 1, 6, expMtrx);
+
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    // For commuting ops that are not uniform, TimeEvolve() and TimeEvolveExact() agree.
+    // (Uniform ops are the exception, since TimeEvolve() exponentiates their blocks as e^(-H * t).)
+    h.pop_back();
+    qftReg2 = qftReg->Clone();
+    qftReg->TimeEvolveExact(h, -tDiff);
+    qftReg2->TimeEvolve(h, -tDiff);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+
+    // Non-commuting ops: compare against a reference from the dense Hamiltonian, on a small register.
+    h.clear();
+    h.push_back(std::make_shared<HamiltonianOp>(0, mtrxA));
+    h.push_back(std::make_shared<HamiltonianOp>(0, mtrxB));
+    h.push_back(std::make_shared<HamiltonianOp>(controls, 1, 0, mtrxZ));
+    h.push_back(std::make_shared<HamiltonianOp>(controls + 1, 1, 1, mtrxA, true));
+
+    const bitLenInt qubitCount = 6;
+    const bitCapIntOcl maxPower = 1U << qubitCount;
+    qftReg = MakeEngine(qubitCount);
+    qftReg->SetPermutation(0x2C);
+    qftReg->H(0, qubitCount);
+    qftReg->T(1);
+    qftReg->RY(0.4f, 5);
+    qftReg2 = qftReg->Clone();
+
+    // H * "in," summed over the ops, (none of which has toggles or is uniform)
+    auto applyHamiltonian = [&](const std::vector<complex>& in, std::vector<complex>& out) {
+        std::fill(out.begin(), out.end(), ZERO_CMPLX);
+        for (size_t i = 0; i < h.size(); i++) {
+            const HamiltonianOp& op = *(h[i]);
+            const bitCapIntOcl targetPower = 1U << op.targetBit;
+            bitCapIntOcl controlMask = 0;
+            for (bitLenInt j = 0; j < op.controlLen; j++) {
+                controlMask |= 1U << op.controls[j];
+            }
+            for (bitCapIntOcl k = 0; k < maxPower; k++) {
+                if ((k & controlMask) != (op.anti ? 0 : controlMask)) {
+                    continue;
+                }
+                const complex* row = op.matrix.get() + ((k & targetPower) ? 2U : 0U);
+                out[k] += row[0] * in[k & ~targetPower] + row[1] * in[k | targetPower];
+            }
+        }
+    };
+
+    // e^(-i * H * t), by a Taylor series over short substeps
+    std::vector<complex> reference(maxPower);
+    std::vector<complex> term(maxPower);
+    std::vector<complex> nextTerm(maxPower);
+    qftReg->GetQuantumState(&(reference[0]));
+    const int substeps = 100;
+    const complex dt = complex(ZERO_R1, -3 * tDiff / substeps);
+    for (int s = 0; s < substeps; s++) {
+        term = reference;
+        for (int order = 1; order <= 10; order++) {
+            applyHamiltonian(term, nextTerm);
+            for (bitCapIntOcl k = 0; k < maxPower; k++) {
+                term[k] = nextTerm[k] * dt / (real1)order;
+                reference[k] += term[k];
+            }
+        }
+    }
+
+    qftReg->TimeEvolveExact(h, 3 * tDiff);
+    complex state[1U << 6U];
+    qftReg->GetQuantumState(state);
+    for (bitCapIntOcl k = 0; k < maxPower; k++) {
+        REQUIRE_FLOAT(real(state[k]), real(reference[k]));
+        REQUIRE_FLOAT(imag(state[k]), imag(reference[k]));
+    }
+
+    // (The ordered product of per-op exponentials differs, since the ops do not commute.)
+    qftReg2->TimeEvolve(h, 3 * tDiff);
+    REQUIRE_FALSE(qftReg->ApproxCompare(qftReg2));
+
+    // Evolving back returns to the original state.
+    qftReg2 = qftReg->Clone();
+    qftReg->TimeEvolveExact(h, -3 * tDiff);
+    qftReg2->SetQuantumState(&(reference[0]));
+    qftReg2->TimeEvolveExact(h, -3 * tDiff);
+    REQUIRE(qftReg->ApproxCompare(qftReg2));
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_qfusion_controlled")
 {
     bitLenInt controls[2] = { 1, 2 };
@@ -4455,6 +5908,58 @@ TEST_CASE_METHOD(QInterfaceTestFixture, "test_qfusion_controlled")
     }
 }
 
+TEST_CASE_METHOD(QInterfaceTestFixture, "test_qfusion_buffering")
+{
+    QInterfacePtr fused = std::make_shared<QFusion>(QINTERFACE_CPU, 6, 0, rng, ONE_CMPLX, false, false);
+    QInterfacePtr unfused = CreateQuantumInterface(QINTERFACE_CPU, 6, 0, rng, ONE_CMPLX, false, false);
+
+    QInterfacePtr regs[2] = { fused, unfused };
+    for (int i = 0; i < 2; i++) {
+        QInterfacePtr qReg = regs[i];
+        qReg->H(0, 2);
+        qReg->T(0);
+        qReg->CNOT(0, 2);
+        qReg->CNOT(0, 3);
+        // These two cancel, and the buffer should be dropped.
+        qReg->S(2);
+        qReg->IS(2);
+        qReg->AntiCNOT(1, 4);
+        qReg->CCNOT(0, 1, 5);
+        qReg->RY(0.3, 5);
+        qReg->CZ(2, 3);
+        qReg->X(4);
+        qReg->X(4);
+    }
+    REQUIRE_FLOAT(fused->Prob(5), unfused->Prob(5));
+    REQUIRE_FLOAT(fused->ProbReg(2, 2, 3), unfused->ProbReg(2, 2, 3));
+
+    for (int i = 0; i < 2; i++) {
+        QInterfacePtr qReg = regs[i];
+        qReg->CRZ(0.7, 5, 1);
+        qReg->Swap(1, 4);
+        qReg->RZ(0.7, 1);
+        qReg->INC(3, 0, 4);
+        qReg->H(3);
+        qReg->Compose(CreateQuantumInterface(QINTERFACE_CPU, 2, 0, rng, ONE_CMPLX, false, false));
+        qReg->X(6);
+        qReg->CY(6, 2);
+    }
+    REQUIRE(fused->GetQubitCount() == 8);
+    REQUIRE_FLOAT(fused->Prob(2), unfused->Prob(2));
+
+    for (int i = 0; i < 2; i++) {
+        regs[i]->Dispose(6, 2, 1);
+    }
+
+    complex a, b;
+    for (bitCapInt i = 0; i < 64; i++) {
+        a = fused->GetAmplitude(i);
+        b = unfused->GetAmplitude(i);
+        REQUIRE_FLOAT(real(a), real(b));
+        REQUIRE_FLOAT(imag(a), imag(b));
+    }
+}
+
 TEST_CASE_METHOD(QInterfaceTestFixture, "test_qneuron")
 {
     const bitLenInt InputCount = 4;